@@ -428,7 +428,7 @@ void CL_ParseDownload (qboolean dataIsCompressed)
 		if (!uncompressedLen)
 			Com_Error (ERR_DROP, "uncompressedLen == 0");
 
-		ZLibDecompress (net_message_buffer + net_message.readcount, size, uncompressed, uncompressedLen, -15);
+		ZLibDecompress (net_message_buffer + net_message.readcount, size, uncompressed, uncompressedLen, -15, false);
 		fwrite (uncompressed, 1, uncompressedLen, cls.download);
 		Com_DPrintf ("svc_zdownload(%s): %d -> %d\n", cls.downloadname, size, uncompressedLen);
 #else
@@ -615,7 +615,7 @@ void CL_ParseBaseline (void)
 	CL_ParseDelta (&null_entity_state, es, newnum, bits);
 }
 
-void CL_ParseZPacket (void)
+void CL_ParseZPacket (int extrabits)
 {
 #ifndef NO_ZLIB
 	byte buff_in[MAX_MSGLEN];
@@ -635,7 +635,8 @@ void CL_ParseZPacket (void)
 	MSG_ReadData (&net_message, buff_in, compressed_len);
 
 	SZ_Init (&sb, buff_out, uncompressed_len);
-	sb.cursize = ZLibDecompress (buff_in, compressed_len, buff_out, uncompressed_len, -15);
+	sb.cursize = ZLibDecompress (buff_in, compressed_len, buff_out, uncompressed_len, -15,
+		cls.protocolVersion >= MINOR_VERSION_R1Q2_ZDICT && (extrabits & ZPACKET_DICTIONARY));
 
 	old = net_message;
 	net_message = sb;
@@ -1408,7 +1409,7 @@ qboolean CL_ParseServerMessage (void)
 		// ************** r1q2 specific BEGIN ****************
 		case svc_zpacket:
 			//contents of zpackets are written to demo implicity on decompress
-			CL_ParseZPacket();
+			CL_ParseZPacket (extrabits);
 			break;
 
 		case svc_zdownload:
@@ -277,6 +277,116 @@ int range (edict_t *self, edict_t *other)
 	return RANGE_FAR;
 }
 
+/*
+=============
+AI_PrecomputeSight
+
+With g_parallel_ai set, the visible() checks every monster is going to make
+against level.sight_client and its enemy are traced up front on the
+server's worker threads.  visible() uses a result only if both eye
+positions are still exactly the ones that were traced, otherwise it traces
+as usual.  A door that moves earlier in the same frame is not seen until
+the next one, the same as for any monster ahead of it in the edict list.
+=============
+*/
+#define	SIGHT_SLOTS		2
+
+typedef struct
+{
+	edict_t		*self, *other;
+	vec3_t		spot1, spot2;
+	int			stamp;
+	qboolean	visible;
+} aisight_t;
+
+static aisight_t	ai_sight[MAX_EDICTS][SIGHT_SLOTS];
+static aisight_t	*ai_sightjobs[MAX_EDICTS * SIGHT_SLOTS];
+static int			ai_sightstamp;
+static int			ai_sightframe = -1;
+
+static void AI_SightJob (int job)
+{
+	aisight_t	*s;
+	trace_t		trace;
+
+	s = ai_sightjobs[job];
+	trace = gi.TraceThreadSafe (s->spot1, vec3_origin, vec3_origin, s->spot2, s->self, MASK_OPAQUE);
+	s->visible = (trace.fraction == 1.0);
+}
+
+static void AI_QueueSight (edict_t *self, edict_t *other, int slot, int *numjobs)
+{
+	aisight_t	*s;
+
+	s = &ai_sight[self - g_edicts][slot];
+	s->self = self;
+	s->other = other;
+	VectorCopy (self->s.origin, s->spot1);
+	s->spot1[2] += self->viewheight;
+	VectorCopy (other->s.origin, s->spot2);
+	s->spot2[2] += other->viewheight;
+	s->stamp = ai_sightstamp;
+
+	ai_sightjobs[(*numjobs)++] = s;
+}
+
+void AI_PrecomputeSight (void)
+{
+	edict_t	*ent;
+	int		i, numjobs;
+
+	ai_sightframe = -1;
+
+	if (!g_parallel_ai->value || !((int)sv_features->value & GMF_RUNWORKERS))
+		return;
+
+	ai_sightstamp++;
+	numjobs = 0;
+
+	for (i = game.maxclients + 1, ent = g_edicts + i; i < globals.num_edicts && i < MAX_EDICTS; i++, ent++)
+	{
+		if (!ent->inuse || !(ent->svflags & SVF_MONSTER) || ent->deadflag || ent->health <= 0)
+			continue;
+
+		if (level.sight_client)
+			AI_QueueSight (ent, level.sight_client, 0, &numjobs);
+
+		if (ent->enemy && ent->enemy->inuse && ent->enemy != level.sight_client)
+			AI_QueueSight (ent, ent->enemy, 1, &numjobs);
+	}
+
+	if (!numjobs)
+		return;
+
+	gi.RunWorkers (AI_SightJob, numjobs);
+	ai_sightframe = level.framenum;
+}
+
+static qboolean AI_CachedSight (edict_t *self, edict_t *other, vec3_t spot1, vec3_t spot2, qboolean *visible)
+{
+	aisight_t	*s;
+	int			i, num;
+
+	if (ai_sightframe != level.framenum)
+		return false;
+
+	num = self - g_edicts;
+	if (num < 0 || num >= MAX_EDICTS)
+		return false;
+
+	for (i = 0, s = ai_sight[num]; i < SIGHT_SLOTS; i++, s++)
+	{
+		if (s->stamp != ai_sightstamp || s->self != self || s->other != other)
+			continue;
+		if (!VectorCompare (s->spot1, spot1) || !VectorCompare (s->spot2, spot2))
+			continue;
+		*visible = s->visible;
+		return true;
+	}
+
+	return false;
+}
+
 /*
 =============
 visible
@@ -286,14 +396,19 @@ returns 1 if the entity is visible to self, even if not infront ()
 */
 qboolean visible (edict_t *self, edict_t *other)
 {
-	vec3_t	spot1;
-	vec3_t	spot2;
-	trace_t	trace;
+	vec3_t		spot1;
+	vec3_t		spot2;
+	trace_t		trace;
+	qboolean	cached;
 
 	VectorCopy (self->s.origin, spot1);
 	spot1[2] += self->viewheight;
 	VectorCopy (other->s.origin, spot2);
 	spot2[2] += other->viewheight;
+
+	if (AI_CachedSight (self, other, spot1, spot2, &cached))
+		return cached;
+
 	trace = gi.trace (spot1, vec3_origin, vec3_origin, spot2, self, MASK_OPAQUE);
 	
 	if (trace.fraction == 1.0)
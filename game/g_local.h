@@ -527,6 +527,7 @@ extern	cvar_t	*timelimit;
 extern	cvar_t	*password;
 extern	cvar_t	*spectator_password;
 extern	cvar_t	*g_select_empty;
+extern	cvar_t	*g_parallel_ai;
 extern	cvar_t	*dedicated;
 
 extern	cvar_t	*filterban;
@@ -545,6 +546,7 @@ extern	cvar_t	*bob_pitch;
 extern	cvar_t	*bob_roll;
 
 extern	cvar_t	*sv_cheats;
+extern	cvar_t	*sv_features;
 extern	cvar_t	*maxclients;
 extern	cvar_t	*maxspectators;
 
@@ -631,8 +633,13 @@ void Touch_Item (edict_t *ent, edict_t *other, cplane_t *plane, csurface_t *surf
 //
 qboolean	KillBox (edict_t *ent);
 void	G_ProjectSource (vec3_t point, vec3_t distance, vec3_t forward, vec3_t right, vec3_t result);
+void	G_InitEdictIndex (void);
+void	G_ClearEdictIndex (void);
+void	G_IndexEdict (edict_t *ent);
 edict_t *G_Find (edict_t *from, int fieldofs, char *match);
 edict_t *findradius (edict_t *from, vec3_t org, float rad);
+extern	void (EXPORT *G_ServerLinkEntity) (edict_t *ent);
+void	EXPORT G_LinkEntity (edict_t *ent);
 edict_t *G_PickTarget (char *targetname);
 void	G_UseTargets (edict_t *ent, edict_t *activator);
 void	G_SetMovedir (vec3_t angles, vec3_t movedir);
@@ -710,6 +717,7 @@ void BecomeExplosion1(edict_t *self);
 // g_ai.c
 //
 void AI_SetSightClient (void);
+void AI_PrecomputeSight (void);
 
 void ai_stand (edict_t *self, float dist);
 void ai_move (edict_t *self, float dist);
@@ -803,6 +811,12 @@ void M_ChangeYaw (edict_t *ent);
 // g_phys.c
 //
 void G_RunEntity (edict_t *ent);
+void G_InitThinkQueue (void);
+void G_ClearThinkQueue (void);
+void G_WakeEdict (edict_t *ent);
+void G_WakeDueEdicts (void);
+qboolean G_EdictAsleep (int num);
+void G_CheckSleep (edict_t *ent);
 
 //
 // g_main.c
@@ -44,6 +44,7 @@ cvar_t	*maxclients;
 cvar_t	*maxspectators;
 cvar_t	*maxentities;
 cvar_t	*g_select_empty;
+cvar_t	*g_parallel_ai;
 cvar_t	*dedicated;
 
 cvar_t	*filterban;
@@ -64,6 +65,7 @@ cvar_t	*bob_pitch;
 cvar_t	*bob_roll;
 
 cvar_t	*sv_cheats;
+cvar_t	*sv_features;
 
 cvar_t	*flood_msgs;
 cvar_t	*flood_persecond;
@@ -83,6 +85,8 @@ void WriteGame (const char *filename, qboolean autosave);
 void ReadGame (const char *filename);
 void WriteLevel (const char *filename);
 void ReadLevel (const char *filename);
+void *WriteLevelBuffer (int *length);
+void ReadLevelBuffer (const void *data, int length);
 void InitGame (void);
 void G_RunFrame (void);
 
@@ -111,6 +115,10 @@ game_export_t __attribute__ ((visibility("default"), externally_visible)) *GetGa
 {
 	gi = *import;
 
+	//r1: findradius wants to know when anything is linked
+	G_ServerLinkEntity = gi.linkentity;
+	gi.linkentity = G_LinkEntity;
+
 	globals.apiversion = GAME_API_VERSION;
 	globals.Init = InitGame;
 	globals.Shutdown = ShutdownGame;
@@ -134,6 +142,9 @@ game_export_t __attribute__ ((visibility("default"), externally_visible)) *GetGa
 
 	globals.edict_size = sizeof(edict_t);
 
+	globals.WriteLevelBuffer = WriteLevelBuffer;
+	globals.ReadLevelBuffer = ReadLevelBuffer;
+
 	return &globals;
 }
 
@@ -361,6 +372,8 @@ void G_RunFrame (void)
 	// choose a client for monsters to target this frame
 	AI_SetSightClient ();
 
+	G_WakeDueEdicts ();
+
 	// exit intermissions
 
 	if (level.exitintermission)
@@ -369,6 +382,9 @@ void G_RunFrame (void)
 		return;
 	}
 
+	// trace monster sight on the server's workers before anyone thinks
+	AI_PrecomputeSight ();
+
 	//
 	// treat each object in turn
 	// even the world gets a chance to think
@@ -376,6 +392,13 @@ void G_RunFrame (void)
 	ent = &g_edicts[0];
 	for (i=0 ; i<globals.num_edicts ; i++, ent++)
 	{
+		// dormant, nothing to do until woken
+		if (G_EdictAsleep (i))
+			continue;
+
+		// pick up any field written directly since the last frame
+		G_IndexEdict (ent);
+
 		if (!ent->inuse)
 			continue;
 
@@ -400,6 +423,7 @@ void G_RunFrame (void)
 		}
 
 		G_RunEntity (ent);
+		G_CheckSleep (ent);
 	}
 
 	// see if it is time to end a deathmatch
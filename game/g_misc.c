@@ -1706,6 +1706,7 @@ void func_clock_think (edict_t *self)
 	}
 
 	self->enemy->message = self->message;
+	G_WakeEdict (self->enemy);
 	self->enemy->use (self->enemy, self, self);
 
 	if (((self->spawnflags & 1) && (self->health > self->wait)) ||
@@ -110,6 +110,178 @@ qboolean SV_RunThink (edict_t *ent)
 	return false;
 }
 
+/*
+=============
+Think queue
+
+An edict with no physics to run (MOVETYPE_NONE, no prethink, not standing
+on anything, nothing to lerp) that has no think due is put to sleep and
+G_RunFrame skips it without touching it.  Sleepers with a nextthink sit in
+a min-heap keyed on it and are woken the frame it comes due, the same frame
+SV_RunThink would have fired.  Anything that calls into a sleeper (use,
+touch, pain, die, blocked) or writes its movetype or think directly, such
+as CopyToBodyQue, must G_WakeEdict it first since its fields may change.
+G_InitEdict and G_FreeEdict do so as well.
+=============
+*/
+typedef struct
+{
+	float		waketime;
+	int			heappos;	// -1 if not in the heap
+	qboolean	asleep;
+} thinkslot_t;
+
+static thinkslot_t	*think_slots;
+static int			*think_heap;
+static int			think_heapsize;
+
+static void G_ThinkHeapSwap (int a, int b)
+{
+	int		e;
+
+	e = think_heap[a];
+	think_heap[a] = think_heap[b];
+	think_heap[b] = e;
+
+	think_slots[think_heap[a]].heappos = a;
+	think_slots[think_heap[b]].heappos = b;
+}
+
+static void G_ThinkHeapUp (int i)
+{
+	int		parent;
+
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (think_slots[think_heap[parent]].waketime <= think_slots[think_heap[i]].waketime)
+			break;
+		G_ThinkHeapSwap (i, parent);
+		i = parent;
+	}
+}
+
+static void G_ThinkHeapDown (int i)
+{
+	int		child;
+
+	for (;;)
+	{
+		child = i * 2 + 1;
+		if (child >= think_heapsize)
+			break;
+		if (child + 1 < think_heapsize && think_slots[think_heap[child + 1]].waketime < think_slots[think_heap[child]].waketime)
+			child++;
+		if (think_slots[think_heap[i]].waketime <= think_slots[think_heap[child]].waketime)
+			break;
+		G_ThinkHeapSwap (i, child);
+		i = child;
+	}
+}
+
+void G_ClearThinkQueue (void)
+{
+	int		i;
+
+	if (!think_slots)
+		return;
+
+	for (i = 0; i < game.maxentities; i++)
+	{
+		think_slots[i].asleep = false;
+		think_slots[i].heappos = -1;
+	}
+
+	think_heapsize = 0;
+}
+
+// slots are TAG_GAME like g_edicts, call again whenever it is reallocated
+void G_InitThinkQueue (void)
+{
+	think_slots = gi.TagMalloc (game.maxentities * sizeof(thinkslot_t), TAG_GAME);
+	think_heap = gi.TagMalloc (game.maxentities * sizeof(int), TAG_GAME);
+	G_ClearThinkQueue ();
+}
+
+void G_WakeEdict (edict_t *ent)
+{
+	thinkslot_t	*slot;
+	int			pos;
+
+	if (!think_slots)
+		return;
+
+	slot = think_slots + (ent - g_edicts);
+	if (!slot->asleep)
+		return;
+
+	slot->asleep = false;
+
+	pos = slot->heappos;
+	if (pos == -1)
+		return;
+
+	slot->heappos = -1;
+	think_heapsize--;
+	if (pos == think_heapsize)
+		return;
+
+	think_heap[pos] = think_heap[think_heapsize];
+	think_slots[think_heap[pos]].heappos = pos;
+	G_ThinkHeapDown (pos);
+	G_ThinkHeapUp (pos);
+}
+
+void G_WakeDueEdicts (void)
+{
+	while (think_heapsize && think_slots[think_heap[0]].waketime <= level.time + 0.001)
+		G_WakeEdict (g_edicts + think_heap[0]);
+}
+
+qboolean G_EdictAsleep (int num)
+{
+	return think_slots && think_slots[num].asleep;
+}
+
+// called by G_RunFrame once ent has had its turn
+void G_CheckSleep (edict_t *ent)
+{
+	thinkslot_t	*slot;
+	int			num;
+
+	if (!think_slots)
+		return;
+
+	num = ent - g_edicts;
+	if (num <= game.maxclients)
+		return;
+
+	if (!ent->inuse || ent->movetype != MOVETYPE_NONE || ent->prethink || ent->groundentity)
+		return;
+
+	if (ent->flags & FL_TEAMSLAVE)
+		return;
+
+	// G_RunFrame copies origin to old_origin, sleeping must not skip that
+	if (!VectorCompare (ent->s.origin, ent->s.old_origin))
+		return;
+
+	// not worth the heap traffic for something thinking again next frame
+	if (ent->nextthink > 0 && ent->nextthink <= level.time + FRAMETIME + 0.001)
+		return;
+
+	slot = think_slots + num;
+	slot->asleep = true;
+
+	if (ent->nextthink > 0)
+	{
+		slot->waketime = ent->nextthink;
+		slot->heappos = think_heapsize;
+		think_heap[think_heapsize++] = num;
+		G_ThinkHeapUp (slot->heappos);
+	}
+}
+
 /*
 ==================
 SV_Impact
@@ -128,7 +300,10 @@ void SV_Impact (edict_t *e1, trace_t *trace)
 		e1->touch (e1, e2, &trace->plane, trace->surface);
 	
 	if (e2->touch && e2->solid != SOLID_NOT)
+	{
+		G_WakeEdict (e2);
 		e2->touch (e2, e1, NULL, NULL);
+	}
 }
 
 
@@ -165,6 +165,10 @@ void InitGame (void)
 
 	// noset vars
 	dedicated = gi.cvar ("dedicated", "0", CVAR_NOSET);
+	sv_features = gi.cvar ("sv_features", "0", CVAR_NOSET);
+
+	//r1: tell the server which extra exports we have
+	gi.cvar_forceset ("g_features", va("%d", GMF_MEMLEVELS));
 
 	// latched vars
 	sv_cheats = gi.cvar ("cheats", "0", CVAR_SERVERINFO|CVAR_LATCH);
@@ -187,6 +191,7 @@ void InitGame (void)
 	filterban = gi.cvar ("filterban", "1", 0);
 
 	g_select_empty = gi.cvar ("g_select_empty", "0", CVAR_ARCHIVE);
+	g_parallel_ai = gi.cvar ("g_parallel_ai", "0", 0);
 
 	run_pitch = gi.cvar ("run_pitch", "0.002", 0);
 	run_roll = gi.cvar ("run_roll", "0.005", 0);
@@ -212,6 +217,8 @@ void InitGame (void)
 	g_edicts =  gi.TagMalloc (game.maxentities * sizeof(g_edicts[0]), TAG_GAME);
 	globals.edicts = g_edicts;
 	globals.max_edicts = game.maxentities;
+	G_InitEdictIndex ();
+	G_InitThinkQueue ();
 
 	// initialize all clients for this game
 	game.maxclients = maxclients->value;
@@ -221,7 +228,143 @@ void InitGame (void)
 
 //=========================================================
 
-void WriteField1 (FILE *f, field_t *field, byte *base)
+/*
+==============
+Save buffers
+
+r1: savegames are built in memory and written with a single fwrite, and
+read back whole with a single fread.  The body is the same struct-then-
+strings stream id always wrote, only the header is new, so files without
+the magic are read with the old header and still load.
+==============
+*/
+#define	SAVEGAME_MAGIC		(('G'<<24)+('S'<<16)+('1'<<8)+'R')	// "R1SG"
+#define	SAVELEVEL_MAGIC		(('L'<<24)+('S'<<16)+('1'<<8)+'R')	// "R1SL"
+#define	SAVE_VERSION		1
+
+typedef struct
+{
+	byte		*data;
+	int			cursize;
+	int			maxsize;
+	int			readcount;
+	const char	*filename;
+} savebuf_t;
+
+static void SB_Write (savebuf_t *b, const void *data, int len)
+{
+	if (b->cursize + len > b->maxsize)
+	{
+		b->maxsize = (b->cursize + len) * 2;
+		if (b->maxsize < 0x10000)
+			b->maxsize = 0x10000;
+		b->data = realloc (b->data, b->maxsize);
+		if (!b->data)
+			gi.error ("SB_Write: couldn't allocate %d bytes for %s", b->maxsize, b->filename);
+	}
+
+	memcpy (b->data + b->cursize, data, len);
+	b->cursize += len;
+}
+
+static void SB_Read (savebuf_t *b, void *data, int len)
+{
+	if (len < 0 || b->readcount + len > b->cursize)
+	{
+		free (b->data);
+		b->data = NULL;
+		gi.error ("%s is truncated", b->filename);
+	}
+
+	memcpy (data, b->data + b->readcount, len);
+	b->readcount += len;
+}
+
+static void SB_WriteFile (savebuf_t *b)
+{
+	FILE	*f;
+	int		ok;
+
+	f = fopen (b->filename, "wb");
+	if (!f)
+	{
+		free (b->data);
+		gi.error ("Couldn't open %s", b->filename);
+	}
+
+	ok = (!b->cursize || fwrite (b->data, b->cursize, 1, f) == 1);
+	fclose (f);
+	free (b->data);
+	b->data = NULL;
+
+	if (!ok)
+		gi.error ("Couldn't write %s", b->filename);
+}
+
+static void SB_ReadFile (savebuf_t *b, const char *filename)
+{
+	FILE	*f;
+	long	len;
+
+	memset (b, 0, sizeof(*b));
+	b->filename = filename;
+
+	f = fopen (filename, "rb");
+	if (!f)
+		gi.error ("Couldn't open %s", filename);
+
+	fseek (f, 0, SEEK_END);
+	len = ftell (f);
+	fseek (f, 0, SEEK_SET);
+
+	if (len < 0)
+	{
+		fclose (f);
+		gi.error ("Couldn't read %s", filename);
+	}
+
+	b->data = malloc (len > 0 ? len : 1);
+	if (!b->data || (len > 0 && fread (b->data, len, 1, f) != 1))
+	{
+		fclose (f);
+		free (b->data);
+		gi.error ("Couldn't read %s", filename);
+	}
+
+	fclose (f);
+	b->cursize = b->maxsize = len;
+}
+
+static qboolean SB_CheckMagic (savebuf_t *b, int magic)
+{
+	int		value;
+
+	if (b->cursize < (int)sizeof(value))
+		return false;
+
+	memcpy (&value, b->data, sizeof(value));
+	if (LittleLong (value) != magic)
+		return false;
+
+	b->readcount = sizeof(value);
+	return true;
+}
+
+static void SB_WriteInt (savebuf_t *b, int value)
+{
+	value = LittleLong (value);
+	SB_Write (b, &value, sizeof(value));
+}
+
+static int SB_ReadInt (savebuf_t *b)
+{
+	int		value;
+
+	SB_Read (b, &value, sizeof(value));
+	return LittleLong (value);
+}
+
+void WriteField1 (field_t *field, byte *base)
 {
 	void		*p;
 	int			len;
@@ -294,7 +437,7 @@ void WriteField1 (FILE *f, field_t *field, byte *base)
 }
 
 
-void WriteField2 (FILE *f, field_t *field, byte *base)
+void WriteField2 (savebuf_t *b, field_t *field, byte *base)
 {
 	int			len;
 	void		*p;
@@ -309,7 +452,7 @@ void WriteField2 (FILE *f, field_t *field, byte *base)
 		if ( *(char **)p )
 		{
 			len = strlen(*(char **)p) + 1;
-			fwrite (*(char **)p, len, 1, f);
+			SB_Write (b, *(char **)p, len);
 		}
 		break;
 	default:
@@ -317,7 +460,7 @@ void WriteField2 (FILE *f, field_t *field, byte *base)
 	}
 }
 
-void ReadField (FILE *f, field_t *field, byte *base)
+void ReadField (savebuf_t *b, field_t *field, byte *base)
 {
 	void		*p;
 	int			len;
@@ -343,7 +486,7 @@ void ReadField (FILE *f, field_t *field, byte *base)
 		else
 		{
 			*(char **)p = gi.TagMalloc (len, TAG_LEVEL);
-			fread (*(char **)p, len, 1, f);
+			SB_Read (b, *(char **)p, len);
 		}
 		break;
 	case F_EDICT:
@@ -400,7 +543,7 @@ WriteClient
 All pointer variables (except function pointers) must be handled specially.
 ==============
 */
-void WriteClient (FILE *f, gclient_t *client)
+void WriteClient (savebuf_t *b, gclient_t *client)
 {
 	field_t		*field;
 	gclient_t	temp;
@@ -411,16 +554,16 @@ void WriteClient (FILE *f, gclient_t *client)
 	// change the pointers to lengths or indexes
 	for (field=clientfields ; field->name ; field++)
 	{
-		WriteField1 (f, field, (byte *)&temp);
+		WriteField1 (field, (byte *)&temp);
 	}
 
 	// write the block
-	fwrite (&temp, sizeof(temp), 1, f);
+	SB_Write (b, &temp, sizeof(temp));
 
 	// now write any allocated data following the edict
 	for (field=clientfields ; field->name ; field++)
 	{
-		WriteField2 (f, field, (byte *)client);
+		WriteField2 (b, field, (byte *)client);
 	}
 }
 
@@ -431,15 +574,15 @@ ReadClient
 All pointer variables (except function pointers) must be handled specially.
 ==============
 */
-void ReadClient (FILE *f, gclient_t *client)
+void ReadClient (savebuf_t *b, gclient_t *client)
 {
 	field_t		*field;
 
-	fread (client, sizeof(*client), 1, f);
+	SB_Read (b, client, sizeof(*client));
 
 	for (field=clientfields ; field->name ; field++)
 	{
-		ReadField (f, field, (byte *)client);
+		ReadField (b, field, (byte *)client);
 	}
 }
 
@@ -459,59 +602,84 @@ last save position.
 */
 void WriteGame (const char *filename, qboolean autosave)
 {
-	FILE	*f;
-	int		i;
-	char	str[16];
+	savebuf_t	b;
+	int			i;
+	char		str[16];
 
 	if (!autosave)
 		SaveClientData ();
 
-	f = fopen (filename, "wb");
-	if (!f)
-		gi.error ("Couldn't open %s", filename);
+	memset (&b, 0, sizeof(b));
+	b.filename = filename;
+
+	SB_WriteInt (&b, SAVEGAME_MAGIC);
+	SB_WriteInt (&b, SAVE_VERSION);
 
 	memset (str, 0, sizeof(str));
 	strcpy (str, __DATE__);
-	fwrite (str, sizeof(str), 1, f);
+	SB_Write (&b, str, sizeof(str));
+
+	SB_WriteInt (&b, sizeof(game));
+	SB_WriteInt (&b, sizeof(gclient_t));
 
 	game.autosaved = autosave;
-	fwrite (&game, sizeof(game), 1, f);
+	SB_Write (&b, &game, sizeof(game));
 	game.autosaved = false;
 
 	for (i=0 ; i<game.maxclients ; i++)
-		WriteClient (f, &game.clients[i]);
+		WriteClient (&b, &game.clients[i]);
 
-	fclose (f);
+	SB_WriteFile (&b);
 }
 
 void ReadGame (const char *filename)
 {
-	FILE	*f;
-	int		i;
-	char	str[16];
+	savebuf_t	b;
+	int			i;
+	char		str[16];
+	qboolean	sizesok;
 
 	gi.FreeTags (TAG_GAME);
 
-	f = fopen (filename, "rb");
-	if (!f)
-		gi.error ("Couldn't open %s", filename);
+	SB_ReadFile (&b, filename);
 
-	fread (str, sizeof(str), 1, f);
-	if (strcmp (str, __DATE__))
+	if (SB_CheckMagic (&b, SAVEGAME_MAGIC))
 	{
-		fclose (f);
+		if (SB_ReadInt (&b) > SAVE_VERSION)
+		{
+			free (b.data);
+			gi.error ("Savegame from a newer version.\n");
+		}
+
+		SB_Read (&b, str, sizeof(str));
+		sizesok = (SB_ReadInt (&b) == sizeof(game));
+		sizesok &= (SB_ReadInt (&b) == sizeof(gclient_t));
+	}
+	else
+	{
+		// pre-R1SG savegame, just the build date up front
+		SB_Read (&b, str, sizeof(str));
+		sizesok = true;
+	}
+
+	str[sizeof(str)-1] = 0;
+	if (strcmp (str, __DATE__) || !sizesok)
+	{
+		free (b.data);
 		gi.error ("Savegame from an older version.\n");
 	}
 
 	g_edicts =  gi.TagMalloc (game.maxentities * sizeof(g_edicts[0]), TAG_GAME);
 	globals.edicts = g_edicts;
+	G_InitEdictIndex ();
+	G_InitThinkQueue ();
 
-	fread (&game, sizeof(game), 1, f);
+	SB_Read (&b, &game, sizeof(game));
 	game.clients = gi.TagMalloc (game.maxclients * sizeof(game.clients[0]), TAG_GAME);
 	for (i=0 ; i<game.maxclients ; i++)
-		ReadClient (f, &game.clients[i]);
+		ReadClient (&b, &game.clients[i]);
 
-	fclose (f);
+	free (b.data);
 }
 
 //==========================================================
@@ -524,7 +692,7 @@ WriteEdict
 All pointer variables (except function pointers) must be handled specially.
 ==============
 */
-void WriteEdict (FILE *f, edict_t *ent)
+void WriteEdict (savebuf_t *b, edict_t *ent)
 {
 	field_t		*field;
 	edict_t		temp;
@@ -535,16 +703,16 @@ void WriteEdict (FILE *f, edict_t *ent)
 	// change the pointers to lengths or indexes
 	for (field=fields ; field->name ; field++)
 	{
-		WriteField1 (f, field, (byte *)&temp);
+		WriteField1 (field, (byte *)&temp);
 	}
 
 	// write the block
-	fwrite (&temp, sizeof(temp), 1, f);
+	SB_Write (b, &temp, sizeof(temp));
 
 	// now write any allocated data following the edict
 	for (field=fields ; field->name ; field++)
 	{
-		WriteField2 (f, field, (byte *)ent);
+		WriteField2 (b, field, (byte *)ent);
 	}
 
 }
@@ -556,7 +724,7 @@ WriteLevelLocals
 All pointer variables (except function pointers) must be handled specially.
 ==============
 */
-void WriteLevelLocals (FILE *f)
+void WriteLevelLocals (savebuf_t *b)
 {
 	field_t		*field;
 	level_locals_t		temp;
@@ -567,16 +735,16 @@ void WriteLevelLocals (FILE *f)
 	// change the pointers to lengths or indexes
 	for (field=levelfields ; field->name ; field++)
 	{
-		WriteField1 (f, field, (byte *)&temp);
+		WriteField1 (field, (byte *)&temp);
 	}
 
 	// write the block
-	fwrite (&temp, sizeof(temp), 1, f);
+	SB_Write (b, &temp, sizeof(temp));
 
 	// now write any allocated data following the edict
 	for (field=levelfields ; field->name ; field++)
 	{
-		WriteField2 (f, field, (byte *)&level);
+		WriteField2 (b, field, (byte *)&level);
 	}
 }
 
@@ -588,15 +756,15 @@ ReadEdict
 All pointer variables (except function pointers) must be handled specially.
 ==============
 */
-void ReadEdict (FILE *f, edict_t *ent)
+void ReadEdict (savebuf_t *b, edict_t *ent)
 {
 	field_t		*field;
 
-	fread (ent, sizeof(*ent), 1, f);
+	SB_Read (b, ent, sizeof(*ent));
 
 	for (field=fields ; field->name ; field++)
 	{
-		ReadField (f, field, (byte *)ent);
+		ReadField (b, field, (byte *)ent);
 	}
 }
 
@@ -607,45 +775,43 @@ ReadLevelLocals
 All pointer variables (except function pointers) must be handled specially.
 ==============
 */
-void ReadLevelLocals (FILE *f)
+void ReadLevelLocals (savebuf_t *b)
 {
 	field_t		*field;
 
-	fread (&level, sizeof(level), 1, f);
+	SB_Read (b, &level, sizeof(level));
 
 	for (field=levelfields ; field->name ; field++)
 	{
-		ReadField (f, field, (byte *)&level);
+		ReadField (b, field, (byte *)&level);
 	}
 }
 
 /*
 =================
-WriteLevel
+WriteLevelData
 
 =================
 */
-void WriteLevel (const char *filename)
+static void WriteLevelData (savebuf_t *b)
 {
-	int		i;
-	edict_t	*ent;
-	FILE	*f;
-	void	*base;
+	int			i;
+	edict_t		*ent;
+	void		*base;
 
-	f = fopen (filename, "wb");
-	if (!f)
-		gi.error ("Couldn't open %s", filename);
+	SB_WriteInt (b, SAVELEVEL_MAGIC);
+	SB_WriteInt (b, SAVE_VERSION);
 
-	// write out edict size for checking
-	i = sizeof(edict_t);
-	fwrite (&i, sizeof(i), 1, f);
+	// write out edict and level sizes for checking
+	SB_WriteInt (b, sizeof(edict_t));
+	SB_WriteInt (b, sizeof(level_locals_t));
 
 	// write out a function pointer for checking
 	base = (void *)InitGame;
-	fwrite (&base, sizeof(base), 1, f);
+	SB_Write (b, &base, sizeof(base));
 
 	// write out level_locals_t
-	WriteLevelLocals (f);
+	WriteLevelLocals (b);
 
 	// write out all the entities
 	for (i=0 ; i<globals.num_edicts ; i++)
@@ -653,19 +819,59 @@ void WriteLevel (const char *filename)
 		ent = &g_edicts[i];
 		if (!ent->inuse)
 			continue;
-		fwrite (&i, sizeof(i), 1, f);
-		WriteEdict (f, ent);
+		SB_WriteInt (b, i);
+		WriteEdict (b, ent);
 	}
-	i = -1;
-	fwrite (&i, sizeof(i), 1, f);
+	SB_WriteInt (b, -1);
+}
 
-	fclose (f);
+/*
+=================
+WriteLevel
+
+=================
+*/
+void WriteLevel (const char *filename)
+{
+	savebuf_t	b;
+
+	memset (&b, 0, sizeof(b));
+	b.filename = filename;
+
+	WriteLevelData (&b);
+	SB_WriteFile (&b);
+}
+
+/*
+=================
+WriteLevelBuffer
+
+r1: the server keeps transition saves in memory instead of on disk,
+see GMF_MEMLEVELS.
+=================
+*/
+void *WriteLevelBuffer (int *length)
+{
+	savebuf_t	b;
+	void		*data;
+
+	memset (&b, 0, sizeof(b));
+	b.filename = "level buffer";
+
+	WriteLevelData (&b);
+
+	data = gi.TagMalloc (b.cursize, TAG_LEVEL);
+	memcpy (data, b.data, b.cursize);
+	free (b.data);
+
+	*length = b.cursize;
+	return data;
 }
 
 
 /*
 =================
-ReadLevel
+ReadLevelData
 
 SpawnEntities will allready have been called on the
 level the same way it was when the level was saved.
@@ -679,17 +885,12 @@ calling ReadLevel.
 No clients are connected yet.
 =================
 */
-void ReadLevel (const char *filename)
+static void ReadLevelData (savebuf_t *b)
 {
-	int		entnum;
-	FILE	*f;
-	int		i;
-	void	*base;
-	edict_t	*ent;
-
-	f = fopen (filename, "rb");
-	if (!f)
-		gi.error ("Couldn't open %s", filename);
+	int			entnum;
+	int			i;
+	void		*base;
+	edict_t		*ent;
 
 	// free any dynamic memory allocated by loading the level
 	// base state
@@ -697,22 +898,38 @@ void ReadLevel (const char *filename)
 
 	// wipe all the entities
 	memset (g_edicts, 0, game.maxentities*sizeof(g_edicts[0]));
+	G_ClearEdictIndex ();
+	G_ClearThinkQueue ();
 	globals.num_edicts = maxclients->value+1;
 
-	// check edict size
-	fread (&i, sizeof(i), 1, f);
+	// check edict size, pre-R1SL levels start with it
+	if (SB_CheckMagic (b, SAVELEVEL_MAGIC))
+	{
+		if (SB_ReadInt (b) > SAVE_VERSION)
+		{
+			free (b->data);
+			gi.error ("ReadLevel: level from a newer version");
+		}
+
+		i = SB_ReadInt (b);
+		if (SB_ReadInt (b) != sizeof(level_locals_t))
+			i = -1;
+	}
+	else
+		i = SB_ReadInt (b);
+
 	if (i != sizeof(edict_t))
 	{
-		fclose (f);
+		free (b->data);
 		gi.error ("ReadLevel: mismatched edict size");
 	}
 
 	// check function pointer base address
-	fread (&base, sizeof(base), 1, f);
+	SB_Read (b, &base, sizeof(base));
 #ifdef _WIN32
 	if (base != (void *)InitGame)
 	{
-		fclose (f);
+		free (b->data);
 		gi.error ("ReadLevel: function pointers have moved");
 	}
 #else
@@ -720,30 +937,31 @@ void ReadLevel (const char *filename)
 #endif
 
 	// load the level locals
-	ReadLevelLocals (f);
+	ReadLevelLocals (b);
 
 	// load all the entities
 	while (1)
 	{
-		if (fread (&entnum, sizeof(entnum), 1, f) != 1)
-		{
-			fclose (f);
-			gi.error ("ReadLevel: failed to read entnum");
-		}
+		entnum = SB_ReadInt (b);
 		if (entnum == -1)
 			break;
+		if (entnum < 0 || entnum >= game.maxentities)
+		{
+			free (b->data);
+			gi.error ("ReadLevel: bad entnum %d", entnum);
+		}
 		if (entnum >= globals.num_edicts)
 			globals.num_edicts = entnum+1;
 
 		ent = &g_edicts[entnum];
-		ReadEdict (f, ent);
+		ReadEdict (b, ent);
 
 		// let the server rebuild world links for this ent
 		memset (&ent->area, 0, sizeof(ent->area));
 		gi.linkentity (ent);
 	}
 
-	fclose (f);
+	free (b->data);
 
 	// mark all clients as unconnected
 	for (i=0 ; i<maxclients->value ; i++)
@@ -757,6 +975,7 @@ void ReadLevel (const char *filename)
 	for (i=0 ; i<globals.num_edicts ; i++)
 	{
 		ent = &g_edicts[i];
+		G_IndexEdict (ent);
 
 		if (!ent->inuse)
 			continue;
@@ -767,3 +986,44 @@ void ReadLevel (const char *filename)
 				ent->nextthink = level.time + ent->delay;
 	}
 }
+
+/*
+=================
+ReadLevel
+
+=================
+*/
+void ReadLevel (const char *filename)
+{
+	savebuf_t	b;
+
+	SB_ReadFile (&b, filename);
+	ReadLevelData (&b);
+}
+
+/*
+=================
+ReadLevelBuffer
+
+r1: ReadLevel from the data WriteLevelBuffer gave the server.
+=================
+*/
+void ReadLevelBuffer (const void *data, int length)
+{
+	savebuf_t	b;
+
+	memset (&b, 0, sizeof(b));
+	b.filename = "level buffer";
+
+	if (length < 0)
+		gi.error ("ReadLevelBuffer: bad length %d", length);
+
+	b.data = malloc (length > 0 ? length : 1);
+	if (!b.data)
+		gi.error ("ReadLevelBuffer: couldn't allocate %d bytes", length);
+
+	memcpy (b.data, data, length);
+	b.cursize = b.maxsize = length;
+
+	ReadLevelData (&b);
+}
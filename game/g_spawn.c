@@ -375,6 +375,8 @@ void ED_ParseField (const char *key, const char *value, edict_t *ent)
 			{
 			case F_LSTRING:
 				*(char **)(b+f->ofs) = ED_NewString (value);
+				if (b == (byte *)ent)
+					G_IndexEdict (ent);
 				break;
 			case F_VECTOR:
 				sscanf (value, "%f %f %f", &vec[0], &vec[1], &vec[2]);
@@ -472,7 +474,7 @@ All but the last will have the teamchain field set to the next one
 void G_FindTeams (void)
 {
 	edict_t	*e, *e2, *chain;
-	int		i, j;
+	int		i;
 	int		c, c2;
 
 	c = 0;
@@ -489,12 +491,9 @@ void G_FindTeams (void)
 		e->teammaster = e;
 		c++;
 		c2++;
-		for (j=i+1, e2=e+1 ; j < globals.num_edicts ; j++,e2++)
+		//r1: G_Find is case insensitive, teams never were
+		for (e2 = e; (e2 = G_Find (e2, FOFS(team), e->team)) != NULL; )
 		{
-			if (!e2->inuse)
-				continue;
-			if (!e2->team)
-				continue;
 			if (e2->flags & FL_TEAMSLAVE)
 				continue;
 			if (!strcmp(e->team, e2->team))
@@ -541,6 +540,8 @@ void SpawnEntities (const char *mapname, const char *entities, const char *spawn
 
 	memset (&level, 0, sizeof(level));
 	memset (g_edicts, 0, game.maxentities * sizeof (g_edicts[0]));
+	G_ClearEdictIndex ();
+	G_ClearThinkQueue ();
 
 	strncpy (level.mapname, mapname, sizeof(level.mapname)-1);
 	strncpy (game.spawnpoint, spawnpoint, sizeof(game.spawnpoint)-1);
@@ -616,6 +617,10 @@ void SpawnEntities (const char *mapname, const char *entities, const char *spawn
 	}
 #endif
 
+	// spawn functions are free to rename themselves
+	for (i = 0, ent = g_edicts; i < globals.num_edicts; i++, ent++)
+		G_IndexEdict (ent);
+
 	G_FindTeams ();
 
 	PlayerTrail_Init ();
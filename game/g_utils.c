@@ -30,6 +30,130 @@ void G_ProjectSource (vec3_t point, vec3_t distance, vec3_t forward, vec3_t righ
 }
 
 
+/*
+=============
+Edict index
+
+classname, targetname and team are filed in hash chains so G_Find on them
+only walks edicts that share a bucket with the match string.  Each edict
+remembers the string pointer it was filed under, G_IndexEdict refiles it
+when that pointer changes.  G_Spawn, G_FreeEdict and ED_ParseField keep it
+current, G_RunFrame catches direct assignments to awake edicts once per
+frame.  Lookups
+still compare the real field, so a stale entry can only be skipped, never
+returned wrongly.
+=============
+*/
+#define	INDEX_FIELDS		3
+#define	INDEX_HASH_SIZE		256
+
+typedef struct
+{
+	const char	*key;		// pointer this edict is filed under, never dereferenced
+	int			bucket;
+	int			prev, next;
+} edictlink_t;
+
+static edictlink_t	*edict_links[INDEX_FIELDS];
+static int			edict_buckets[INDEX_FIELDS][INDEX_HASH_SIZE];
+
+static int G_IndexField (int fieldofs)
+{
+	if (fieldofs == FOFS(classname))
+		return 0;
+	if (fieldofs == FOFS(targetname))
+		return 1;
+	if (fieldofs == FOFS(team))
+		return 2;
+	return -1;
+}
+
+static int G_IndexHash (const char *s)
+{
+	unsigned	hash = 0;
+
+	while (*s)
+		hash = hash * 31 + tolower ((byte)*s++);
+
+	return hash & (INDEX_HASH_SIZE - 1);
+}
+
+void G_ClearEdictIndex (void)
+{
+	int		i, j;
+
+	for (i = 0; i < INDEX_FIELDS; i++)
+	{
+		if (!edict_links[i])
+			return;
+
+		for (j = 0; j < game.maxentities; j++)
+		{
+			edict_links[i][j].key = NULL;
+			edict_links[i][j].prev = edict_links[i][j].next = -1;
+		}
+
+		for (j = 0; j < INDEX_HASH_SIZE; j++)
+			edict_buckets[i][j] = -1;
+	}
+}
+
+// edicts and index are both TAG_GAME, call again whenever g_edicts is reallocated
+void G_InitEdictIndex (void)
+{
+	int		i;
+
+	for (i = 0; i < INDEX_FIELDS; i++)
+		edict_links[i] = gi.TagMalloc (game.maxentities * sizeof(edictlink_t), TAG_GAME);
+
+	G_ClearEdictIndex ();
+}
+
+void G_IndexEdict (edict_t *ent)
+{
+	static const int	ofs[INDEX_FIELDS] = {FOFS(classname), FOFS(targetname), FOFS(team)};
+	edictlink_t			*links, *l;
+	const char			*key;
+	int					i, num;
+
+	if (!edict_links[0])
+		return;
+
+	num = ent - g_edicts;
+
+	for (i = 0; i < INDEX_FIELDS; i++)
+	{
+		key = ent->inuse ? *(char **)((byte *)ent + ofs[i]) : NULL;
+		links = edict_links[i];
+		l = links + num;
+
+		if (l->key == key)
+			continue;
+
+		if (l->key)
+		{
+			if (l->prev != -1)
+				links[l->prev].next = l->next;
+			else
+				edict_buckets[i][l->bucket] = l->next;
+			if (l->next != -1)
+				links[l->next].prev = l->prev;
+		}
+
+		l->key = key;
+		l->prev = l->next = -1;
+
+		if (key)
+		{
+			l->bucket = G_IndexHash (key);
+			l->next = edict_buckets[i][l->bucket];
+			if (l->next != -1)
+				links[l->next].prev = num;
+			edict_buckets[i][l->bucket] = num;
+		}
+	}
+}
+
 /*
 =============
 G_Find
@@ -45,6 +169,27 @@ NULL will be returned if the end of the list is reached.
 edict_t *G_Find (edict_t *from, int fieldofs, char *match)
 {
 	char	*s;
+	int		field, e, first, best;
+
+	field = G_IndexField (fieldofs);
+	if (field != -1 && edict_links[field])
+	{
+		// chains are unordered, pick the lowest numbered match after from
+		first = from ? (from - g_edicts) + 1 : 0;
+		best = -1;
+		for (e = edict_buckets[field][G_IndexHash (match)]; e != -1; e = edict_links[field][e].next)
+		{
+			if (e < first || e >= globals.num_edicts || (best != -1 && e > best))
+				continue;
+			if (!g_edicts[e].inuse)
+				continue;
+			s = *(char **) ((byte *)&g_edicts[e] + fieldofs);
+			if (!s || Q_stricmp (s, match))
+				continue;
+			best = e;
+		}
+		return best == -1 ? NULL : &g_edicts[best];
+	}
 
 	if (!from)
 		from = g_edicts;
@@ -75,28 +220,186 @@ Returns entities that have origins within a spherical area
 findradius (origin, radius)
 =================
 */
-edict_t *findradius (edict_t *from, vec3_t org, float rad)
+static qboolean InRadius (edict_t *ent, vec3_t org, float rad)
 {
 	vec3_t	eorg;
 	int		j;
 
-	if (!from)
-		from = g_edicts;
-	else
-		from++;
-	for ( ; from < &g_edicts[globals.num_edicts]; from++)
+	if (!ent->inuse)
+		return false;
+	if (ent->solid == SOLID_NOT)
+		return false;
+	for (j=0 ; j<3 ; j++)
+		eorg[j] = org[j] - (ent->s.origin[j] + (ent->mins[j] + ent->maxs[j])*0.5);
+	if (VectorLength(eorg) > rad)
+		return false;
+	return true;
+}
+
+// r1: a findradius loop queries the server once and then walks the sorted
+// result. a few queries are kept so findradius loops nested inside one
+// another (a barrel exploding inside T_RadiusDamage) each keep their own.
+// anything linked mid-loop (gibs, debris, knocked back edicts) may have come
+// into range, so the next step queries again and carries on after from, the
+// same as the linear scan would.
+#define	RADIUS_CACHE	8
+
+typedef struct
+{
+	vec3_t		org;
+	float		rad;
+	int			framenum;	// -1 when free
+	int			used;
+	int			linkcount;	// radius_linkcount at the query
+	int			num;
+	edict_t		*list[MAX_EDICTS];
+} radiuscache_t;
+
+static radiuscache_t	radius_cache[RADIUS_CACHE];
+static int				radius_used;
+static int				radius_linkcount;
+
+void (EXPORT *G_ServerLinkEntity) (edict_t *ent);
+
+// gi.linkentity, see GetGameAPI
+void EXPORT G_LinkEntity (edict_t *ent)
+{
+	radius_linkcount++;
+	G_ServerLinkEntity (ent);
+}
+
+static int RadiusCompare (const void *a, const void *b)
+{
+	const edict_t	*e1, *e2;
+
+	e1 = *(const edict_t **)a;
+	e2 = *(const edict_t **)b;
+
+	return (e1 > e2) - (e1 < e2);
+}
+
+// index of the first entry in c after from
+static int RadiusAfter (radiuscache_t *c, edict_t *from)
+{
+	int		lo, hi, mid;
+
+	lo = 0;
+	hi = c->num;
+	while (lo < hi)
 	{
-		if (!from->inuse)
-			continue;
-		if (from->solid == SOLID_NOT)
+		mid = (lo + hi) / 2;
+		if (c->list[mid] <= from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+// the query a loop at from is walking, if it is still around
+static radiuscache_t *RadiusFind (edict_t *from, vec3_t org, float rad)
+{
+	radiuscache_t	*c, *best;
+	int				i, pos;
+
+	best = NULL;
+	for (i = 0, c = radius_cache; i < RADIUS_CACHE; i++, c++)
+	{
+		if (c->framenum != level.framenum || c->rad != rad || !VectorCompare (c->org, org))
 			continue;
-		for (j=0 ; j<3 ; j++)
-			eorg[j] = org[j] - (from->s.origin[j] + (from->mins[j] + from->maxs[j])*0.5);
-		if (VectorLength(eorg) > rad)
+		if (best && c->used < best->used)
 			continue;
-		return from;
+
+		pos = RadiusAfter (c, from);
+		if (pos && c->list[pos-1] == from)
+			best = c;
 	}
 
+	return best;
+}
+
+static void RadiusFill (radiuscache_t *c, vec3_t org, float rad)
+{
+	VectorCopy (org, c->org);
+	c->rad = rad;
+	c->framenum = level.framenum;
+	c->linkcount = radius_linkcount;
+	c->num = gi.RadiusEdicts (org, rad, c->list, MAX_EDICTS);
+	qsort (c->list, c->num, sizeof(c->list[0]), RadiusCompare);
+}
+
+static radiuscache_t *RadiusQuery (vec3_t org, float rad)
+{
+	radiuscache_t	*c, *best;
+	int				i;
+
+	// a free slot, else the one used longest ago
+	best = radius_cache;
+	for (i = 0, c = radius_cache; i < RADIUS_CACHE; i++, c++)
+	{
+		if (c->framenum != level.framenum)
+		{
+			best = c;
+			break;
+		}
+		if (c->used < best->used)
+			best = c;
+	}
+
+	RadiusFill (best, org, rad);
+
+	return best;
+}
+
+edict_t *findradius (edict_t *from, vec3_t org, float rad)
+{
+	radiuscache_t	*c;
+	int				i;
+
+	if (!((int)sv_features->value & GMF_RADIUSEDICTS))
+	{
+		if (!from)
+			from = g_edicts;
+		else
+			from++;
+		for ( ; from < &g_edicts[globals.num_edicts]; from++)
+		{
+			if (InRadius (from, org, rad))
+				return from;
+		}
+		return NULL;
+	}
+
+	// the world is never linked, check it by hand
+	if (!from)
+	{
+		if (InRadius (g_edicts, org, rad))
+			return g_edicts;
+		from = g_edicts;
+	}
+
+	// continue the loop's own query if it is still cached, otherwise ask the
+	// server's area tree for everything in range. entries are rechecked as
+	// they are handed out so edicts freed or moved mid-loop are skipped.
+	c = NULL;
+	if (from != g_edicts)
+		c = RadiusFind (from, org, rad);
+	if (!c)
+		c = RadiusQuery (org, rad);
+	else if (c->linkcount != radius_linkcount)
+		RadiusFill (c, org, rad);
+
+	c->used = ++radius_used;
+
+	for (i = RadiusAfter (c, from); i < c->num; i++)
+	{
+		if (InRadius (c->list[i], org, rad))
+			return c->list[i];
+	}
+
+	// loop is done, free the slot
+	c->framenum = -1;
 	return NULL;
 }
 
@@ -243,7 +546,10 @@ void G_UseTargets (edict_t *ent, edict_t *activator)
 			else
 			{
 				if (t->use)
+				{
+					G_WakeEdict (t);
 					t->use (t, ent, activator);
+				}
 			}
 			if (!ent->inuse)
 			{
@@ -404,6 +710,8 @@ void G_InitEdict (edict_t *e)
 	e->classname = "noclass";
 	e->gravity = 1.0f;
 	e->s.number = e - g_edicts;
+	G_IndexEdict (e);
+	G_WakeEdict (e);
 }
 
 /*
@@ -452,6 +760,7 @@ Marks the edict as free
 void G_FreeEdict (edict_t *ed)
 {
 	gi.unlinkentity (ed);		// unlink from world
+	G_WakeEdict (ed);
 
 	if ((ed - g_edicts) <= (maxclients->value + BODY_QUEUE_SIZE))
 	{
@@ -463,6 +772,7 @@ void G_FreeEdict (edict_t *ed)
 	ed->classname = "freed";
 	ed->freetime = level.time;
 	ed->inuse = false;
+	G_IndexEdict (ed);
 }
 
 
@@ -493,6 +803,7 @@ void	G_TouchTriggers (edict_t *ent)
 			continue;
 		if (!hit->touch)
 			continue;
+		G_WakeEdict (hit);
 		hit->touch (hit, ent, NULL, NULL);
 	}
 }
@@ -521,7 +832,10 @@ void	G_TouchSolids (edict_t *ent)
 		if (!hit->inuse)
 			continue;
 		if (ent->touch)
+		{
+			G_WakeEdict (hit);
 			ent->touch (hit, ent, NULL, NULL);
+		}
 		if (!ent->inuse)
 			break;
 	}
@@ -52,6 +52,17 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	SVF_NOPREDICTION		0x00000008	// send this as solid=0 to the client to ignore prediction
 //!!! r1q2 specific
 
+//!!! r1q2 specific
+// sv_features bits, server provides these game_import_t members
+#define	GMF_RADIUSEDICTS		0x00010000	// RadiusEdicts
+#define	GMF_RUNWORKERS			0x00020000	// RunWorkers and TraceThreadSafe
+//!!! r1q2 specific
+
+//!!! r1q2 specific
+// g_features bits, game provides these game_export_t members
+#define	GMF_MEMLEVELS			0x00040000	// WriteLevelBuffer and ReadLevelBuffer
+//!!! r1q2 specific
+
 // edict->solid values
 
 typedef enum
@@ -212,6 +223,18 @@ typedef struct
 	void	(EXPORT *AddCommandString) (const char *text);
 
 	void	(EXPORT *DebugGraph) (float value, int color);
+
+	// only present if the server advertises GMF_RADIUSEDICTS in sv_features.
+	// fills list with linked, non-SOLID_NOT edicts whose bbox center is
+	// within radius of origin, in no particular order.
+	int		(EXPORT *RadiusEdicts) (vec3_t origin, float radius, edict_t **list, int maxcount);
+
+	// only present if the server advertises GMF_RUNWORKERS in sv_features.
+	// RunWorkers calls func once per job index across the server's worker
+	// threads and returns when all are done.  jobs must not change any game
+	// or server state, TraceThreadSafe is the only trace they may use.
+	void	(EXPORT *RunWorkers) (void (*func)(int job), int numjobs);
+	trace_t	(EXPORT *TraceThreadSafe) (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int contentmask);
 } game_import_t;
 
 //
@@ -269,6 +292,13 @@ typedef struct
 	int			edict_size;
 	int			num_edicts;		// current number, <= max_edicts
 	int			max_edicts;
+
+	// only present if the game sets GMF_MEMLEVELS in g_features.
+	// WriteLevelBuffer is WriteLevel into memory, it returns the contents
+	// of the .sav file and the data is freed with the level.  ReadLevelBuffer
+	// is ReadLevel from such data.
+	void		*(IMPORT *WriteLevelBuffer) (int *length);
+	void		(IMPORT *ReadLevelBuffer) (const void *data, int length);
 } game_export_t;
 
 game_export_t * IMPORT GetGameApi (game_import_t *import);
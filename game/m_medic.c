@@ -618,6 +618,7 @@ void medic_cable_attack (edict_t *self)
 		self->enemy->combattarget = NULL;
 		self->enemy->deathtarget = NULL;
 		self->enemy->owner = self;
+		G_WakeEdict (self->enemy);
 		ED_CallSpawn (self->enemy);
 		self->enemy->owner = NULL;
 		if (self->enemy->think)
@@ -956,6 +956,10 @@ void CopyToBodyQue (edict_t *ent)
 	gi.unlinkentity (ent);
 
 	gi.unlinkentity (body);
+
+	//r1: the que slot has been idle and is likely asleep
+	G_WakeEdict (body);
+
 	body->s = ent->s;
 	body->s.number = body - g_edicts;
 
@@ -1690,6 +1694,7 @@ void ClientThink (edict_t *ent, usercmd_t *ucmd)
 				continue;	// duplicated
 			if (!other->touch)
 				continue;
+			G_WakeEdict (other);
 			other->touch (other, ent, NULL, NULL);
 		}
 
@@ -125,6 +125,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 //#endif
 #define __attribute__(x) 
 #define PACKED_STRUCT
+#define THREADLOCAL __declspec(thread)
 typedef __int32 int32;
 typedef __int16 int16;
 typedef __int64 int64;
@@ -144,6 +145,7 @@ typedef uint32_t uint32;
 typedef uint16_t uint16;
 typedef uint64_t uint64;
 #define PACKED_STRUCT __attribute__((packed))
+#define THREADLOCAL __thread
 //XXX: are these portable enough on non-win32?
 #define Q_stricmp strcasecmp
 #define Q_strncasecmp strncasecmp
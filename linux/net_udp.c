@@ -1,5 +1,9 @@
 // net_wins.c
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "../qcommon/qcommon.h"
 
 #include <unistd.h>
@@ -27,6 +31,10 @@ static unsigned long long net_total_out;
 static unsigned long long net_packets_in;
 static unsigned long long net_packets_out;
 
+//r1: syscalls used to move the above, to see how well batching works
+static unsigned long long net_recv_calls;
+static unsigned long long net_send_calls;
+
 int			server_port;
 //netadr_t	net_local_adr;
 
@@ -35,10 +43,224 @@ static int			ip_sockets[2];
 char *NET_ErrorString (void);
 
 cvar_t	*net_no_recverr;
+cvar_t	*net_batch;
 
 //Aiee...
 #include "../qcommon/net_common.c"
 
+/*
+=============================================================================
+
+BATCHED SOCKET I/O
+
+r1: recvmmsg fills a burst of datagrams which NET_GetPacket then hands out one
+at a time, so SV_ReadPackets drains the socket in a few syscalls. while a send
+batch is open NET_SendPacket only queues and NET_FlushPacketBatch pushes the
+whole lot out with sendmmsg. falls back to recvfrom/sendto on kernels without
+the mmsg calls or if net_batch is 0.
+
+=============================================================================
+*/
+
+#define	NET_RECV_BATCH	32
+#define	NET_SEND_BATCH	64
+
+typedef struct
+{
+	int					socket;
+	int					count;
+	int					current;
+	struct mmsghdr		hdrs[NET_RECV_BATCH];
+	struct iovec		iovs[NET_RECV_BATCH];
+	struct sockaddr_in	addrs[NET_RECV_BATCH];
+	byte				bufs[NET_RECV_BATCH][MAX_MSGLEN];
+} net_recvbatch_t;
+
+typedef struct
+{
+	qboolean			active;
+	int					count;
+	struct mmsghdr		hdrs[NET_SEND_BATCH];
+	struct iovec		iovs[NET_SEND_BATCH];
+	struct sockaddr_in	addrs[NET_SEND_BATCH];
+	netadr_t			to[NET_SEND_BATCH];
+	byte				bufs[NET_SEND_BATCH][MAX_MSGLEN];
+} net_sendbatch_t;
+
+static net_recvbatch_t	recv_batch[2];
+static net_sendbatch_t	send_batch[2];
+static qboolean			net_no_mmsg;
+
+static void NET_NoMMsg (const char *func)
+{
+	net_no_mmsg = true;
+	Com_Printf ("%s: not supported by this kernel, falling back to one syscall per packet.\n", LOG_NET|LOG_WARNING, func);
+}
+
+/*
+=============
+NET_RecvBatch
+
+Same as recvfrom, but served from a recvmmsg burst.
+=============
+*/
+static int NET_RecvBatch (netsrc_t sock, int net_socket, struct sockaddr_in *from, sizebuf_t *net_message)
+{
+	net_recvbatch_t	*batch;
+	int				i, ret;
+
+	batch = &recv_batch[sock];
+
+	//socket got reopened, anything left is stale
+	if (batch->socket != net_socket)
+	{
+		batch->socket = net_socket;
+		batch->count = batch->current = 0;
+	}
+
+	if (batch->current == batch->count)
+	{
+		batch->count = batch->current = 0;
+
+		for (i = 0; i < NET_RECV_BATCH; i++)
+		{
+			batch->iovs[i].iov_base = batch->bufs[i];
+			batch->iovs[i].iov_len = net_message->maxsize;
+
+			memset (&batch->hdrs[i], 0, sizeof(batch->hdrs[i]));
+			batch->hdrs[i].msg_hdr.msg_name = &batch->addrs[i];
+			batch->hdrs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+			batch->hdrs[i].msg_hdr.msg_iov = &batch->iovs[i];
+			batch->hdrs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		ret = recvmmsg (net_socket, batch->hdrs, NET_RECV_BATCH, MSG_DONTWAIT, NULL);
+		if (ret == -1)
+		{
+			if (errno == ENOSYS)
+			{
+				socklen_t	fromlen;
+
+				NET_NoMMsg ("recvmmsg");
+
+				fromlen = sizeof(*from);
+				return recvfrom (net_socket, net_message->data, net_message->maxsize, 0, (struct sockaddr *)from, &fromlen);
+			}
+			return -1;
+		}
+
+		net_recv_calls++;
+		batch->count = ret;
+	}
+
+	i = batch->current++;
+
+	ret = batch->hdrs[i].msg_len;
+	memcpy (net_message->data, batch->bufs[i], ret);
+	*from = batch->addrs[i];
+
+	return ret;
+}
+
+void NET_BeginPacketBatch (netsrc_t sock)
+{
+	if (!net_batch->intvalue || net_no_mmsg)
+		return;
+
+	send_batch[sock].active = true;
+}
+
+static void NET_SendBatch (netsrc_t sock)
+{
+	net_sendbatch_t	*batch;
+	int				i, sent, ret;
+
+	batch = &send_batch[sock];
+
+	sent = 0;
+
+	while (sent < batch->count)
+	{
+		ret = sendmmsg (ip_sockets[sock], batch->hdrs + sent, batch->count - sent, 0);
+		if (ret == -1)
+		{
+			if (errno == ENOSYS)
+			{
+				NET_NoMMsg ("sendmmsg");
+
+				for (i = sent; i < batch->count; i++)
+				{
+					if (sendto (ip_sockets[sock], batch->bufs[i], batch->iovs[i].iov_len, 0, (struct sockaddr *)&batch->addrs[i], sizeof(batch->addrs[i])) == -1)
+					{
+						Com_Printf ("NET_SendPacket to %s: ERROR: %s\n", LOG_NET, NET_AdrToString(&batch->to[i]), NET_ErrorString());
+						continue;
+					}
+					net_send_calls++;
+					net_packets_out++;
+					net_total_out += batch->iovs[i].iov_len;
+				}
+				break;
+			}
+
+			//sendmmsg only fails outright if the first one did, report it and skip
+			Com_Printf ("NET_SendPacket to %s: ERROR: %s\n", LOG_NET, NET_AdrToString(&batch->to[sent]), NET_ErrorString());
+			sent++;
+			continue;
+		}
+
+		net_send_calls++;
+
+		for (i = sent; i < sent + ret; i++)
+		{
+			net_packets_out++;
+			net_total_out += batch->hdrs[i].msg_len;
+		}
+
+		sent += ret;
+	}
+
+	batch->count = 0;
+}
+
+void NET_FlushPacketBatch (netsrc_t sock)
+{
+	if (!send_batch[sock].active)
+		return;
+
+	if (ip_sockets[sock])
+		NET_SendBatch (sock);
+	else
+		send_batch[sock].count = 0;
+
+	send_batch[sock].active = false;
+}
+
+static void NET_QueuePacket (netsrc_t sock, int length, const void *data, netadr_t *to)
+{
+	net_sendbatch_t	*batch;
+	int				i;
+
+	batch = &send_batch[sock];
+
+	if (batch->count == NET_SEND_BATCH)
+		NET_SendBatch (sock);
+
+	i = batch->count++;
+
+	memcpy (batch->bufs[i], data, length);
+	batch->to[i] = *to;
+	NetadrToSockadr (to, &batch->addrs[i]);
+
+	batch->iovs[i].iov_base = batch->bufs[i];
+	batch->iovs[i].iov_len = length;
+
+	memset (&batch->hdrs[i], 0, sizeof(batch->hdrs[i]));
+	batch->hdrs[i].msg_hdr.msg_name = &batch->addrs[i];
+	batch->hdrs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+	batch->hdrs[i].msg_hdr.msg_iov = &batch->iovs[i];
+	batch->hdrs[i].msg_hdr.msg_iovlen = 1;
+}
+
 /*
 =============
 NET_StringToAdr
@@ -143,6 +365,14 @@ void Net_Stats_f (void)
 				diff,
 				net_total_in, net_packets_in, (int)(((net_total_in * 8) / 1024) / diff),
 				net_total_out, net_packets_out, (int)((net_total_out * 8) / 1024) / diff);
+
+	Com_Printf ("%llu receive calls (av: %.2f packets/call)\n"
+				"%llu send calls (av: %.2f packets/call)\n"
+				"Batched I/O is %s.\n", LOG_NET,
+
+				net_recv_calls, net_recv_calls ? (double)net_packets_in / net_recv_calls : 0.0,
+				net_send_calls, net_send_calls ? (double)net_packets_out / net_send_calls : 0.0,
+				net_no_mmsg ? "unsupported" : net_batch->intvalue ? "enabled" : "disabled");
 }
 
 /*
@@ -180,10 +410,20 @@ int	NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 	if (!net_socket)
 		return 0;
 
-	fromlen = sizeof(from);
+	if (net_batch->intvalue && !net_no_mmsg)
+	{
+		ret = NET_RecvBatch (sock, net_socket, &from, net_message);
+	}
+	else
+	{
+		fromlen = sizeof(from);
+
+		ret = recvfrom (net_socket, net_message->data, net_message->maxsize
+			, 0, (struct sockaddr *)&from, &fromlen);
 
-	ret = recvfrom (net_socket, net_message->data, net_message->maxsize
-		, 0, (struct sockaddr *)&from, &fromlen);
+		if (ret != -1)
+			net_recv_calls++;
+	}
 
 	if (ret == -1)
 	{
@@ -364,6 +604,12 @@ int NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t *to)
 		return 0;
 	}
 
+	if (send_batch[sock].active)
+	{
+		NET_QueuePacket (sock, length, data, to);
+		return 1;
+	}
+
 	NetadrToSockadr (to, &addr);
 
 	ret = sendto (net_socket, data, length, 0, (struct sockaddr *)&addr, sizeof(addr) );
@@ -373,6 +619,7 @@ int NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t *to)
 		return 0;
 	}
 
+	net_send_calls++;
 	net_packets_out++;
 	net_total_out += ret;
 	return 1;
@@ -389,6 +636,9 @@ void NET_Init (void)
 {
 	NET_Common_Init ();
 	net_no_recverr = Cvar_Get ("net_no_recverr", "0", 0);
+
+	net_batch = Cvar_Get ("net_batch", "1", 0);
+	net_batch->help = "Use recvmmsg/sendmmsg to move several packets per syscall. Default 1.\n";
 }
 
 
@@ -11,6 +11,7 @@
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "../linux/glob.h"
 
@@ -90,21 +91,24 @@ Sys_Milliseconds
 ================
 */
 unsigned int curtime;
+
+//r1: exposed so timers can be armed for an exact Sys_Milliseconds value
+unsigned int sys_secbase;
+
 unsigned int Sys_Milliseconds (void)
 {
 	struct timeval tp;
 	struct timezone tzp;
-	static unsigned int		secbase;
 
 	gettimeofday(&tp, &tzp);
 	
-	if (!secbase)
+	if (!sys_secbase)
 	{
-		secbase = tp.tv_sec;
+		sys_secbase = tp.tv_sec;
 		return tp.tv_usec/1000;
 	}
 
-	curtime = (tp.tv_sec - secbase)*1000 + tp.tv_usec/1000;
+	curtime = (tp.tv_sec - sys_secbase)*1000 + tp.tv_usec/1000;
 	
 	return curtime;
 }
@@ -221,3 +225,294 @@ void Sys_FindClose (void)
 
 //============================================
 
+//============================================
+
+/*
+================
+Worker threads
+
+r1: a very simple pool for splitting per-client work over several cores. the
+caller of Sys_RunWorkers takes jobs too, so numthreads is in addition to the
+main thread. jobs are handed out with an atomic counter so there is no queue.
+================
+*/
+
+static pthread_t		workers[MAX_WORKER_THREADS];
+static int				num_workers;
+
+static pthread_mutex_t	work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	work_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	work_done = PTHREAD_COND_INITIALIZER;
+
+static void				(*work_func)(int job);
+static int				work_count;
+static volatile int		work_next;
+static int				work_busy;
+static unsigned			work_generation;
+static qboolean			work_quit;
+
+static void Sys_TakeJobs (void)
+{
+	int		job;
+
+	while ((job = __sync_fetch_and_add (&work_next, 1)) < work_count)
+		work_func (job);
+}
+
+static void *Sys_WorkerThread (void *arg)
+{
+	unsigned	generation;
+
+	//r1: start from the current generation, work_generation carries on
+	//across sv_threads changes and a new worker must not see a stale pass.
+	pthread_mutex_lock (&work_lock);
+	generation = work_generation;
+
+	for (;;)
+	{
+		while (generation == work_generation && !work_quit)
+			pthread_cond_wait (&work_start, &work_lock);
+
+		if (work_quit)
+			break;
+
+		generation = work_generation;
+		pthread_mutex_unlock (&work_lock);
+
+		Sys_TakeJobs ();
+
+		pthread_mutex_lock (&work_lock);
+		if (--work_busy == 0)
+			pthread_cond_signal (&work_done);
+	}
+	pthread_mutex_unlock (&work_lock);
+
+	Com_ThreadExit ();
+
+	return NULL;
+}
+
+void Sys_ShutdownWorkers (void)
+{
+	int		i;
+
+	if (!num_workers)
+		return;
+
+	pthread_mutex_lock (&work_lock);
+	work_quit = true;
+	pthread_cond_broadcast (&work_start);
+	pthread_mutex_unlock (&work_lock);
+
+	for (i = 0; i < num_workers; i++)
+		pthread_join (workers[i], NULL);
+
+	num_workers = 0;
+	work_quit = false;
+}
+
+int Sys_InitWorkers (int numthreads)
+{
+	Sys_ShutdownWorkers ();
+
+	if (numthreads > MAX_WORKER_THREADS)
+		numthreads = MAX_WORKER_THREADS;
+
+	while (num_workers < numthreads)
+	{
+		int		err;
+
+		err = pthread_create (&workers[num_workers], NULL, Sys_WorkerThread, NULL);
+		if (err)
+		{
+			Com_Printf ("Sys_InitWorkers: pthread_create failed (%d)\n", LOG_GENERAL|LOG_WARNING, err);
+			break;
+		}
+		num_workers++;
+	}
+
+	return num_workers;
+}
+
+int Sys_NumWorkers (void)
+{
+	return num_workers;
+}
+
+void Sys_RunWorkers (void (*func)(int job), int numjobs)
+{
+	int		i;
+
+	if (!num_workers || numjobs < 2)
+	{
+		for (i = 0; i < numjobs; i++)
+			func (i);
+		return;
+	}
+
+	pthread_mutex_lock (&work_lock);
+	work_func = func;
+	work_count = numjobs;
+	work_next = 0;
+	work_busy = num_workers;
+	work_generation++;
+	pthread_cond_broadcast (&work_start);
+	pthread_mutex_unlock (&work_lock);
+
+	Sys_TakeJobs ();
+
+	pthread_mutex_lock (&work_lock);
+	while (work_busy)
+		pthread_cond_wait (&work_done, &work_lock);
+	pthread_mutex_unlock (&work_lock);
+}
+
+/*
+================
+Sys_StartThread
+
+r1: a plain background thread for things that don't fit the worker pool, eg
+the async log writer. returns NULL on failure.
+================
+*/
+typedef struct
+{
+	pthread_t	thread;
+	void		(*func)(void *arg);
+	void		*arg;
+} systhread_t;
+
+static void *Sys_ThreadMain (void *arg)
+{
+	systhread_t	*t;
+
+	t = (systhread_t *)arg;
+	t->func (t->arg);
+
+	Com_ThreadExit ();
+
+	return NULL;
+}
+
+void *Sys_StartThread (void (*func)(void *arg), void *arg)
+{
+	systhread_t	*t;
+	int			err;
+
+	t = malloc (sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->func = func;
+	t->arg = arg;
+
+	err = pthread_create (&t->thread, NULL, Sys_ThreadMain, t);
+	if (err)
+	{
+		Com_Printf ("Sys_StartThread: pthread_create failed (%d)\n", LOG_GENERAL|LOG_WARNING, err);
+		free (t);
+		return NULL;
+	}
+
+	return t;
+}
+
+void Sys_JoinThread (void *thread)
+{
+	systhread_t	*t;
+
+	t = (systhread_t *)thread;
+
+	pthread_join (t->thread, NULL);
+	free (t);
+}
+
+typedef struct
+{
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	qboolean		set;
+} syssignal_t;
+
+void *Sys_CreateSignal (void)
+{
+	syssignal_t	*s;
+
+	s = malloc (sizeof(*s));
+	if (!s)
+		return NULL;
+
+	pthread_mutex_init (&s->lock, NULL);
+	pthread_cond_init (&s->cond, NULL);
+	s->set = false;
+
+	return s;
+}
+
+void Sys_DestroySignal (void *sig)
+{
+	syssignal_t	*s;
+
+	s = (syssignal_t *)sig;
+
+	pthread_cond_destroy (&s->cond);
+	pthread_mutex_destroy (&s->lock);
+	free (s);
+}
+
+void Sys_SetSignal (void *sig)
+{
+	syssignal_t	*s;
+
+	s = (syssignal_t *)sig;
+
+	pthread_mutex_lock (&s->lock);
+	s->set = true;
+	pthread_cond_signal (&s->cond);
+	pthread_mutex_unlock (&s->lock);
+}
+
+qboolean Sys_WaitSignal (void *sig, int msec)
+{
+	syssignal_t		*s;
+	struct timespec	until;
+	qboolean		set;
+
+	s = (syssignal_t *)sig;
+
+	if (msec > 0)
+	{
+		clock_gettime (CLOCK_REALTIME, &until);
+		until.tv_sec += msec / 1000;
+		until.tv_nsec += (msec % 1000) * 1000000L;
+		if (until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+	}
+
+	pthread_mutex_lock (&s->lock);
+	while (!s->set)
+	{
+		if (msec < 0)
+			pthread_cond_wait (&s->cond, &s->lock);
+		else if (!msec || pthread_cond_timedwait (&s->cond, &s->lock, &until) == ETIMEDOUT)
+			break;
+	}
+	set = s->set;
+	s->set = false;
+	pthread_mutex_unlock (&s->lock);
+
+	return set;
+}
+
+qboolean Sys_CompareAndSwap (volatile int *value, int oldvalue, int newvalue)
+{
+	return __sync_bool_compare_and_swap (value, oldvalue, newvalue);
+}
+
+void Sys_MemoryBarrier (void)
+{
+	__sync_synchronize ();
+}
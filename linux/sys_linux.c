@@ -18,6 +18,8 @@
 #include <errno.h>
 #include <execinfo.h>
 #include <sys/utsname.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #define __USE_GNU 1
 #define _GNU_SOURCE
 #include <link.h>
@@ -295,9 +297,207 @@ void Sys_ProcessTimes_f (void)
 
 static unsigned int goodspins, badspins;
 
+/*
+=================
+Event loop
+
+r1: instead of select with a millisecond timeout, dedicated servers wait in
+epoll on the server socket, stdin and a timerfd armed for the exact moment
+Sys_Milliseconds reaches the next server frame. this wakes the server as soon
+as a packet arrives or the frame is due rather than somewhere within the
+following millisecond.
+=================
+*/
+#define	EV_SOCKET	0
+#define	EV_TIMER	1
+#define	EV_STDIN	2
+
+extern unsigned int	sys_secbase;
+
+static int			sys_epollfd = -1;
+static int			sys_timerfd = -1;
+static qboolean		sys_events_failed;
+static int			sys_watched_socket;
+static qboolean		sys_watching_stdin;
+static qboolean		sys_stdin_unwatchable;
+
+//Sys_Milliseconds at the start of the current main loop iteration
+static unsigned int	sys_loop_time;
+
+static unsigned int	ev_waits, ev_socket_wakes, ev_timer_wakes, ev_stdin_wakes, ev_timeouts;
+static uint64		ev_slept_usec, ev_late_usec;
+static unsigned int	ev_max_late_usec;
+
+static qboolean Sys_InitEvents (void)
+{
+	struct epoll_event	ev;
+
+	sys_epollfd = epoll_create (4);
+	if (sys_epollfd == -1)
+		goto fail;
+
+	sys_timerfd = timerfd_create (CLOCK_REALTIME, 0);
+	if (sys_timerfd == -1)
+		goto fail;
+
+	fcntl (sys_epollfd, F_SETFD, FD_CLOEXEC);
+	fcntl (sys_timerfd, F_SETFD, FD_CLOEXEC);
+	fcntl (sys_timerfd, F_SETFL, fcntl (sys_timerfd, F_GETFL, 0) | O_NONBLOCK);
+
+	memset (&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = EV_TIMER;
+
+	if (epoll_ctl (sys_epollfd, EPOLL_CTL_ADD, sys_timerfd, &ev) == -1)
+		goto fail;
+
+	return true;
+
+fail:
+	Com_Printf ("WARNING: Couldn't set up epoll/timerfd (%s), using select.\n", LOG_GENERAL|LOG_WARNING, strerror (errno));
+
+	if (sys_timerfd != -1)
+		close (sys_timerfd);
+
+	if (sys_epollfd != -1)
+		close (sys_epollfd);
+
+	sys_timerfd = sys_epollfd = -1;
+	sys_events_failed = true;
+	return false;
+}
+
+static void Sys_WatchEvent (int fd, uint32 tag, qboolean watch)
+{
+	struct epoll_event	ev;
+
+	memset (&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = tag;
+
+	if (watch)
+	{
+		if (epoll_ctl (sys_epollfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+		{
+			//stdin can be a regular file which epoll refuses
+			if (tag == EV_STDIN)
+				sys_stdin_unwatchable = true;
+			else
+				Com_Printf ("WARNING: epoll_ctl: %s\n", LOG_GENERAL|LOG_WARNING, strerror (errno));
+			return;
+		}
+	}
+	else
+	{
+		//sockets that were closed are already gone from the set
+		epoll_ctl (sys_epollfd, EPOLL_CTL_DEL, fd, &ev);
+	}
+
+	if (tag == EV_SOCKET)
+		sys_watched_socket = watch ? fd : 0;
+	else if (tag == EV_STDIN)
+		sys_watching_stdin = watch;
+}
+
+qboolean Sys_EventWait (int sock, int msec)
+{
+	struct epoll_event	events[4];
+	struct itimerspec	its;
+	struct timeval		before, after;
+	unsigned int		target;
+	uint64				deadline, now, expirations;
+	qboolean			want_stdin;
+	int					i, n;
+
+	if (sys_epollfd == -1 && (sys_events_failed || !Sys_InitEvents ()))
+		return false;
+
+	if (sock != sys_watched_socket)
+	{
+		if (sys_watched_socket)
+			Sys_WatchEvent (sys_watched_socket, EV_SOCKET, false);
+
+		if (sock)
+			Sys_WatchEvent (sock, EV_SOCKET, true);
+	}
+
+	want_stdin = stdin_active && !(nostdin && nostdin->intvalue) && !sys_stdin_unwatchable;
+	if (want_stdin != sys_watching_stdin)
+		Sys_WatchEvent (0, EV_STDIN, want_stdin);
+
+	//Sys_Milliseconds counts from sys_secbase on the realtime clock
+	target = sys_loop_time + msec;
+	deadline = (uint64)(sys_secbase + target / 1000) * 1000000 + (target % 1000) * 1000;
+
+	memset (&its, 0, sizeof(its));
+	its.it_value.tv_sec = sys_secbase + target / 1000;
+	its.it_value.tv_nsec = (target % 1000) * 1000000;
+
+	if (timerfd_settime (sys_timerfd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+		return false;
+
+	gettimeofday (&before, NULL);
+
+	//timeout is only a safety net, the timer should always fire first
+	n = epoll_wait (sys_epollfd, events, sizeof(events) / sizeof(events[0]), msec + 1);
+
+	gettimeofday (&after, NULL);
+
+	now = (uint64)after.tv_sec * 1000000 + after.tv_usec;
+
+	ev_waits++;
+	ev_slept_usec += now - ((uint64)before.tv_sec * 1000000 + before.tv_usec);
+
+	if (n == 0)
+		ev_timeouts++;
+
+	for (i = 0; i < n; i++)
+	{
+		switch (events[i].data.u32)
+		{
+			case EV_SOCKET:
+				ev_socket_wakes++;
+				break;
+			case EV_STDIN:
+				ev_stdin_wakes++;
+				//closed pipe, would wake us up forever
+				if (events[i].events & (EPOLLHUP|EPOLLERR))
+				{
+					Sys_WatchEvent (0, EV_STDIN, false);
+					sys_stdin_unwatchable = true;
+				}
+				break;
+			case EV_TIMER:
+				read (sys_timerfd, &expirations, sizeof(expirations));
+				ev_timer_wakes++;
+				if (now > deadline)
+				{
+					ev_late_usec += now - deadline;
+					if (now - deadline > ev_max_late_usec)
+						ev_max_late_usec = (unsigned int)(now - deadline);
+				}
+				break;
+		}
+	}
+
+	return true;
+}
+
 void Sys_Spinstats_f (void)
 {
 	Com_Printf ("%u fast spins, %u slow spins, %.2f%% slow.\n", LOG_GENERAL, goodspins, badspins, ((float)badspins / (float)(goodspins+badspins)) * 100.0f);
+
+	if (sys_epollfd == -1)
+	{
+		Com_Printf ("epoll event loop %s.\n", LOG_GENERAL, sys_events_failed ? "unavailable" : "not in use");
+		return;
+	}
+
+	Com_Printf ("%u waits, %.1fs asleep. woken by: %u packets, %u timers, %u console, %u timeouts.\n", LOG_GENERAL,
+		ev_waits, (double)ev_slept_usec / 1000000.0, ev_socket_wakes, ev_timer_wakes, ev_stdin_wakes, ev_timeouts);
+
+	if (ev_timer_wakes)
+		Com_Printf ("timer lateness: %.1fus average, %uus max.\n", LOG_GENERAL, (double)ev_late_usec / (double)ev_timer_wakes, ev_max_late_usec);
 }
 
 unsigned short Sys_GetFPUStatus (void)
@@ -635,6 +835,8 @@ int main (int argc, char **argv)
 			badspins++;
 		else
 			goodspins++;
+
+		sys_loop_time = newtime;
 		
 		Qcommon_Frame (time);
 		oldtime = newtime;
@@ -0,0 +1,441 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// bitset.c -- vectorized kernels for vis rows and entity bitsets
+
+#include "qcommon.h"
+
+//r1: all kernels use unaligned loads so callers can pass any uint32 row,
+//the SSE2 / AVX2 versions are picked at startup by Bit_Init.
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define	BITSET_SIMD
+#define	BITSET_TARGET(x)	__attribute__((target(x)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && _MSC_VER >= 1600 && (defined(_M_IX86) || defined(_M_X64))
+#define	BITSET_SIMD
+#define	BITSET_TARGET(x)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+void		(*Bit_Or) (uint32 *out, const uint32 *in, int words);
+void		(*Bit_And) (uint32 *out, const uint32 *in, int words);
+qboolean	(*Bit_Intersects) (const uint32 *a, const uint32 *b, int words);
+int			(*Bit_Count) (const uint32 *in, int words);
+
+/*
+===============================================================================
+
+SCALAR
+
+===============================================================================
+*/
+
+static void Bit_OrScalar (uint32 *out, const uint32 *in, int words)
+{
+	int		i;
+
+	for (i = 0; i < words; i++)
+		out[i] |= in[i];
+}
+
+static void Bit_AndScalar (uint32 *out, const uint32 *in, int words)
+{
+	int		i;
+
+	for (i = 0; i < words; i++)
+		out[i] &= in[i];
+}
+
+static qboolean Bit_IntersectsScalar (const uint32 *a, const uint32 *b, int words)
+{
+	int		i;
+
+	for (i = 0; i < words; i++)
+	{
+		if (a[i] & b[i])
+			return true;
+	}
+
+	return false;
+}
+
+static int Bit_CountWord (uint32 v)
+{
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+static int Bit_CountScalar (const uint32 *in, int words)
+{
+	int		i;
+	int		count;
+
+	count = 0;
+	for (i = 0; i < words; i++)
+		count += Bit_CountWord (in[i]);
+
+	return count;
+}
+
+#ifdef BITSET_SIMD
+/*
+===============================================================================
+
+SSE2
+
+===============================================================================
+*/
+
+BITSET_TARGET("sse2") static void Bit_OrSSE2 (uint32 *out, const uint32 *in, int words)
+{
+	int		i;
+	__m128i	a, b;
+
+	for (i = 0; i + 4 <= words; i += 4)
+	{
+		a = _mm_loadu_si128 ((const __m128i *)(out + i));
+		b = _mm_loadu_si128 ((const __m128i *)(in + i));
+		_mm_storeu_si128 ((__m128i *)(out + i), _mm_or_si128 (a, b));
+	}
+
+	for (; i < words; i++)
+		out[i] |= in[i];
+}
+
+BITSET_TARGET("sse2") static void Bit_AndSSE2 (uint32 *out, const uint32 *in, int words)
+{
+	int		i;
+	__m128i	a, b;
+
+	for (i = 0; i + 4 <= words; i += 4)
+	{
+		a = _mm_loadu_si128 ((const __m128i *)(out + i));
+		b = _mm_loadu_si128 ((const __m128i *)(in + i));
+		_mm_storeu_si128 ((__m128i *)(out + i), _mm_and_si128 (a, b));
+	}
+
+	for (; i < words; i++)
+		out[i] &= in[i];
+}
+
+BITSET_TARGET("sse2") static qboolean Bit_IntersectsSSE2 (const uint32 *a, const uint32 *b, int words)
+{
+	int		i;
+	__m128i	x;
+
+	for (i = 0; i + 4 <= words; i += 4)
+	{
+		x = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *)(a + i)), _mm_loadu_si128 ((const __m128i *)(b + i)));
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (x, _mm_setzero_si128 ())) != 0xFFFF)
+			return true;
+	}
+
+	for (; i < words; i++)
+	{
+		if (a[i] & b[i])
+			return true;
+	}
+
+	return false;
+}
+
+//per byte popcount with the usual shift/mask reduction, then summed with psadbw
+BITSET_TARGET("sse2") static int Bit_CountSSE2 (const uint32 *in, int words)
+{
+	int		i;
+	int		count;
+	__m128i	v, total;
+	const __m128i	m1 = _mm_set1_epi8 (0x55);
+	const __m128i	m2 = _mm_set1_epi8 (0x33);
+	const __m128i	m4 = _mm_set1_epi8 (0x0F);
+
+	total = _mm_setzero_si128 ();
+
+	for (i = 0; i + 4 <= words; i += 4)
+	{
+		v = _mm_loadu_si128 ((const __m128i *)(in + i));
+		v = _mm_sub_epi8 (v, _mm_and_si128 (_mm_srli_epi16 (v, 1), m1));
+		v = _mm_add_epi8 (_mm_and_si128 (v, m2), _mm_and_si128 (_mm_srli_epi16 (v, 2), m2));
+		v = _mm_and_si128 (_mm_add_epi8 (v, _mm_srli_epi16 (v, 4)), m4);
+		total = _mm_add_epi64 (total, _mm_sad_epu8 (v, _mm_setzero_si128 ()));
+	}
+
+	count = _mm_cvtsi128_si32 (total) + _mm_cvtsi128_si32 (_mm_srli_si128 (total, 8));
+
+	for (; i < words; i++)
+		count += Bit_CountWord (in[i]);
+
+	return count;
+}
+
+/*
+===============================================================================
+
+AVX2
+
+===============================================================================
+*/
+
+BITSET_TARGET("avx2") static void Bit_OrAVX2 (uint32 *out, const uint32 *in, int words)
+{
+	int		i;
+	__m256i	a, b;
+
+	for (i = 0; i + 8 <= words; i += 8)
+	{
+		a = _mm256_loadu_si256 ((const __m256i *)(out + i));
+		b = _mm256_loadu_si256 ((const __m256i *)(in + i));
+		_mm256_storeu_si256 ((__m256i *)(out + i), _mm256_or_si256 (a, b));
+	}
+
+	for (; i < words; i++)
+		out[i] |= in[i];
+}
+
+BITSET_TARGET("avx2") static void Bit_AndAVX2 (uint32 *out, const uint32 *in, int words)
+{
+	int		i;
+	__m256i	a, b;
+
+	for (i = 0; i + 8 <= words; i += 8)
+	{
+		a = _mm256_loadu_si256 ((const __m256i *)(out + i));
+		b = _mm256_loadu_si256 ((const __m256i *)(in + i));
+		_mm256_storeu_si256 ((__m256i *)(out + i), _mm256_and_si256 (a, b));
+	}
+
+	for (; i < words; i++)
+		out[i] &= in[i];
+}
+
+BITSET_TARGET("avx2") static qboolean Bit_IntersectsAVX2 (const uint32 *a, const uint32 *b, int words)
+{
+	int		i;
+
+	for (i = 0; i + 8 <= words; i += 8)
+	{
+		if (!_mm256_testz_si256 (_mm256_loadu_si256 ((const __m256i *)(a + i)), _mm256_loadu_si256 ((const __m256i *)(b + i))))
+			return true;
+	}
+
+	for (; i < words; i++)
+	{
+		if (a[i] & b[i])
+			return true;
+	}
+
+	return false;
+}
+
+//nibble lookup popcount, summed with vpsadbw
+BITSET_TARGET("avx2") static int Bit_CountAVX2 (const uint32 *in, int words)
+{
+	int		i;
+	int		count;
+	__m256i	v, total;
+	__m128i	sum;
+	const __m256i	lookup = _mm256_setr_epi8 (0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i	low = _mm256_set1_epi8 (0x0F);
+
+	total = _mm256_setzero_si256 ();
+
+	for (i = 0; i + 8 <= words; i += 8)
+	{
+		v = _mm256_loadu_si256 ((const __m256i *)(in + i));
+		v = _mm256_add_epi8 (_mm256_shuffle_epi8 (lookup, _mm256_and_si256 (v, low)),
+							 _mm256_shuffle_epi8 (lookup, _mm256_and_si256 (_mm256_srli_epi16 (v, 4), low)));
+		total = _mm256_add_epi64 (total, _mm256_sad_epu8 (v, _mm256_setzero_si256 ()));
+	}
+
+	sum = _mm_add_epi64 (_mm256_castsi256_si128 (total), _mm256_extracti128_si256 (total, 1));
+	count = _mm_cvtsi128_si32 (sum) + _mm_cvtsi128_si32 (_mm_srli_si128 (sum, 8));
+
+	for (; i < words; i++)
+		count += Bit_CountWord (in[i]);
+
+	return count;
+}
+
+static void Bit_CPUFeatures (qboolean *sse2, qboolean *avx2)
+{
+#ifdef _MSC_VER
+	int		info[4];
+
+	*sse2 = *avx2 = false;
+
+	__cpuid (info, 0);
+	if (info[0] < 1)
+		return;
+
+	__cpuid (info, 1);
+	*sse2 = (info[3] & (1 << 26)) ? true : false;
+
+	//avx needs osxsave and the os saving ymm state
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv (0) & 6) != 6)
+		return;
+
+	__cpuid (info, 0);
+	if (info[0] < 7)
+		return;
+
+	__cpuidex (info, 7, 0);
+	*avx2 = (info[1] & (1 << 5)) ? true : false;
+#else
+	__builtin_cpu_init ();
+	*sse2 = __builtin_cpu_supports ("sse2") ? true : false;
+	*avx2 = __builtin_cpu_supports ("avx2") ? true : false;
+#endif
+}
+#endif
+
+typedef struct
+{
+	const char	*name;
+	void		(*merge) (uint32 *out, const uint32 *in, int words);
+	void		(*mask) (uint32 *out, const uint32 *in, int words);
+	qboolean	(*intersects) (const uint32 *a, const uint32 *b, int words);
+	int			(*count) (const uint32 *in, int words);
+	qboolean	supported;
+} bitkernels_t;
+
+static bitkernels_t	bitkernels[] =
+{
+	{"scalar", Bit_OrScalar, Bit_AndScalar, Bit_IntersectsScalar, Bit_CountScalar, true},
+#ifdef BITSET_SIMD
+	{"sse2", Bit_OrSSE2, Bit_AndSSE2, Bit_IntersectsSSE2, Bit_CountSSE2, false},
+	{"avx2", Bit_OrAVX2, Bit_AndAVX2, Bit_IntersectsAVX2, Bit_CountAVX2, false},
+#endif
+};
+
+#define	NUM_BITKERNELS	(int)(sizeof(bitkernels) / sizeof(bitkernels[0]))
+
+static const bitkernels_t	*bit_active;
+
+static void Bit_Select (const bitkernels_t *k)
+{
+	bit_active = k;
+	Bit_Or = k->merge;
+	Bit_And = k->mask;
+	Bit_Intersects = k->intersects;
+	Bit_Count = k->count;
+}
+
+/*
+===============
+Bit_Bench_f
+
+Times each available kernel on two pvs rows of the loaded map.
+===============
+*/
+static void Bit_Bench_f (void)
+{
+	static uint32		rowa[MAX_MAP_LEAFS/32];
+	static uint32		rowb[MAX_MAP_LEAFS/32];
+	static uint32		work[MAX_MAP_LEAFS/32];
+	byte				buffer[MAX_MAP_LEAFS/8];
+	const bitkernels_t	*k;
+	volatile int		sink;
+	int					i, j, iterations, words;
+	int					start, ms[4];
+
+	if (!CM_MapName()[0])
+	{
+		Com_Printf ("No map loaded.\n", LOG_GENERAL);
+		return;
+	}
+
+	iterations = 1000000;
+	if (Cmd_Argc() > 1)
+		iterations = atoi (Cmd_Argv(1));
+
+	if (iterations < 1000)
+		iterations = 1000;
+
+	words = (CM_NumClusters + 31) >> 5;
+
+	memset (rowa, 0, sizeof(rowa));
+	memset (rowb, 0, sizeof(rowb));
+	memcpy (rowa, CM_ClusterPVS (0, buffer), (CM_NumClusters + 7) >> 3);
+	memcpy (rowb, CM_ClusterPVS (CM_NumClusters / 2, buffer), (CM_NumClusters + 7) >> 3);
+
+	Com_Printf ("%s: %d clusters (%d words), %d iterations, ns per call\n", LOG_GENERAL, CM_MapName(), CM_NumClusters, words, iterations);
+	Com_Printf ("kernel       or      and    isect    count\n", LOG_GENERAL);
+
+	sink = 0;
+
+	for (i = 0; i < NUM_BITKERNELS; i++)
+	{
+		k = &bitkernels[i];
+		if (!k->supported)
+			continue;
+
+		memcpy (work, rowa, sizeof(work));
+
+		start = Sys_Milliseconds ();
+		for (j = 0; j < iterations; j++)
+			k->merge (work, rowb, words);
+		ms[0] = Sys_Milliseconds () - start;
+
+		start = Sys_Milliseconds ();
+		for (j = 0; j < iterations; j++)
+			k->mask (work, rowa, words);
+		ms[1] = Sys_Milliseconds () - start;
+
+		start = Sys_Milliseconds ();
+		for (j = 0; j < iterations; j++)
+			sink += k->intersects (rowa, rowb, words);
+		ms[2] = Sys_Milliseconds () - start;
+
+		start = Sys_Milliseconds ();
+		for (j = 0; j < iterations; j++)
+			sink += k->count (work, words);
+		ms[3] = Sys_Milliseconds () - start;
+
+		Com_Printf ("%-6s %8.1f %8.1f %8.1f %8.1f%s\n", LOG_GENERAL, k->name,
+			ms[0] * 1e6 / iterations, ms[1] * 1e6 / iterations,
+			ms[2] * 1e6 / iterations, ms[3] * 1e6 / iterations,
+			k == bit_active ? " (active)" : "");
+	}
+}
+
+void Bit_Init (void)
+{
+	int			i;
+#ifdef BITSET_SIMD
+	qboolean	sse2, avx2;
+
+	Bit_CPUFeatures (&sse2, &avx2);
+
+	bitkernels[1].supported = sse2;
+	bitkernels[2].supported = avx2;
+#endif
+
+	for (i = NUM_BITKERNELS - 1; i >= 0; i--)
+	{
+		if (bitkernels[i].supported)
+		{
+			Bit_Select (&bitkernels[i]);
+			break;
+		}
+	}
+
+	Cmd_AddCommand ("bitbench", Bit_Bench_f);
+}
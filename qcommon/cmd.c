@@ -488,7 +488,7 @@ void Cmd_Exec_f (void)
 		len = COMMAND_BUFFER_SIZE - 2;
 	}
 
-	len = FS_LoadFile (path, (void **)&f);
+	len = FS_LoadFileView (path, (void **)&f);
 	if (!f || len <= 0)
 	{
 		//ugly hack to avoid printing missing config errors before startup finishes
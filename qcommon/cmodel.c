@@ -39,7 +39,6 @@ typedef struct
 	int			contents;
 	int			numsides;
 	int			firstbrushside;
-	int			checkcount;		// to avoid repeated testings
 } cbrush_t;
 
 typedef struct
@@ -50,8 +49,6 @@ typedef struct
 	int		floodvalid;
 } carea_t;
 
-static int			checkcount;
-
 static char		map_name[MAX_QPATH];
 
 static int			numbrushsides;
@@ -103,9 +100,13 @@ static qboolean		portalopen[MAX_MAP_AREAPORTALS];
 
 
 static	cvar_t		*map_noareas;
+static	cvar_t		*cm_viscache;
 
 void	CM_InitBoxHull (void);
 void	FloodAreaConnections (void);
+static void	CM_FreeVisCache (void);
+static void	CM_BuildVisCache (void);
+static void	CM_InitNodeMasks (void);
 
 #ifndef DEDICATED_ONLY
 int		c_pointcontents;
@@ -598,6 +599,9 @@ cmodel_t *CM_LoadMap (const char *name, qboolean clientload, uint32 *checksum)
 	static uint32	last_checksum;
 	map_noareas = Cvar_Get ("map_noareas", "0", 0);
 
+	cm_viscache = Cvar_Get ("cm_viscache", "16384", 0);
+	cm_viscache->help = "Kilobytes of memory to use for decompressed PVS/PHS rows. If the whole map fits it is expanded at load time, otherwise recently used rows are cached. 0 disables. Default 16384.\n";
+
 	if (!strcmp (map_name, name) && (clientload || !Cvar_IntValue ("flushmap")) )
 	{
 		*checksum = last_checksum;
@@ -621,6 +625,8 @@ cmodel_t *CM_LoadMap (const char *name, qboolean clientload, uint32 *checksum)
 	memset (map_entitystring, 0, sizeof(map_entitystring));
 	memset (map_name, 0, sizeof(map_name));
 
+	CM_FreeVisCache ();
+
 	if (!name || !name[0])
 	{
 		numleafs = 1;
@@ -720,7 +726,7 @@ cmodel_t *CM_LoadMap (const char *name, qboolean clientload, uint32 *checksum)
 #endif
 
 	if (!length)*/
-		length = FS_LoadFile (name, (void **)&buf);
+		length = FS_LoadFileView (name, (void **)&buf);
 
 	if (!buf)
 	{
@@ -790,11 +796,13 @@ cmodel_t *CM_LoadMap (const char *name, qboolean clientload, uint32 *checksum)
 	CMod_LoadAreas (&header.lumps[LUMP_AREAS]);
 	CMod_LoadAreaPortals (&header.lumps[LUMP_AREAPORTALS]);
 	CMod_LoadVisibility (&header.lumps[LUMP_VISIBILITY]);
+	CM_BuildVisCache ();
+	CM_InitNodeMasks ();
 
 	if (!(override_bits & 4))
 		CMod_LoadEntityString (&header.lumps[LUMP_ENTITIES]);
 
-	Z_Free (buf);
+	FS_FreeFile (buf);
 
 	CM_InitBoxHull ();
 
@@ -1044,12 +1052,15 @@ CM_BoxLeafnums
 Fills in a list of all the leafs touched
 =============
 */
-int		leaf_count, leaf_maxcount;
-int		*leaf_list;
-float	*leaf_mins, *leaf_maxs;
-int		leaf_topnode;
+typedef struct
+{
+	int		count, maxcount;
+	int		*list;
+	float	*mins, *maxs;
+	int		topnode;
+} leafcontext_t;
 
-void CM_BoxLeafnums_r (int nodenum)
+static void CM_BoxLeafnums_r (leafcontext_t *lc, int nodenum)
 {
 	cplane_t	*plane;
 	cnode_t		*node;
@@ -1059,27 +1070,27 @@ void CM_BoxLeafnums_r (int nodenum)
 	{
 		if (nodenum < 0)
 		{
-			if (leaf_count >= leaf_maxcount)
+			if (lc->count >= lc->maxcount)
 			{
 				return;
 			}
-			leaf_list[leaf_count++] = -1 - nodenum;
+			lc->list[lc->count++] = -1 - nodenum;
 			return;
 		}
 	
 		node = &map_nodes[nodenum];
 		plane = node->plane;
-//		s = BoxOnPlaneSide (leaf_mins, leaf_maxs, plane);
-		s = BOX_ON_PLANE_SIDE(leaf_mins, leaf_maxs, plane);
+//		s = BoxOnPlaneSide (lc->mins, lc->maxs, plane);
+		s = BOX_ON_PLANE_SIDE(lc->mins, lc->maxs, plane);
 		if (s == 1)
 			nodenum = node->children[0];
 		else if (s == 2)
 			nodenum = node->children[1];
 		else
 		{	// go down both
-			if (leaf_topnode == -1)
-				leaf_topnode = nodenum;
-			CM_BoxLeafnums_r (node->children[0]);
+			if (lc->topnode == -1)
+				lc->topnode = nodenum;
+			CM_BoxLeafnums_r (lc, node->children[0]);
 			nodenum = node->children[1];
 		}
 
@@ -1088,20 +1099,22 @@ void CM_BoxLeafnums_r (int nodenum)
 
 int	CM_BoxLeafnums_headnode (vec3_t mins, vec3_t maxs, int *list, int listsize, int headnode, int /*@null@*/*topnode)
 {
-	leaf_list = list;
-	leaf_count = 0;
-	leaf_maxcount = listsize;
-	leaf_mins = mins;
-	leaf_maxs = maxs;
+	leafcontext_t	lc;
+
+	lc.list = list;
+	lc.count = 0;
+	lc.maxcount = listsize;
+	lc.mins = mins;
+	lc.maxs = maxs;
 
-	leaf_topnode = -1;
+	lc.topnode = -1;
 
-	CM_BoxLeafnums_r (headnode);
+	CM_BoxLeafnums_r (&lc, headnode);
 
 	if (topnode)
-		*topnode = leaf_topnode;
+		*topnode = lc.topnode;
 
-	return leaf_count;
+	return lc.count;
 }
 
 int	CM_BoxLeafnums (vec3_t mins, vec3_t maxs, int *list, int listsize, int /*@null@*/*topnode)
@@ -1173,20 +1186,31 @@ BOX TRACING
 // 1/32 epsilon to keep floating point happy
 #define	DIST_EPSILON	(0.03125f)
 
-vec3_t	trace_start, trace_end;
-vec3_t	trace_mins, trace_maxs;
-vec3_t	trace_extents;
+//r1: all state of a trace lives in its context so traces can run on
+//several threads at once.
+typedef struct
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		extents;
+
+	trace_t		trace;
+	int			contents;
+	qboolean	ispoint;		// optimized case
+	int			checkcount;
+} tracecontext_t;
 
-trace_t	trace_trace;
-int		trace_contents;
-qboolean	trace_ispoint;		// optimized case
+//brushes already tested by the current trace, kept per thread instead of in
+//cbrush_t so concurrent traces don't skip each other's brushes
+static THREADLOCAL int	trace_checkcount;
+static THREADLOCAL int	trace_brushchecks[MAX_MAP_BRUSHES];
 
 /*
 ================
 CM_ClipBoxToBrush
 ================
 */
-void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
+static void CM_ClipBoxToBrush (const tracecontext_t *tc, vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 					  trace_t *trace, cbrush_t *brush)
 {
 	int			i, j;
@@ -1221,7 +1245,7 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 
 		// FIXME: special case for axial
 
-		if (!trace_ispoint)
+		if (!tc->ispoint)
 		{	// general box case
 
 			// push the plane out apropriately for mins/maxs
@@ -1307,7 +1331,7 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 CM_TestBoxInBrush
 ================
 */
-void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
+static void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 					  trace_t *trace, cbrush_t *brush)
 {
 	int			i, j;
@@ -1362,7 +1386,7 @@ void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 CM_TraceToLeaf
 ================
 */
-void CM_TraceToLeaf (int leafnum)
+static void CM_TraceToLeaf (tracecontext_t *tc, int leafnum)
 {
 	int			k;
 	int			brushnum;
@@ -1370,21 +1394,21 @@ void CM_TraceToLeaf (int leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & tc->contents))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
 		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
+		if (trace_brushchecks[brushnum] == tc->checkcount)
 			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
+		trace_brushchecks[brushnum] = tc->checkcount;
 
-		if ( !(b->contents & trace_contents))
+		if ( !(b->contents & tc->contents))
 			continue;
-		CM_ClipBoxToBrush (trace_mins, trace_maxs, trace_start, trace_end, &trace_trace, b);
-		if (FLOAT_EQ_ZERO (trace_trace.fraction))
+		CM_ClipBoxToBrush (tc, tc->mins, tc->maxs, tc->start, tc->end, &tc->trace, b);
+		if (FLOAT_EQ_ZERO (tc->trace.fraction))
 			return;
 	}
 
@@ -1396,7 +1420,7 @@ void CM_TraceToLeaf (int leafnum)
 CM_TestInLeaf
 ================
 */
-void CM_TestInLeaf (int leafnum)
+static void CM_TestInLeaf (tracecontext_t *tc, int leafnum)
 {
 	int			k;
 	int			brushnum;
@@ -1404,21 +1428,21 @@ void CM_TestInLeaf (int leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & tc->contents))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
 		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
+		if (trace_brushchecks[brushnum] == tc->checkcount)
 			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
+		trace_brushchecks[brushnum] = tc->checkcount;
 
-		if ( !(b->contents & trace_contents))
+		if ( !(b->contents & tc->contents))
 			continue;
-		CM_TestBoxInBrush (trace_mins, trace_maxs, trace_start, &trace_trace, b);
-		if (FLOAT_EQ_ZERO(trace_trace.fraction))
+		CM_TestBoxInBrush (tc->mins, tc->maxs, tc->start, &tc->trace, b);
+		if (FLOAT_EQ_ZERO(tc->trace.fraction))
 			return;
 	}
 
@@ -1431,7 +1455,7 @@ CM_RecursiveHullCheck
 
 ==================
 */
-void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
+static void CM_RecursiveHullCheck (tracecontext_t *tc, int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 {
 	cnode_t		*node;
 	fplane_t	*plane;
@@ -1442,7 +1466,7 @@ void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 	int			side;
 	float		midf;
 
-	if (trace_trace.fraction <= p1f)
+	if (tc->trace.fraction <= p1f)
 		return;		// already hit something nearer
 
 	//if (++recursions == 512)
@@ -1451,7 +1475,7 @@ void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 	// if < 0, we are in a leaf node
 	if (num < 0)
 	{
-		CM_TraceToLeaf (-1-num);
+		CM_TraceToLeaf (tc, -1-num);
 		return;
 	}
 
@@ -1469,36 +1493,36 @@ void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 	{
 		t1 = p1[plane->type] - plane->dist;
 		t2 = p2[plane->type] - plane->dist;
-		offset = trace_extents[plane->type];
+		offset = tc->extents[plane->type];
 	}
 	else
 	{
 		t1 = DotProduct (plane->normal, p1) - plane->dist;
 		t2 = DotProduct (plane->normal, p2) - plane->dist;
-		if (trace_ispoint)
+		if (tc->ispoint)
 			offset = 0;
 		else
-			offset = (float)fabs(trace_extents[0]*plane->normal[0]) +
-				(float)fabs(trace_extents[1]*plane->normal[1]) +
-				(float)fabs(trace_extents[2]*plane->normal[2]);
+			offset = (float)fabs(tc->extents[0]*plane->normal[0]) +
+				(float)fabs(tc->extents[1]*plane->normal[1]) +
+				(float)fabs(tc->extents[2]*plane->normal[2]);
 	}
 
 
 #if 0
-CM_RecursiveHullCheck (node->children[0], p1f, p2f, p1, p2);
-CM_RecursiveHullCheck (node->children[1], p1f, p2f, p1, p2);
+CM_RecursiveHullCheck (tc, node->children[0], p1f, p2f, p1, p2);
+CM_RecursiveHullCheck (tc, node->children[1], p1f, p2f, p1, p2);
 return;
 #endif
 
 	// see which sides we need to consider
 	if (t1 >= offset && t2 >= offset)
 	{
-		CM_RecursiveHullCheck (node->children[0], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck (tc, node->children[0], p1f, p2f, p1, p2);
 		return;
 	}
 	if (t1 < -offset && t2 < -offset)
 	{
-		CM_RecursiveHullCheck (node->children[1], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck (tc, node->children[1], p1f, p2f, p1, p2);
 		return;
 	}
 
@@ -1537,7 +1561,7 @@ return;
 	mid[1] = p1[1] + frac*(p2[1] - p1[1]);
 	mid[2] = p1[2] + frac*(p2[2] - p1[2]);
 
-	CM_RecursiveHullCheck (node->children[side], p1f, midf, p1, mid);
+	CM_RecursiveHullCheck (tc, node->children[side], p1f, midf, p1, mid);
 
 
 	// go past the node
@@ -1552,8 +1576,8 @@ return;
 	mid[1] = p1[1] + frac2*(p2[1] - p1[1]);
 	mid[2] = p1[2] + frac2*(p2[2] - p1[2]);
 
-	//if (trace_trace.fraction > midf)
-		CM_RecursiveHullCheck (node->children[side^1], midf, p2f, mid, p2);
+	//if (tc->trace.fraction > midf)
+		CM_RecursiveHullCheck (tc, node->children[side^1], midf, p2f, mid, p2);
 }
 
 
@@ -1562,44 +1586,44 @@ return;
 
 /*
 ==================
-CM_BoxTrace
+CM_TraceBox
 ==================
 */
-trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
+static void CM_TraceBox (tracecontext_t *tc, vec3_t start, vec3_t end,
 						  vec3_t mins, vec3_t maxs,
 						  int headnode, int brushmask)
 {
-	checkcount++;		// for multi-check avoidance
+	tc->checkcount = ++trace_checkcount;		// for multi-check avoidance
 
 #ifndef DEDICATED_ONLY
 	c_traces++;			// for statistics, may be zeroed
 #endif
 
 	// fill in a default trace
-	memset (&trace_trace, 0, sizeof(trace_trace));
+	memset (&tc->trace, 0, sizeof(tc->trace));
 
-	trace_trace.fraction = 1;
-	trace_trace.surface = &(nullsurface.c);
+	tc->trace.fraction = 1;
+	tc->trace.surface = &(nullsurface.c);
 
-	/*trace_trace.allsolid = false;
-	trace_trace.startsolid = false;
-	trace_trace.fraction = 1;
-	VectorClear (trace_trace.endpos);
+	/*tc->trace.allsolid = false;
+	tc->trace.startsolid = false;
+	tc->trace.fraction = 1;
+	VectorClear (tc->trace.endpos);
 
-	memset (&trace_trace.plane, 0, sizeof(trace_trace.plane));
-	trace_trace.surface = &(nullsurface.c);
-	trace_trace.contents = 0;
-	trace_trace.ent = NULL;*/
+	memset (&tc->trace.plane, 0, sizeof(tc->trace.plane));
+	tc->trace.surface = &(nullsurface.c);
+	tc->trace.contents = 0;
+	tc->trace.ent = NULL;*/
 
 
 	if (!numnodes)	// map not loaded
-		return trace_trace;
+		return;
 
-	trace_contents = brushmask;
-	FastVectorCopy (*start, trace_start);
-	FastVectorCopy (*end, trace_end);
-	FastVectorCopy (*mins, trace_mins);
-	FastVectorCopy (*maxs, trace_maxs);
+	tc->contents = brushmask;
+	FastVectorCopy (*start, tc->start);
+	FastVectorCopy (*end, tc->end);
+	FastVectorCopy (*mins, tc->mins);
+	FastVectorCopy (*maxs, tc->maxs);
 
 	//
 	// check for position test special case
@@ -1624,12 +1648,12 @@ trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
 		numleafs = CM_BoxLeafnums_headnode (c1, c2, leafs, 1024, headnode, &topnode);
 		for (i=0 ; i<numleafs ; i++)
 		{
-			CM_TestInLeaf (leafs[i]);
-			if (trace_trace.allsolid)
+			CM_TestInLeaf (tc, leafs[i]);
+			if (tc->trace.allsolid)
 				break;
 		}
-		FastVectorCopy (*start, trace_trace.endpos);
-		return trace_trace;
+		FastVectorCopy (*start, tc->trace.endpos);
+		return;
 	}
 
 	//
@@ -1638,34 +1662,49 @@ trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
 	if (FLOAT_EQ_ZERO(mins[0]) && FLOAT_EQ_ZERO(mins[1]) && FLOAT_EQ_ZERO(mins[2])
 		&& FLOAT_EQ_ZERO(maxs[0]) && FLOAT_EQ_ZERO(maxs[1]) && FLOAT_EQ_ZERO(maxs[2]))
 	{
-		trace_ispoint = true;
-		VectorClear (trace_extents);
+		tc->ispoint = true;
+		VectorClear (tc->extents);
 	}
 	else
 	{
-		trace_ispoint = false;
-		trace_extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
-		trace_extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
-		trace_extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+		tc->ispoint = false;
+		tc->extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
+		tc->extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
+		tc->extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
 	}
 
 	//
 	// general sweeping through world
 	//
 	//recursions = 0;
-	CM_RecursiveHullCheck (headnode, 0, 1, start, end);
+	CM_RecursiveHullCheck (tc, headnode, 0, 1, start, end);
 
-	if (trace_trace.fraction == 1.0f)
+	if (tc->trace.fraction == 1.0f)
 	{
-		FastVectorCopy (*end, trace_trace.endpos);
+		FastVectorCopy (*end, tc->trace.endpos);
 	}
 	else
 	{
-		trace_trace.endpos[0] = start[0] + trace_trace.fraction * (end[0] - start[0]);
-		trace_trace.endpos[1] = start[1] + trace_trace.fraction * (end[1] - start[1]);
-		trace_trace.endpos[2] = start[2] + trace_trace.fraction * (end[2] - start[2]);
+		tc->trace.endpos[0] = start[0] + tc->trace.fraction * (end[0] - start[0]);
+		tc->trace.endpos[1] = start[1] + tc->trace.fraction * (end[1] - start[1]);
+		tc->trace.endpos[2] = start[2] + tc->trace.fraction * (end[2] - start[2]);
 	}
-	return trace_trace;
+}
+
+/*
+==================
+CM_BoxTrace
+==================
+*/
+trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int headnode, int brushmask)
+{
+	tracecontext_t	tc;
+
+	CM_TraceBox (&tc, start, end, mins, maxs, headnode, brushmask);
+
+	return tc.trace;
 }
 
 
@@ -1802,25 +1841,304 @@ void CM_DecompressVis (byte *in, byte *out)
 	} while (out_p - out < row);
 }
 
-byte	pvsrow[MAX_MAP_LEAFS/8];
-byte	phsrow[MAX_MAP_LEAFS/8];
+//r1: decompressed vis rows. if the whole pvs+phs matrix fits in cm_viscache
+//kilobytes it is expanded once at map load and rows are handed out directly,
+//otherwise recently used rows are kept in a small lru shared by all threads.
+#define	VISCACHE_ALIGN	64
 
-byte	*CM_ClusterPVS (int cluster)
+typedef struct visslot_s
 {
-	if (cluster == -1)
-		memset (pvsrow, 0, (numclusters+7)>>3);
+	int					key;		// (cluster << 1) | DVIS_*, -1 if unused
+	struct visslot_s	*hashnext;
+	struct visslot_s	*prev;
+	struct visslot_s	*next;
+	byte				*row;
+} visslot_t;
+
+static void			*vis_alloc;
+static byte			*vis_rows;		// aligned row storage, full matrix or lru slots
+static int			vis_rowsize;	// row stride, padded to VISCACHE_ALIGN
+static qboolean		vis_full;
+
+static visslot_t	*vis_slots;
+static visslot_t	**vis_hash;
+static int			vis_numslots;
+static int			vis_hashmask;
+static visslot_t	vis_lru;		// sentinel, next is most recently used
+static volatile int	vis_lock;
+
+//r1: cluster masks of nodes that entities use as headnodes, built on first
+//use so CM_HeadnodeVisible is a single row intersection instead of a walk.
+#define	MAX_NODEMASKS	256
+
+static volatile int	*node_maskindex;	// per node, -1 if not built yet
+static uint32		*node_masks;
+static int			node_maskwords;
+static int			node_nummasks;
+
+static void CM_FreeVisCache (void)
+{
+	if (vis_alloc)
+	{
+		Z_Free (vis_alloc);
+		vis_alloc = NULL;
+	}
+
+	if (vis_slots)
+	{
+		Z_Free (vis_slots);
+		vis_slots = NULL;
+	}
+
+	if (vis_hash)
+	{
+		Z_Free (vis_hash);
+		vis_hash = NULL;
+	}
+
+	if (node_maskindex)
+	{
+		Z_Free ((void *)node_maskindex);
+		node_maskindex = NULL;
+	}
+
+	if (node_masks)
+	{
+		Z_Free (node_masks);
+		node_masks = NULL;
+	}
+
+	vis_rows = NULL;
+	vis_full = false;
+	vis_numslots = 0;
+	node_nummasks = 0;
+}
+
+static void CM_BuildVisCache (void)
+{
+	int		i;
+	int		budget;
+	int		rows;
+
+	CM_FreeVisCache ();
+
+	budget = cm_viscache->intvalue;
+	if (budget <= 0 || numclusters <= 0)
+		return;
+
+	vis_rowsize = (((numclusters+7)>>3) + VISCACHE_ALIGN - 1) & ~(VISCACHE_ALIGN - 1);
+	rows = numclusters * 2;
+
+	if ((int64)rows * vis_rowsize <= (int64)budget * 1024)
+	{
+		vis_full = true;
+	}
 	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PVS], pvsrow);
-	return pvsrow;
+	{
+		rows = (int)(((int64)budget * 1024) / vis_rowsize);
+		if (rows < 16)
+			rows = 16;
+	}
+
+	vis_alloc = Z_TagMalloc (rows * vis_rowsize + VISCACHE_ALIGN, TAGMALLOC_VISCACHE);
+	vis_rows = (byte *)(((uintptr_t)vis_alloc + VISCACHE_ALIGN - 1) & ~(uintptr_t)(VISCACHE_ALIGN - 1));
+	memset (vis_rows, 0, rows * vis_rowsize);
+
+	if (vis_full)
+	{
+		for (i = 0; i < numclusters; i++)
+		{
+			CM_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PVS], vis_rows + (i*2 + DVIS_PVS) * vis_rowsize);
+			CM_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PHS], vis_rows + (i*2 + DVIS_PHS) * vis_rowsize);
+		}
+		Com_DPrintf ("CM_BuildVisCache: expanded %d clusters (%d KB)\n", numclusters, (rows * vis_rowsize) / 1024);
+		return;
+	}
+
+	vis_numslots = rows;
+	for (vis_hashmask = 1; vis_hashmask < rows; vis_hashmask <<= 1)
+		;
+
+	vis_hash = Z_TagMalloc (vis_hashmask * sizeof(visslot_t *), TAGMALLOC_VISCACHE);
+	memset (vis_hash, 0, vis_hashmask * sizeof(visslot_t *));
+	vis_hashmask--;
+
+	vis_slots = Z_TagMalloc (rows * sizeof(visslot_t), TAGMALLOC_VISCACHE);
+
+	vis_lru.next = vis_lru.prev = &vis_lru;
+	for (i = 0; i < rows; i++)
+	{
+		vis_slots[i].key = -1;
+		vis_slots[i].hashnext = NULL;
+		vis_slots[i].row = vis_rows + i * vis_rowsize;
+		vis_slots[i].next = vis_lru.next;
+		vis_slots[i].prev = &vis_lru;
+		vis_lru.next->prev = &vis_slots[i];
+		vis_lru.next = &vis_slots[i];
+	}
+
+	Com_DPrintf ("CM_BuildVisCache: %d of %d rows cached\n", rows, numclusters * 2);
+}
+
+static void CM_InitNodeMasks (void)
+{
+	int		i;
+
+	if (numnodes <= 0)
+		return;
+
+	node_maskwords = (((numclusters+7)>>3) + 3) >> 2;
+
+	node_maskindex = Z_TagMalloc (numnodes * sizeof(int), TAGMALLOC_VISCACHE);
+	for (i = 0; i < numnodes; i++)
+		node_maskindex[i] = -1;
+
+	node_masks = Z_TagMalloc (MAX_NODEMASKS * node_maskwords * sizeof(uint32), TAGMALLOC_VISCACHE);
+	node_nummasks = 0;
+}
+
+static void CM_NodeClusterBits (int nodenum, byte *bits)
+{
+	int		cluster;
+
+	while (nodenum >= 0)
+	{
+		CM_NodeClusterBits (map_nodes[nodenum].children[0], bits);
+		nodenum = map_nodes[nodenum].children[1];
+	}
+
+	cluster = map_leafs[-1-nodenum].cluster;
+	if (cluster != -1)
+		bits[cluster>>3] |= 1<<(cluster&7);
 }
 
-byte	*CM_ClusterPHS (int cluster)
+static void CM_LockVis (void)
 {
+	while (!Sys_CompareAndSwap (&vis_lock, 0, 1))
+		;
+}
+
+static void CM_UnlockVis (void)
+{
+	Sys_MemoryBarrier ();
+	vis_lock = 0;
+}
+
+static visslot_t *CM_FindVisSlot (int key)
+{
+	visslot_t	*slot;
+
+	for (slot = vis_hash[key & vis_hashmask]; slot; slot = slot->hashnext)
+	{
+		if (slot->key == key)
+			return slot;
+	}
+
+	return NULL;
+}
+
+static void CM_TouchVisSlot (visslot_t *slot)
+{
+	slot->prev->next = slot->next;
+	slot->next->prev = slot->prev;
+
+	slot->next = vis_lru.next;
+	slot->prev = &vis_lru;
+	vis_lru.next->prev = slot;
+	vis_lru.next = slot;
+}
+
+static void CM_StoreVisSlot (int key, const byte *row)
+{
+	visslot_t	*slot;
+	visslot_t	**link;
+
+	if (CM_FindVisSlot (key))
+		return;
+
+	//recycle the least recently used slot
+	slot = vis_lru.prev;
+
+	if (slot->key != -1)
+	{
+		for (link = &vis_hash[slot->key & vis_hashmask]; *link; link = &(*link)->hashnext)
+		{
+			if (*link == slot)
+			{
+				*link = slot->hashnext;
+				break;
+			}
+		}
+	}
+
+	slot->key = key;
+	slot->hashnext = vis_hash[key & vis_hashmask];
+	vis_hash[key & vis_hashmask] = slot;
+
+	memcpy (slot->row, row, (numclusters+7)>>3);
+	CM_TouchVisSlot (slot);
+}
+
+/*
+===================
+CM_ClusterVis
+
+Returns the decompressed row for cluster, either directly from the
+expanded matrix or filled into buffer (which must hold MAX_MAP_LEAFS/8
+bytes). Safe to call from multiple threads.
+===================
+*/
+static const byte *CM_ClusterVis (int cluster, int type, byte *buffer)
+{
+	visslot_t	*slot;
+	int			key;
+
 	if (cluster == -1)
-		memset (phsrow, 0, (numclusters+7)>>3);
-	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PHS], phsrow);
-	return phsrow;
+	{
+		memset (buffer, 0, (numclusters+7)>>3);
+		return buffer;
+	}
+
+	if (vis_full)
+		return vis_rows + (cluster*2 + type) * vis_rowsize;
+
+	if (!vis_numslots)
+	{
+		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][type], buffer);
+		return buffer;
+	}
+
+	key = (cluster << 1) | type;
+
+	CM_LockVis ();
+	slot = CM_FindVisSlot (key);
+	if (slot)
+	{
+		CM_TouchVisSlot (slot);
+		memcpy (buffer, slot->row, (numclusters+7)>>3);
+		CM_UnlockVis ();
+		return buffer;
+	}
+	CM_UnlockVis ();
+
+	//decompress outside the lock, another thread may race us to insert it
+	CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][type], buffer);
+
+	CM_LockVis ();
+	CM_StoreVisSlot (key, buffer);
+	CM_UnlockVis ();
+
+	return buffer;
+}
+
+const byte *CM_ClusterPVS (int cluster, byte *buffer)
+{
+	return CM_ClusterVis (cluster, DVIS_PVS, buffer);
+}
+
+const byte *CM_ClusterPHS (int cluster, byte *buffer)
+{
+	return CM_ClusterVis (cluster, DVIS_PHS, buffer);
 }
 
 
@@ -1973,6 +2291,31 @@ void	CM_ReadPortalState (FILE *f)
 	FloodAreaConnections ();
 }
 
+/*
+===================
+CM_SavePortalState
+
+r1: CM_WritePortalState for levels the server keeps in memory
+===================
+*/
+void	CM_SavePortalState (qboolean *state)
+{
+	memcpy (state, portalopen, sizeof(portalopen));
+}
+
+/*
+===================
+CM_LoadPortalState
+
+r1: CM_ReadPortalState for levels the server keeps in memory
+===================
+*/
+void	CM_LoadPortalState (const qboolean *state)
+{
+	memcpy (portalopen, state, sizeof(portalopen));
+	FloodAreaConnections ();
+}
+
 /*
 =============
 CM_HeadnodeVisible
@@ -1981,7 +2324,7 @@ Returns true if any leaf under headnode has a cluster that
 is potentially visible
 =============
 */
-qboolean CM_HeadnodeVisible (int nodenum, const byte *visbits)
+static qboolean CM_HeadnodeVisibleR (int nodenum, const byte *visbits)
 {
 	int		leafnum;
 	int		cluster;
@@ -1999,8 +2342,42 @@ qboolean CM_HeadnodeVisible (int nodenum, const byte *visbits)
 	}
 
 	node = &map_nodes[nodenum];
-	if (CM_HeadnodeVisible(node->children[0], visbits))
+	if (CM_HeadnodeVisibleR(node->children[0], visbits))
 		return true;
-	return CM_HeadnodeVisible(node->children[1], visbits);
+	return CM_HeadnodeVisibleR(node->children[1], visbits);
+}
+
+//visbits must be readable in whole uint32s, as the CM_ClusterPVS rows are
+qboolean CM_HeadnodeVisible (int nodenum, const byte *visbits)
+{
+	int		index;
+	uint32	*mask;
+
+	if (nodenum < 0 || nodenum >= numnodes || !node_maskindex)
+		return CM_HeadnodeVisibleR (nodenum, visbits);
+
+	index = node_maskindex[nodenum];
+	if (index == -1)
+	{
+		CM_LockVis ();
+		index = node_maskindex[nodenum];
+		if (index == -1 && node_nummasks < MAX_NODEMASKS)
+		{
+			index = node_nummasks;
+			mask = node_masks + index * node_maskwords;
+			memset (mask, 0, node_maskwords * sizeof(uint32));
+			CM_NodeClusterBits (nodenum, (byte *)mask);
+			Sys_MemoryBarrier ();
+			node_maskindex[nodenum] = index;
+			node_nummasks++;
+		}
+		CM_UnlockVis ();
+
+		//out of masks, this node stays on the slow path
+		if (index == -1)
+			return CM_HeadnodeVisibleR (nodenum, visbits);
+	}
+
+	return Bit_Intersects (node_masks + index * node_maskwords, (const uint32 *)visbits, node_maskwords);
 }
 
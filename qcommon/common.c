@@ -40,6 +40,7 @@ usercmd_t		null_usercmd;
 cvar_t			uninitialized_cvar;
 
 cvar_t			*z_debug;
+cvar_t			*z_arena;
 cvar_t			*z_buggygame;
 cvar_t			*z_allowcorruption;
 
@@ -67,6 +68,9 @@ static cvar_t	*logfile_timestamp;
 static cvar_t	*logfile_timestamp_format;
 static cvar_t	*logfile_name;
 static cvar_t	*logfile_filterlevel = &uninitialized_cvar;
+static cvar_t	*logfile_async = &uninitialized_cvar;
+static cvar_t	*logfile_async_flush = &uninitialized_cvar;
+static cvar_t	*logfile_binary = &uninitialized_cvar;
 static cvar_t	*con_filterlevel = &uninitialized_cvar;
 
 #ifndef DEDICATED_ONLY
@@ -102,6 +106,8 @@ unsigned int		time_after_ref;
 #ifndef NPROFILE
 static int msg_local_hits;
 static int msg_malloc_hits;
+static int msg_shared_hits;
+static int msg_payload_heap;
 
 static int messageSizes[1500];
 #endif
@@ -171,6 +177,9 @@ tagmalloc_tag_t tagmalloc_tags[] =
 	{TAGMALLOC_CMDBANS, "CMDBANS", 0},
 	{TAGMALLOC_REDBLACK, "REDBLACK", 0},
 	{TAGMALLOC_LRCON, "LRCON", 0},
+	{TAGMALLOC_CLUSTERINDEX, "CLUSTERINDEX", 0},
+	{TAGMALLOC_DLCACHE, "DLCACHE", 0},
+	{TAGMALLOC_VISCACHE, "VISCACHE", 0},
 #ifdef ANTICHEAT
 	{TAGMALLOC_ANTICHEAT, "ANTICHEAT", 0},
 #endif
@@ -220,6 +229,401 @@ void Com_EndRedirect (qboolean flush)
 	rd_flush = NULL;
 }
 
+/*
+=============
+Com_LogWrite
+
+Writes one print to the logfile, inserting timestamps at the start of lines.
+msg is modified. Returns false on a write error, the caller closes the file.
+=============
+*/
+//r1: the cvars Com_LogWrite depends on, the async writer keeps its own copy
+//so a cvar change on the main thread can't free a string out from under it.
+typedef struct
+{
+	int		binary;
+	int		timestamp;
+	char	timestamp_format[64];
+	int		flush_msec;
+} logformat_t;
+
+static void Com_GetLogFormat (logformat_t *format)
+{
+	format->binary = logfile_binary->intvalue;
+	format->timestamp = logfile_timestamp->intvalue;
+	Q_strncpy (format->timestamp_format, logfile_timestamp_format->string, sizeof(format->timestamp_format)-1);
+	format->flush_msec = logfile_async_flush->intvalue;
+}
+
+static qboolean Com_LogWrite (char *msg, int level, time_t tm, const logformat_t *format)
+{
+	char		timestamp[64];
+	char		*line;
+	char		*msgptr;
+
+	static qboolean	insert_timestamp = true;
+
+	//r1: structured records, level / unix time / length then the text
+	if (format->binary)
+	{
+		uint32	header[3];
+
+		header[0] = LittleLong (level);
+		header[1] = LittleLong ((uint32)tm);
+		header[2] = LittleLong ((int)strlen (msg));
+
+		if (fwrite (header, sizeof(header), 1, logfile) != 1)
+			return false;
+
+		if (header[2] && fwrite (msg, LittleLong (header[2]), 1, logfile) != 1)
+			return false;
+
+		return true;
+	}
+
+	if (!format->timestamp)
+		return fwrite (msg, strlen(msg), 1, logfile) == 1 || !msg[0];
+
+	strftime (timestamp, sizeof(timestamp)-1, format->timestamp_format, localtime(&tm));
+
+	msgptr = msg;
+	line = strchr (msgptr, '\n');
+	while (line)
+	{
+		if (insert_timestamp)
+		{
+			fprintf (logfile, "%s ", timestamp);
+			insert_timestamp = false;
+		}
+		*line = 0;
+
+		if (fprintf (logfile, "%s\n", msgptr) < 0)
+			return false;
+			
+		insert_timestamp = true;
+		line++;
+		msgptr = line;
+
+		if (!*line)
+			break;
+
+		line = strchr (msgptr, '\n');
+	}
+
+	if (insert_timestamp)
+	{
+		fprintf (logfile, "%s ", timestamp);
+		insert_timestamp = false;
+	}
+
+	fprintf (logfile, "%s", msgptr);
+
+	return true;
+}
+
+/*
+=============
+Async logfile
+
+r1: with logfile_async set, Com_Printf only copies the print into a lock-free
+ring and a writer thread does the formatting and disk I/O, so a stalled disk
+can't stall the frame. any thread may queue, space is claimed with a CAS on
+the reserve position. a record's size is written last which is what tells
+the writer it is complete, the writer zeroes records after use so stale
+data never looks complete. if the ring is full the print is dropped and
+counted rather than waiting. an idle writer sleeps on logwriter_signal and
+is only signalled by Com_LogQueue while logwriter_sleeping is set.
+=============
+*/
+typedef struct
+{
+	volatile int	size;		// whole record, 0 until complete
+	int				level;
+	uint32			time;
+	int				length;		// of the text following the header
+} logrecord_t;
+
+#define	LOGRING_ALIGN		sizeof(logrecord_t)
+
+static byte			*logring;
+static int			logring_size;		// power of two
+static volatile int	logring_reserve;
+static volatile int	logring_read;
+
+static void			*logwriter;
+static void			*logwriter_signal;
+static volatile int	logwriter_sleeping;
+static volatile int	logwriter_quit;
+static volatile int	logwriter_failed;
+static logformat_t	logwriter_format;
+
+static volatile int	log_queued;
+static volatile int	log_written;
+static volatile int	log_dropped;
+static volatile int	log_dropped_bytes;
+static volatile int	log_flushes;
+static volatile int	log_peak;
+
+static void Com_AtomicAdd (volatile int *value, int add)
+{
+	int		old;
+
+	do
+	{
+		old = *value;
+	} while (!Sys_CompareAndSwap (value, old, old + add));
+}
+
+static void Com_LogRingCopy (byte *dest, int pos, int len)
+{
+	int		start, first;
+
+	start = pos & (logring_size - 1);
+	first = logring_size - start;
+
+	if (len <= first)
+	{
+		memcpy (dest, logring + start, len);
+	}
+	else
+	{
+		memcpy (dest, logring + start, first);
+		memcpy (dest + first, logring, len - first);
+	}
+}
+
+static qboolean Com_LogQueue (const char *msg, int level, time_t tm)
+{
+	logrecord_t	*rec;
+	int			len, total, pos, used, start, first;
+
+	len = (int)strlen (msg);
+	total = (sizeof(logrecord_t) + len + LOGRING_ALIGN - 1) & ~(LOGRING_ALIGN - 1);
+
+	for (;;)
+	{
+		pos = logring_reserve;
+		used = pos - logring_read;
+
+		if (used + total > logring_size)
+		{
+			Com_AtomicAdd (&log_dropped, 1);
+			Com_AtomicAdd (&log_dropped_bytes, len);
+			return false;
+		}
+
+		if (Sys_CompareAndSwap (&logring_reserve, pos, pos + total))
+			break;
+	}
+
+	if (used + total > log_peak)
+		log_peak = used + total;
+
+	//headers are aligned so they never wrap, the text may
+	rec = (logrecord_t *)(logring + (pos & (logring_size - 1)));
+	rec->level = level;
+	rec->time = (uint32)tm;
+	rec->length = len;
+
+	start = (pos + sizeof(logrecord_t)) & (logring_size - 1);
+	first = logring_size - start;
+
+	if (len <= first)
+	{
+		memcpy (logring + start, msg, len);
+	}
+	else
+	{
+		memcpy (logring + start, msg, first);
+		memcpy (logring, msg + first, len - first);
+	}
+
+	Sys_MemoryBarrier ();
+	rec->size = total;
+
+	Com_AtomicAdd (&log_queued, 1);
+
+	//pairs with the barrier in Com_LogWriter between setting sleeping and rechecking the ring
+	Sys_MemoryBarrier ();
+	if (logwriter_sleeping)
+		Sys_SetSignal (logwriter_signal);
+
+	return true;
+}
+
+static void Com_LogWriter (void *arg)
+{
+	char			msg[MAXPRINTMSG];
+	logrecord_t		*rec;
+	int				pos, total, start, first, dropped;
+	qboolean		dirty;
+
+	dirty = false;
+	dropped = 0;
+
+	for (;;)
+	{
+		pos = logring_read;
+		rec = (logrecord_t *)(logring + (pos & (logring_size - 1)));
+
+		if (!rec->size)
+		{
+			if (logwriter_quit)
+				break;
+
+			if (!logwriter_failed && logfile)
+			{
+				//let the log know there is a gap
+				total = log_dropped;
+				if (total != dropped)
+				{
+					Com_sprintf (msg, sizeof(msg), "*** %d log messages dropped, logfile_async queue full ***\n", total - dropped);
+					dropped = total;
+					if (!Com_LogWrite (msg, LOG_GENERAL|LOG_WARNING, time(NULL), &logwriter_format))
+						logwriter_failed = true;
+					dirty = true;
+				}
+			}
+
+			//sleep until something is queued, if there is unflushed output
+			//only for as long as the queue must stay empty before flushing.
+			logwriter_sleeping = true;
+			Sys_MemoryBarrier ();
+
+			if (!rec->size && !logwriter_quit)
+			{
+				if (!Sys_WaitSignal (logwriter_signal, dirty ? logwriter_format.flush_msec : -1) && dirty)
+				{
+					if (!logwriter_failed && logfile)
+					{
+						if (fflush (logfile))
+							logwriter_failed = true;
+						log_flushes++;
+					}
+					dirty = false;
+				}
+			}
+
+			logwriter_sleeping = false;
+			continue;
+		}
+
+		Sys_MemoryBarrier ();
+
+		total = rec->size;
+
+		Com_LogRingCopy ((byte *)msg, pos + sizeof(logrecord_t), rec->length);
+		msg[rec->length] = 0;
+
+		//after a write error everything is thrown away until the main thread notices
+		if (!logwriter_failed && logfile)
+		{
+			if (!Com_LogWrite (msg, rec->level, rec->time, &logwriter_format))
+				logwriter_failed = true;
+			dirty = true;
+			log_written++;
+		}
+
+		//clear it so no future header sees stale data
+		start = pos & (logring_size - 1);
+		first = logring_size - start;
+
+		if (total <= first)
+		{
+			memset (logring + start, 0, total);
+		}
+		else
+		{
+			memset (logring + start, 0, first);
+			memset (logring, 0, total - first);
+		}
+
+		Sys_MemoryBarrier ();
+		logring_read = pos + total;
+	}
+
+	if (dirty && logfile)
+		fflush (logfile);
+}
+
+static void Com_StartLogWriter (void)
+{
+	int		size;
+
+	//kb, rounded down to a power of two that can hold a max size print
+	size = 1;
+	while (size * 2 <= logfile_async->intvalue * 1024)
+		size *= 2;
+
+	if (size < MAXPRINTMSG * 4)
+		size = MAXPRINTMSG * 4;
+
+	logring = calloc (1, size);
+	if (!logring)
+	{
+		Cvar_ForceSet ("logfile_async", "0");
+		Com_Printf ("WARNING: Couldn't allocate %d bytes for logfile_async, using synchronous logging.\n", LOG_GENERAL|LOG_WARNING, size);
+		return;
+	}
+
+	logwriter_signal = Sys_CreateSignal ();
+	if (!logwriter_signal)
+	{
+		free (logring);
+		logring = NULL;
+		Cvar_ForceSet ("logfile_async", "0");
+		Com_Printf ("WARNING: Couldn't start the logfile_async writer, using synchronous logging.\n", LOG_GENERAL|LOG_WARNING);
+		return;
+	}
+
+	logring_size = size;
+	logring_reserve = logring_read = 0;
+	logwriter_sleeping = false;
+	logwriter_quit = false;
+	logwriter_failed = false;
+	Com_GetLogFormat (&logwriter_format);
+
+	logwriter = Sys_StartThread (Com_LogWriter, NULL);
+	if (!logwriter)
+	{
+		Sys_DestroySignal (logwriter_signal);
+		logwriter_signal = NULL;
+		free (logring);
+		logring = NULL;
+		Cvar_ForceSet ("logfile_async", "0");
+		Com_Printf ("WARNING: Couldn't start the logfile_async writer, using synchronous logging.\n", LOG_GENERAL|LOG_WARNING);
+	}
+}
+
+//writes out everything queued and stops the writer, must be called before closing the logfile
+static void Com_StopLogWriter (void)
+{
+	if (!logwriter)
+		return;
+
+	logwriter_quit = true;
+	Sys_SetSignal (logwriter_signal);
+	Sys_JoinThread (logwriter);
+	logwriter = NULL;
+
+	Sys_DestroySignal (logwriter_signal);
+	logwriter_signal = NULL;
+
+	free (logring);
+	logring = NULL;
+
+	//the error has been dealt with by whoever stopped us, a later logfile starts clean
+	logwriter_failed = false;
+}
+
+static void Com_LogStats_f (void)
+{
+	Com_Printf ("logfile_async: %s, queue %d KB (peak %d KB)\n"
+				"queued %d, written %d, dropped %d (%d bytes), flushes %d\n", LOG_GENERAL,
+				logwriter ? "running" : "off", logring_size / 1024, log_peak / 1024,
+				log_queued, log_written, log_dropped, log_dropped_bytes, log_flushes);
+}
+
 /*
 =============
 Com_Printf
@@ -269,9 +673,10 @@ void Com_Printf (const char *fmt, int level, ...)
 	// logfile
 	if (logfile_active && logfile_active->intvalue && !(level & logfile_filterlevel->intvalue))
 	{
-		char	name[MAX_QPATH];
-		char	timestamp[64];
-		char	*p;
+		char		name[MAX_QPATH];
+		char		*p;
+		time_t		tm;
+		logformat_t	format;
 
 		//r1: strip highbits and control chars
 		p = msg;
@@ -283,6 +688,15 @@ void Com_Printf (const char *fmt, int level, ...)
 			p++;
 		}
 
+		//the writer thread hit an error, shut it down here
+		if (logwriter_failed)
+		{
+			Com_StopLogWriter ();
+			Cvar_ForceSet ("logfile", "0");
+			Com_Printf ("ALERT: Error writing to logfile %s, file closed.\n", LOG_GENERAL|LOG_WARNING, logfile_name->string);
+			return;
+		}
+
 		if (!logfile)
 		{
 			//ensure someone malicious with rcon can't overwrite arbitrary files...
@@ -307,61 +721,26 @@ void Com_Printf (const char *fmt, int level, ...)
 			}
 		}
 
-		if (logfile)
-		{
-			if (logfile_timestamp->intvalue)
-			{
-				char		*line;
-				char		*msgptr;
-
-				static qboolean	insert_timestamp = true;
-
-				time_t	tm;
-				time(&tm);
-				strftime (timestamp, sizeof(timestamp)-1, logfile_timestamp_format->string, localtime(&tm));
-
-				msgptr = msg;
-				line = strchr (msgptr, '\n');
-				while (line)
-				{
-					if (insert_timestamp)
-					{
-						fprintf (logfile, "%s ", timestamp);
-						insert_timestamp = false;
-					}
-					*line = 0;
-
-					if (fprintf (logfile, "%s\n", msgptr) < 0)
-					{
-						fclose (logfile);
-						logfile = NULL;
-						Cvar_ForceSet ("logfile", "0");
-						Com_Printf ("ALERT: Error writing to logfile %s, file closed.\n", LOG_GENERAL|LOG_WARNING, logfile_name->string);
-						return;
-					}
-						
-					insert_timestamp = true;
-					line++;
-					msgptr = line;
+		time (&tm);
 
-					if (!*line)
-						break;
+		if (logfile_async->intvalue && !logwriter)
+			Com_StartLogWriter ();
 
-					line = strchr (msgptr, '\n');
-				}
+		if (logwriter)
+		{
+			Com_LogQueue (msg, level, tm);
+			return;
+		}
 
-				if (insert_timestamp)
-				{
-					fprintf (logfile, "%s ", timestamp);
-					insert_timestamp = false;
-				}
+		Com_GetLogFormat (&format);
 
-				fprintf (logfile, "%s", msgptr);
-			}
-			else
-			{
-				fwrite (msg, strlen(msg), 1, logfile);
-			}
+		if (!Com_LogWrite (msg, level, tm, &format))
+		{
+			fclose (logfile);
+			logfile = NULL;
+			Cvar_ForceSet ("logfile", "0");
+			Com_Printf ("ALERT: Error writing to logfile %s, file closed.\n", LOG_GENERAL|LOG_WARNING, logfile_name->string);
+			return;
 		}
 
 		//r1: allow logging > 2 (append) but not forcing flushing.
@@ -484,6 +863,8 @@ void Com_Error (int code, const char *fmt, ...)
 		}
 	}
 
+	Com_StopLogWriter ();
+
 	if (logfile)
 	{
 		fprintf (logfile, "Fatal Error\n*****************************\n"
@@ -519,6 +900,8 @@ void Com_Quit (void)
 	CL_Shutdown ();
 #endif
 
+	Com_StopLogWriter ();
+
 	if (logfile)
 	{
 		fclose (logfile);
@@ -568,8 +951,16 @@ vec3_t	bytedirs[NUMVERTEXNORMALS] =
 // writing functions
 //
 
-byte		message_buff[0x10000];
-sizebuf_t	msgbuff;
+//r1: per-thread so server worker threads can encode frames in parallel. any thread
+//other than the main one must call MSG_InitBuffer before writing.
+static THREADLOCAL byte			message_buff[0x10000];
+static THREADLOCAL sizebuf_t	msgbuff;
+
+void MSG_InitBuffer (void)
+{
+	if (!msgbuff.data)
+		SZ_Init (&msgbuff, message_buff, sizeof(message_buff));
+}
 
 void MSG_WriteChar (int c)
 {
@@ -784,7 +1175,105 @@ void MSG_EndWriting (sizebuf_t *out)
 #endif
 }
 
-void MSG_EndWrite (messagelist_t *out)
+/*
+==============
+Message payloads
+
+r1: blocks come from per size class freelists rather than going back to the
+heap after every message. a payload starts with one reference owned by the
+creator, each queued client message using it holds another.
+==============
+*/
+#define	PAYLOAD_MIN_SHIFT	7		//smallest class is 128 bytes
+#define	PAYLOAD_CLASSES		10		//largest is 64k, same as msgbuff
+#define	PAYLOAD_MAX_FREE	256		//per class, any more go back to the heap
+
+static msgpayload_t	*payload_free[PAYLOAD_CLASSES];
+static int			payload_numfree[PAYLOAD_CLASSES];
+
+static msgpayload_t *MSG_AllocPayload (int size)
+{
+	msgpayload_t	*payload;
+	int				sizeclass;
+
+	for (sizeclass = 0; (1 << (sizeclass + PAYLOAD_MIN_SHIFT)) < size; sizeclass++)
+		;
+
+	if (sizeclass >= PAYLOAD_CLASSES)
+		Com_Error (ERR_FATAL, "MSG_AllocPayload: %d bytes is too big", size);
+
+	payload = payload_free[sizeclass];
+
+	if (payload)
+	{
+		payload_free[sizeclass] = payload->next;
+		payload_numfree[sizeclass]--;
+	}
+	else
+	{
+		payload = malloc (sizeof(*payload) + (1 << (sizeclass + PAYLOAD_MIN_SHIFT)));
+		if (!payload)
+			Com_Error (ERR_FATAL, "MSG_AllocPayload: out of memory for %d bytes", size);
+#ifndef NPROFILE
+		msg_payload_heap++;
+#endif
+	}
+
+	payload->sizeclass = sizeclass;
+	payload->refcount = 1;
+	payload->cursize = size;
+
+	return payload;
+}
+
+void MSG_ReleasePayload (msgpayload_t *payload)
+{
+	Q_assert (payload->refcount > 0);
+
+	if (--payload->refcount)
+		return;
+
+	if (payload_numfree[payload->sizeclass] >= PAYLOAD_MAX_FREE)
+	{
+		free (payload);
+		return;
+	}
+
+	payload->next = payload_free[payload->sizeclass];
+	payload_free[payload->sizeclass] = payload;
+	payload_numfree[payload->sizeclass]++;
+}
+
+//copy of the current message that can be handed to any number of MSG_EndWriteShared
+msgpayload_t *MSG_CreatePayload (void)
+{
+	msgpayload_t	*payload;
+
+	Q_assert (msgbuff.cursize > 0);
+
+	payload = MSG_AllocPayload (msgbuff.cursize);
+	memcpy (payload->data, message_buff, msgbuff.cursize);
+
+	return payload;
+}
+
+//takes another reference to payload for a queued message, returns its length
+int MSG_EndWriteShared (msgpayload_t *payload)
+{
+#ifndef NPROFILE
+	msg_shared_hits++;
+	if (payload->cursize < sizeof(messageSizes) / sizeof(messageSizes[0]))
+		messageSizes[payload->cursize]++;
+#endif
+
+	payload->refcount++;
+
+	return payload->cursize;
+}
+
+//copies the current message to out (MSG_MAX_SIZE_BEFORE_MALLOC bytes) or, if
+//it is bigger than that, into a new payload. returns its length.
+int MSG_EndWrite (byte *out, msgpayload_t **payload)
 {
 	Q_assert (msgbuff.cursize > 0);
 
@@ -794,14 +1283,15 @@ void MSG_EndWrite (messagelist_t *out)
 #ifndef NPROFILE
 		msg_malloc_hits++;
 #endif
-		out->data = malloc (msgbuff.cursize);
+		*payload = MSG_CreatePayload ();
 	}
 	else
 	{
 #ifndef NPROFILE
 		msg_local_hits++;
 #endif
-		out->data = out->localbuff;
+		*payload = NULL;
+		memcpy (out, message_buff, msgbuff.cursize);
 	}
 
 #ifndef NPROFILE
@@ -809,8 +1299,7 @@ void MSG_EndWrite (messagelist_t *out)
 		messageSizes[msgbuff.cursize]++;
 #endif
 
-	memcpy (out->data, message_buff, msgbuff.cursize);
-	out->cursize = msgbuff.cursize;
+	return msgbuff.cursize;
 }
 
 void MSG_WriteCoord (float f)
@@ -1529,6 +2018,7 @@ typedef struct z_memloc_s
 	void				*address;
 	uint32				time;
 	uint32				size;
+	int					tag;
 	struct	z_memloc_s	*next;
 	void				*allocationLocation;
 } z_memloc_t;
@@ -1546,24 +2036,388 @@ static unsigned long	z_game_allocs = 0;
 
 qboolean	free_from_game = false;
 
+#define	TAG_GAME	765		// clear when unloading the dll
+#define	TAG_LEVEL	766		// clear when loading a new level
+
+RESTRICT void * EXPORT Z_TagMallocRelease (int size, int tag);
+
 /*
 ========================
-Z_Free
+Zone arenas
+
+r1: optional backend (z_arena) that keeps every tag in its own arena. blocks up
+to ARENA_MAX_SMALL bytes come from power of two size class freelists carved out
+of slabs, anything bigger is malloced and linked to the arena. Z_FreeTags then
+just hands the slabs back instead of freeing every block one at a time. blocks
+carry their own magic so they can be freed whatever backend is active.
 ========================
 */
-void EXPORT Z_FreeRelease (const void *ptr)
+#define	Z_MAGIC_ARENA		0x3d3d
+
+#define	ARENA_MIN_SHIFT		6			//smallest class, including zhead_t
+#define	ARENA_CLASSES		8			//so 64 .. 8192 bytes
+#define	ARENA_MAX_SMALL		(1 << (ARENA_MIN_SHIFT + ARENA_CLASSES - 1))
+#define	ARENA_MIN_SLAB		0x1000
+#define	ARENA_MAX_SLAB		0x40000
+#define	ARENA_MAX_TAGS		64
+
+typedef struct zslab_s
 {
-	zhead_t	*z;
+	struct zslab_s	*next;
+	int				size;
+	int				used;
+} zslab_t;
 
-	z = ((zhead_t *)ptr) - 1;
+typedef struct zarena_s
+{
+	int			tag;
+	qboolean	inuse;
 
-	if (z->magic != Z_MAGIC && z->magic != Z_MAGIC_DEBUG)
-		Com_Error (ERR_DIE, "Z_Free: bad magic");
+	zslab_t		*slabs;
+	int			numslabs;
+	int			nextslabsize;
+	zhead_t		*freelist[ARENA_CLASSES];
+	zhead_t		large;
 
-	z->prev->next = z->next;
-	z->next->prev = z->prev;
+	long		reserved;		//slab + large block bytes taken from the heap
+	long		live;			//bytes in live blocks after size class rounding
+	long		requested;		//bytes in live blocks as asked for
+	long		freelisted;		//bytes sitting in size class freelists
+	int			blocks;
+} zarena_t;
 
-	z_count--;
+static zarena_t	z_arenas[ARENA_MAX_TAGS];
+
+static zarena_t *Z_ArenaForTag (int tag, qboolean create)
+{
+	zarena_t	*arena;
+	int			i, start;
+
+	start = i = (uint32)tag % ARENA_MAX_TAGS;
+
+	do
+	{
+		arena = z_arenas + i;
+
+		if (!arena->inuse)
+		{
+			if (!create)
+				return NULL;
+
+			memset (arena, 0, sizeof(*arena));
+			arena->inuse = true;
+			arena->tag = tag;
+			arena->nextslabsize = ARENA_MIN_SLAB;
+			arena->large.next = arena->large.prev = &arena->large;
+			return arena;
+		}
+
+		if (arena->tag == tag)
+			return arena;
+
+		i = (i + 1) % ARENA_MAX_TAGS;
+	} while (i != start);
+
+	return NULL;
+}
+
+static int Z_ArenaClass (int size)
+{
+	int		sizeclass;
+
+	for (sizeclass = 0; (1 << (sizeclass + ARENA_MIN_SHIFT)) < size; sizeclass++)
+		;
+
+	return sizeclass;
+}
+
+static void Z_FreeArenaBlock (zhead_t *z)
+{
+	zarena_t	*arena;
+	int			sizeclass;
+
+	arena = Z_ArenaForTag (z->tag, false);
+	if (!arena)
+		Com_Error (ERR_DIE, "Z_Free: arena block %p has no arena for tag %d", (void *)(z+1), z->tag);
+
+	z_count--;
+	z_bytes -= z->size;
+
+	arena->blocks--;
+	arena->requested -= z->size;
+
+	if (z->size > ARENA_MAX_SMALL)
+	{
+		z->prev->next = z->next;
+		z->next->prev = z->prev;
+
+		arena->live -= z->size;
+		arena->reserved -= z->size;
+		free (z);
+		return;
+	}
+
+	sizeclass = Z_ArenaClass (z->size);
+
+	arena->live -= 1 << (sizeclass + ARENA_MIN_SHIFT);
+	arena->freelisted += 1 << (sizeclass + ARENA_MIN_SHIFT);
+
+	z->magic = 0;
+	z->next = arena->freelist[sizeclass];
+	arena->freelist[sizeclass] = z;
+}
+
+//drops everything in the arena for tag, returns false if there isn't one
+static qboolean Z_FreeArena (int tag)
+{
+	zarena_t	*arena;
+	zslab_t		*slab, *nextslab;
+	zhead_t		*z, *next;
+
+	arena = Z_ArenaForTag (tag, false);
+	if (!arena)
+		return false;
+
+	for (slab = arena->slabs; slab; slab = nextslab)
+	{
+		nextslab = slab->next;
+		free (slab);
+	}
+
+	for (z = arena->large.next; z != &arena->large; z = next)
+	{
+		next = z->next;
+		free (z);
+	}
+
+	z_count -= arena->blocks;
+	z_bytes -= arena->requested;
+
+	//keep the slot (and its probe chain) but forget the memory
+	arena->slabs = NULL;
+	arena->numslabs = 0;
+	arena->nextslabsize = ARENA_MIN_SLAB;
+	memset (arena->freelist, 0, sizeof(arena->freelist));
+	arena->large.next = arena->large.prev = &arena->large;
+	arena->reserved = arena->live = arena->requested = arena->freelisted = 0;
+	arena->blocks = 0;
+
+	return true;
+}
+
+static zhead_t *Z_ArenaAlloc (zarena_t *arena, int size)
+{
+	zhead_t	*z;
+	zslab_t	*slab;
+	int		sizeclass, classsize;
+
+	if (size > ARENA_MAX_SMALL)
+	{
+		z = malloc (size);
+		if (!z)
+			return NULL;
+
+		z->next = arena->large.next;
+		z->prev = &arena->large;
+		arena->large.next->prev = z;
+		arena->large.next = z;
+
+		arena->reserved += size;
+		arena->live += size;
+		return z;
+	}
+
+	sizeclass = Z_ArenaClass (size);
+	classsize = 1 << (sizeclass + ARENA_MIN_SHIFT);
+
+	z = arena->freelist[sizeclass];
+
+	if (z)
+	{
+		arena->freelist[sizeclass] = z->next;
+		arena->freelisted -= classsize;
+	}
+	else
+	{
+		slab = arena->slabs;
+
+		if (!slab || slab->used + classsize > slab->size)
+		{
+			while (arena->nextslabsize < classsize)
+				arena->nextslabsize *= 2;
+
+			slab = malloc (sizeof(zslab_t) + arena->nextslabsize);
+			if (!slab)
+				return NULL;
+
+			slab->size = arena->nextslabsize;
+			slab->used = 0;
+			slab->next = arena->slabs;
+			arena->slabs = slab;
+			arena->numslabs++;
+			arena->reserved += slab->size;
+
+			if (arena->nextslabsize < ARENA_MAX_SLAB)
+				arena->nextslabsize *= 2;
+		}
+
+		z = (zhead_t *)((byte *)(slab + 1) + slab->used);
+		slab->used += classsize;
+	}
+
+	z->next = z->prev = NULL;
+	arena->live += classsize;
+	return z;
+}
+
+RESTRICT void * EXPORT Z_TagMallocArena (int size, int tag)
+{
+	zarena_t	*arena;
+	zhead_t		*z;
+
+	if (size < 0)
+		Com_Error (ERR_DIE, "Z_TagMalloc: Illegal allocation size of %d bytes from %p for tag %d", size,
+#if defined _WIN32
+		_ReturnAddress (),
+#elif defined LINUX
+		__builtin_return_address (0), 
+#else
+		NULL,
+#endif
+		tag);
+
+	//out of arena slots, fall back to the plain heap
+	arena = Z_ArenaForTag (tag, true);
+	if (!arena)
+		return Z_TagMallocRelease (size, tag);
+
+	size = size + sizeof(zhead_t);
+	z = Z_ArenaAlloc (arena, size);
+
+	if (!z)
+		Com_Error (ERR_DIE, "Z_TagMalloc: Out of memory. Couldn't allocate %i bytes for tag %d from %p (already %li bytes in %li blocks)", size, tag,
+#if defined _WIN32
+		_ReturnAddress (),
+#elif defined LINUX
+		__builtin_return_address (0), 
+#else
+		NULL,
+#endif		
+		z_bytes, z_count);
+
+	z_count++;
+
+	if ((uint32)tag < TAGMALLOC_MAX_TAGS)
+		tagmalloc_tags[tag].allocs++;
+
+	z_bytes += size;
+
+	arena->blocks++;
+	arena->requested += size;
+
+#if defined _WIN32
+	z->allocationLocation = _ReturnAddress ();
+#elif defined LINUX
+	z->allocationLocation = __builtin_return_address (0);
+#else
+	//FIXME: other OSes/CCs
+	z->allocationLocation = 0;
+#endif
+
+	z->magic = Z_MAGIC_ARENA;
+	z->tag = tag;
+	z->size = size;
+
+	return (void *)(z+1);
+}
+
+static const char *Z_TagName (int tag)
+{
+	if ((uint32)tag < TAGMALLOC_MAX_TAGS)
+		return tagmalloc_tags[tag].name;
+	else if (tag == TAG_GAME)
+		return "DLL_GAME";
+	else if (tag == TAG_LEVEL)
+		return "DLL_LEVEL";
+
+	return va("TAG_%d", tag);
+}
+
+static void Z_ArenaStats (void)
+{
+	zarena_t	*arena;
+	zslab_t		*slab;
+	int			i;
+	long		slack;
+	long		reserved, live, requested, freelisted, totalslack;
+
+	reserved = live = requested = freelisted = totalslack = 0;
+
+	Com_Printf ("\n%14.14s  %5s %9s %6s %6s %6s %6s\n", LOG_GENERAL, "ARENA", "slabs", "reserved", "util", "round", "free", "slack");
+
+	for (i = 0; i < ARENA_MAX_TAGS; i++)
+	{
+		arena = z_arenas + i;
+		if (!arena->inuse || !arena->reserved)
+			continue;
+
+		//unused space at the end of slabs that can't be reached by any class
+		slack = 0;
+		for (slab = arena->slabs; slab; slab = slab->next)
+			slack += slab->size - slab->used;
+
+		Com_Printf ("%14.14s: %5d %9ld %5.1f%% %5.1f%% %5.1f%% %5.1f%%\n", LOG_GENERAL, Z_TagName (arena->tag),
+			arena->numslabs, arena->reserved,
+			(float)arena->requested / (float)arena->reserved * 100.0f,
+			(float)(arena->live - arena->requested) / (float)arena->reserved * 100.0f,
+			(float)arena->freelisted / (float)arena->reserved * 100.0f,
+			(float)slack / (float)arena->reserved * 100.0f);
+
+		reserved += arena->reserved;
+		live += arena->live;
+		requested += arena->requested;
+		freelisted += arena->freelisted;
+		totalslack += slack;
+	}
+
+	if (!reserved)
+	{
+		Com_Printf ("no arenas in use\n", LOG_GENERAL);
+		return;
+	}
+
+	Com_Printf ("%ld bytes reserved, %.1f%% used, %.1f%% lost to size class rounding, %.1f%% fragmented in freelists, %.1f%% unused slab space\n", LOG_GENERAL,
+		reserved,
+		(float)requested / (float)reserved * 100.0f,
+		(float)(live - requested) / (float)reserved * 100.0f,
+		(float)freelisted / (float)reserved * 100.0f,
+		(float)totalslack / (float)reserved * 100.0f);
+}
+
+/*
+========================
+Z_Free
+========================
+*/
+void EXPORT Z_FreeRelease (const void *ptr)
+{
+	zhead_t	*z;
+
+	z = ((zhead_t *)ptr) - 1;
+
+	if (z->magic == Z_MAGIC_ARENA)
+	{
+		Z_FreeArenaBlock (z);
+		return;
+	}
+
+	if (z->magic != Z_MAGIC && z->magic != Z_MAGIC_DEBUG)
+		Com_Error (ERR_DIE, "Z_Free: bad magic");
+
+	z->prev->next = z->next;
+	z->next->prev = z->prev;
+
+	z_count--;
 	z_bytes -= z->size;
 	free (z);
 }
@@ -1577,6 +2431,12 @@ void EXPORT Z_FreeDebug (const void *ptr)
 
 	z = ((zhead_t *)ptr) - 1;
 
+	if (z->magic == Z_MAGIC_ARENA)
+	{
+		Z_FreeArenaBlock (z);
+		return;
+	}
+
 	Z_Verify ("Z_FreeDebug: START FREE FROM %s OF %p (%d bytes tagged %d (%s))", free_from_game ? "GAME" : "EXECUTABLE", ptr, z->size, z->tag, z->tag < TAGMALLOC_MAX_TAGS ? tagmalloc_tags[z->tag].name : "UNKNOWN TAG");
 
 	//magic test
@@ -1624,13 +2484,11 @@ Z_Stats_f
 ========================
 */
 
-#define	TAG_GAME	765		// clear when unloading the dll
-#define	TAG_LEVEL	766		// clear when loading a new level
-
 void Z_Stats_f (void)
 {
 	int i, total, num, bigtotal, bignum, level_count, level_size, game_count, game_size;
 	zhead_t	*z, *next;
+	zarena_t	*arena;
 
 	bigtotal = bignum = level_size = level_count = game_size = game_count = 0;
 
@@ -1654,11 +2512,33 @@ void Z_Stats_f (void)
 				}
 			}
 		}
+
+		arena = Z_ArenaForTag (i, false);
+		if (arena)
+		{
+			total += arena->requested;
+			num += arena->blocks;
+		}
+
 		bigtotal += total;
 		bignum += num;
 		Com_Printf ("%14.14s: %8i bytes %5i blocks %8i allocs\n", LOG_GENERAL, tagmalloc_tags[i].name, total, num, tagmalloc_tags[i].allocs);
 	}
 
+	arena = Z_ArenaForTag (TAG_LEVEL, false);
+	if (arena)
+	{
+		level_size += arena->requested;
+		level_count += arena->blocks;
+	}
+
+	arena = Z_ArenaForTag (TAG_GAME, false);
+	if (arena)
+	{
+		game_size += arena->requested;
+		game_count += arena->blocks;
+	}
+
 	bigtotal += game_size;
 	bigtotal += level_size;
 
@@ -1672,6 +2552,8 @@ void Z_Stats_f (void)
 
 	Com_Printf ("  CALCED_TOTAL: %i bytes in %i blocks\n", LOG_GENERAL, bigtotal, bignum);
 	Com_Printf (" RUNNING_TOTAL: %li bytes in %li blocks\n", LOG_GENERAL, z_bytes, z_count);
+
+	Z_ArenaStats ();
 }
 
 /*
@@ -1692,6 +2574,8 @@ void Z_FreeTags (int tag)
 			Z_Free ((void *)(z+1));
 	}
 
+	Z_FreeArena (tag);
+
 	Z_Verify ("Z_FreeTags: END");
 }
 
@@ -1923,6 +2807,7 @@ RESTRICT void * EXPORT Z_TagMallocGame (int size, int tag)
 
 	newentry->address = b;
 	newentry->size = size;
+	newentry->tag = tag;
 	newentry->next = last;
 	newentry->time = curtime;
 	newentry->allocationLocation = retAddr;
@@ -1982,8 +2867,6 @@ void EXPORT Z_FreeGame (void *buf)
 
 void EXPORT Z_FreeTagsGame (int tag)
 {
-	zhead_t	*z, *next;
-
 	z_memloc_t	*loc, *last;
 
 	loc = last = &z_game_locations;
@@ -1999,13 +2882,25 @@ void EXPORT Z_FreeTagsGame (int tag)
 		}
 	}
 
-	for (z=z_chain.next ; z != &z_chain ; z=next)
+	//r1: drop the tracking entries in one pass and free the blocks by tag rather
+	//than searching the whole location list again for every block.
+	last = &z_game_locations;
+	while (last->next)
 	{
-		next = z->next;
-		if (z->tag == tag)
-			Z_FreeGame ((void *)(z+1));
+		loc = last->next;
+		if (loc->tag == tag)
+		{
+			last->next = loc->next;
+			free (loc);
+		}
+		else
+			last = loc;
 	}
 
+	free_from_game = true;
+	Z_FreeTags (tag);
+	free_from_game = false;
+
 	Z_Verify (va("Z_FreeTags %d (GAME): END", tag));
 }
 
@@ -2203,11 +3098,17 @@ void Msg_Stats_f (void)
 	int		num;
 	int		sum;
 
-	total = msg_malloc_hits + msg_local_hits;
+	total = msg_malloc_hits + msg_local_hits + msg_shared_hits;
 
-	Com_Printf ("malloc: %d (%.2f%%), local: %d (%.2f%%)\n", LOG_GENERAL,
+	Com_Printf ("pooled: %d (%.2f%%), local: %d (%.2f%%), shared: %d (%.2f%%)\n", LOG_GENERAL,
 		msg_malloc_hits, ((float)msg_malloc_hits / (float)total) * 100.0f,
-		msg_local_hits, ((float)msg_local_hits / (float)total) * 100.0f);
+		msg_local_hits, ((float)msg_local_hits / (float)total) * 100.0f,
+		msg_shared_hits, ((float)msg_shared_hits / (float)total) * 100.0f);
+
+	Com_Printf ("payload pool: %d heap allocations, free blocks:", LOG_GENERAL, msg_payload_heap);
+	for (i = 0; i < PAYLOAD_CLASSES; i++)
+		Com_Printf (" %d", LOG_GENERAL, payload_numfree[i]);
+	Com_Printf ("\n", LOG_GENERAL);
 	
 	Com_Printf ("byte breakdown:\n", LOG_GENERAL);
 
@@ -2231,26 +3132,49 @@ void Msg_Stats_f (void)
 #endif
 }
 
-void _z_debug_changed (cvar_t *cvar, char *o, char *n)
+//r1: blocks can be freed by any backend so it's safe to switch at any time
+static void Z_SelectBackend (void)
 {
-	if (cvar->intvalue)
+	if (z_debug->intvalue)
 	{
 		Z_TagMalloc = Z_TagMallocDebug;
 		Z_Free = Z_FreeDebug;
 	}
+	else if (z_arena->intvalue)
+	{
+		Z_TagMalloc = Z_TagMallocArena;
+		Z_Free = Z_FreeRelease;
+	}
 	else
 	{
 		Z_TagMalloc = Z_TagMallocRelease;
 		Z_Free = Z_FreeRelease;
 	}
+}
 
+void _z_debug_changed (cvar_t *cvar, char *o, char *n)
+{
+	Z_SelectBackend ();
 	Com_Printf ("Z_Debug: Intensive memory checking %s.\n", LOG_GENERAL, cvar->intvalue ? "enabled" : "disabled");
 }
 
+//r1: the writer is restarted with the new queue size and format on the next print
+void _logfile_async_changed (cvar_t *cvar, char *o, char *n)
+{
+	Com_StopLogWriter ();
+}
+
+void _z_arena_changed (cvar_t *cvar, char *o, char *n)
+{
+	Z_SelectBackend ();
+}
+
 void _logfile_changed (cvar_t *cvar, char *o, char *n)
 {
 	if (cvar->intvalue == 0)
 	{
+		Com_StopLogWriter ();
+
 		if (logfile)
 		{
 			fclose (logfile);
@@ -2266,7 +3190,7 @@ void Qcommon_Init (int argc, char **argv)
 
 	seedMT((uint32)time(0));
 
-	SZ_Init (&msgbuff, message_buff, sizeof(message_buff));
+	MSG_InitBuffer ();
 
 	Z_Free = Z_FreeRelease;
 	Z_TagMalloc = Z_TagMallocRelease;
@@ -2291,12 +3215,12 @@ void Qcommon_Init (int argc, char **argv)
 
 	cl_quietstartup = Cvar_Get ("cl_quietstartup", "1", 0);
 
+	z_arena = Cvar_Get ("z_arena", "0", 0);
+	z_arena->help = "Allocate memory from per tag arenas so that freeing a whole tag (eg on map change) is cheap and heap fragmentation is reduced. Default 0.\n";
+
 	z_debug->changed = _z_debug_changed;
-	if (z_debug->intvalue)
-	{
-		Z_TagMalloc = Z_TagMallocDebug;
-		Z_Free = Z_FreeDebug;
-	}
+	z_arena->changed = _z_arena_changed;
+	Z_SelectBackend ();
 
 #ifndef DEDICATED_ONLY
 	Key_Init ();
@@ -2312,6 +3236,8 @@ void Qcommon_Init (int argc, char **argv)
 	Cmd_AddCommand ("processtimes", Sys_ProcessTimes_f);
 	Cmd_AddCommand ("spinstats", Sys_Spinstats_f);
 
+	Bit_Init ();
+
 	// we need to add the early commands twice, because
 	// a basedir or cddir needs to be set before execing
 	// config files, but we want other parms to override
@@ -2345,6 +3271,25 @@ void Qcommon_Init (int argc, char **argv)
 	logfile_filterlevel = Cvar_Get ("logfile_filterlevel", "0", 0);
 	logfile_active->changed = _logfile_changed;
 
+	//r1: async logging so disk stalls don't stall the server
+	logfile_async = Cvar_Get ("logfile_async", "0", 0);
+	logfile_async->changed = _logfile_async_changed;
+	logfile_async->help = "Size in KB of a queue that logfile output goes through so a separate thread does the disk writes, a slow disk then can't stall the server. Output is dropped (see logstats) if the queue fills up and the last few lines may be lost on a crash. 0 writes directly. Default 0.\n";
+
+	logfile_async_flush = Cvar_Get ("logfile_async_flush", "1000", 0);
+	logfile_async_flush->help = "Milliseconds the logfile_async queue must have been empty before the logfile is flushed to disk. 0 flushes whenever the queue is drained. Default 1000.\n";
+
+	logfile_binary = Cvar_Get ("logfile_binary", "0", 0);
+	logfile_binary->help = "Write the logfile as binary records instead of text. Each print becomes a little endian 32 bit LOG_* level, unix time and length, followed by the text. Default 0.\n";
+
+	//the writer works from a copy of these, restart it when they change
+	logfile_async_flush->changed = _logfile_async_changed;
+	logfile_binary->changed = _logfile_async_changed;
+	logfile_timestamp->changed = _logfile_async_changed;
+	logfile_timestamp_format->changed = _logfile_async_changed;
+
+	Cmd_AddCommand ("logstats", Com_LogStats_f);
+
 	con_filterlevel = Cvar_Get ("con_filterlevel", "0", 0);
 
 #ifndef DEDICATED_ONLY
@@ -2566,7 +3511,132 @@ void Qcommon_Frame (int msec)
 }
 
 #ifndef NO_ZLIB
-int ZLibDecompress (byte *in, int inlen, byte *out, int outlen, int wbits)
+//r1: preset dictionary for protocol 35 zpackets (MINOR_VERSION_R1Q2_ZDICT and
+//above). deflate prefers matches close to the data, so the most common strings
+//are at the end. changing this breaks the protocol, bump the minor version!
+static const char zlib_dictionary[] =
+	"sprites/s_bfg1.sp2sprites/s_bfg2.sp2sprites/s_bfg3.sp2models/objects/gibs/sm_meat/tris.md2"
+	"models/objects/gibs/skull/tris.md2models/objects/gibs/head2/tris.md2models/objects/rocket/tris.md2"
+	"models/objects/laser/tris.md2models/objects/grenade/tris.md2models/objects/debris1/tris.md2"
+	"models/items/armor/body/tris.md2models/items/armor/combat/tris.md2models/items/armor/jacket/tris.md2"
+	"models/items/armor/shard/tris.md2models/items/healing/medium/tris.md2models/items/healing/large/tris.md2"
+	"models/items/healing/stimpack/tris.md2models/items/mega_h/tris.md2models/items/quaddama/tris.md2"
+	"models/items/invulner/tris.md2models/items/ammo/bullets/medium/tris.md2models/items/ammo/shells/medium/tris.md2"
+	"models/items/ammo/rockets/medium/tris.md2models/items/ammo/cells/medium/tris.md2models/items/ammo/slugs/medium/tris.md2"
+	"models/items/ammo/grenades/medium/tris.md2models/weapons/g_shotg/tris.md2models/weapons/g_shotg2/tris.md2"
+	"models/weapons/g_machn/tris.md2models/weapons/g_chain/tris.md2models/weapons/g_launch/tris.md2"
+	"models/weapons/g_rocket/tris.md2models/weapons/g_hyperb/tris.md2models/weapons/g_rail/tris.md2"
+	"models/weapons/g_bfg/tris.md2models/weapons/v_blast/tris.md2models/weapons/v_shotg/tris.md2"
+	"models/weapons/v_shotg2/tris.md2models/weapons/v_machn/tris.md2models/weapons/v_chain/tris.md2"
+	"models/weapons/v_handgr/tris.md2models/weapons/v_launch/tris.md2models/weapons/v_rocket/tris.md2"
+	"models/weapons/v_hyperb/tris.md2models/weapons/v_rail/tris.md2models/weapons/v_bfg/tris.md2"
+	"items/pkup.wavitems/respawn1.wavitems/damage.wavitems/protect.wavmisc/w_pkup.wavmisc/ar1_pkup.wav"
+	"weapons/rocklx1a.wavweapons/grenlx1a.wavweapons/noammo.wavweapons/railgf1a.wavweapons/hyprbf1a.wav"
+	"player/male/jump1.wavplayer/male/pain100_1.wavplayer/male/death1.wav*jump1.wav*pain100_1.wav"
+	"*pain75_1.wav*pain50_1.wav*pain25_1.wav*death1.wav*death2.wav*death3.wav*death4.wav*fall1.wav"
+	"*fall2.wav*gurp1.wav*drown1.wavworld/land.wavplayer/watr_in.wavplayer/watr_out.wavplayers/male/tris.md2"
+	"\\male/grunt\\female/athena\\cyborg/oni911\\male/\\female/\\cyborg/#w_blaster.md2#w_shotgun.md2"
+	"#w_sshotgun.md2#w_machinegun.md2#w_chaingun.md2#a_grenades.md2#w_glauncher.md2#w_rlauncher.md2"
+	"#w_hyperblaster.md2#w_railgun.md2#w_bfg.md2i_healthi_powershieldw_blasterw_railguna_rocketsa_cells"
+	"i_fixme0123456789/tris.md2.pcx.wavmodels/players/";
+
+const byte *ZLibDictionary (void)
+{
+	return (const byte *)zlib_dictionary;
+}
+
+int ZLibDictionarySize (void)
+{
+	return sizeof(zlib_dictionary) - 1;
+}
+
+static THREADLOCAL z_stream	*deflate_stream;
+static THREADLOCAL int		deflate_level;
+
+/*
+===============
+ZLibDeflateStream
+
+r1: returns this thread's raw deflate stream, reset for a new chunk and primed
+with the preset dictionary if wanted. setting up a stream costs more than
+compressing a frame does, so it is only ever reset until the thread exits,
+see Com_ThreadExit.
+===============
+*/
+z_stream *ZLibDeflateStream (int level, qboolean dictionary)
+{
+	z_stream	*zs;
+
+	zs = deflate_stream;
+
+	if (!zs)
+	{
+		zs = calloc (1, sizeof(*zs));
+		if (!zs)
+			return NULL;
+
+		if (deflateInit2 (zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			free (zs);
+			return NULL;
+		}
+
+		deflate_stream = zs;
+		deflate_level = level;
+	}
+	else
+	{
+		if (deflateReset (zs) != Z_OK)
+			return NULL;
+
+		if (level != deflate_level)
+		{
+			if (deflateParams (zs, level, Z_DEFAULT_STRATEGY) != Z_OK)
+				return NULL;
+			deflate_level = level;
+		}
+	}
+
+	if (dictionary && deflateSetDictionary (zs, ZLibDictionary (), ZLibDictionarySize ()) != Z_OK)
+		return NULL;
+
+	zs->data_type = Z_BINARY;
+
+	return zs;
+}
+
+static void ZLibFreeDeflateStream (void)
+{
+	if (!deflate_stream)
+		return;
+
+	deflateEnd (deflate_stream);
+	free (deflate_stream);
+	deflate_stream = NULL;
+}
+
+//compresses in as one chunk on the current thread's stream, -1 on failure
+int ZLibCompressFrame (byte *in, int len_in, byte *out, int len_out, int level, qboolean dictionary)
+{
+	z_stream	*zs;
+
+	zs = ZLibDeflateStream (level, dictionary);
+	if (!zs)
+		return -1;
+
+	zs->next_in = in;
+	zs->avail_in = len_in;
+
+	zs->next_out = out;
+	zs->avail_out = len_out;
+
+	if (deflate (zs, Z_FINISH) != Z_STREAM_END)
+		return -1;
+
+	return zs->total_out;
+}
+
+int ZLibDecompress (byte *in, int inlen, byte *out, int outlen, int wbits, qboolean dictionary)
 {
 	z_stream zs;
 	int result;
@@ -2586,6 +3656,18 @@ int ZLibDecompress (byte *in, int inlen, byte *out, int outlen, int wbits)
 		return 0;
 	}
 
+	//raw streams take the dictionary up front
+	if (dictionary)
+	{
+		result = inflateSetDictionary (&zs, ZLibDictionary (), ZLibDictionarySize ());
+		if (result != Z_OK)
+		{
+			inflateEnd (&zs);
+			Com_Error (ERR_DROP, "ZLib data error! Error %d on inflateSetDictionary.\nMessage: %s", result, zs.msg);
+			return 0;
+		}
+	}
+
 	zs.avail_in = inlen;
 
 	result = inflate(&zs, Z_FINISH);
@@ -2644,6 +3726,21 @@ int ZLibCompressChunk(byte *in, int len_in, byte *out, int len_out, int method,
 }
 #endif
 
+/*
+===============
+Com_ThreadExit
+
+r1: worker threads come and go with sv_threads, anything they keep in
+THREADLOCAL storage has to be released here or it leaks with every change.
+===============
+*/
+void Com_ThreadExit (void)
+{
+#ifndef NO_ZLIB
+	ZLibFreeDeflateStream ();
+#endif
+}
+
 void StripHighBits (char *string, int highbits)
 {
 	byte		high;
@@ -24,6 +24,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/mman.h>
+#endif
 /*
 =============================================================================
 
@@ -77,6 +81,12 @@ typedef struct pack_s
 	//packfile_t		*files;
 	struct rbtree	*rb;
 	packtype_t		type;
+
+	//r1: read-only mapping of the whole pak, NULL if not mapped
+	byte			*mapped;
+	uint32			maplength;
+	int				views;			// outstanding FS_LoadFileView buffers
+	struct pack_s	*nextretired;	// freed paks still pinned by views
 } pack_t;
 
 char	fs_gamedir[MAX_OSPATH];
@@ -84,6 +94,7 @@ cvar_t	*fs_basedir;
 cvar_t	*fs_gamedirvar;
 cvar_t	*fs_cache;
 cvar_t	*fs_noextern;
+cvar_t	*fs_mmap;
 
 typedef struct filelink_s
 {
@@ -107,6 +118,12 @@ static searchpath_t	*fs_base_searchpaths;	// without gamedirs
 
 static const char *current_filename;
 
+//r1: pak (if any) and offset the last FS_FOpenFile result came from
+static pack_t		*fs_foundpack;
+static uint32		fs_foundpos;
+
+static pack_t		*fs_retiredpacks;
+
 /*
 
 All of Quake's data access is through a hierchal file system, but the contents of
@@ -328,6 +345,41 @@ void FS_FlushCache (void)
 	RB_Purge (rb);
 }
 
+/*
+================
+FS_MapStats
+================
+*/
+static void FS_MapStats (void)
+{
+	searchpath_t	*search;
+	pack_t			*pak;
+	int				mapped, views, retired;
+	uint64			mapbytes;
+
+	mapped = views = retired = 0;
+	mapbytes = 0;
+
+	for (search = fs_searchpaths ; search ; search = search->next)
+	{
+		pak = search->pack;
+		if (pak && pak->mapped)
+		{
+			mapped++;
+			mapbytes += pak->maplength;
+			views += pak->views;
+		}
+	}
+
+	for (pak = fs_retiredpacks ; pak ; pak = pak->nextretired)
+	{
+		retired++;
+		views += pak->views;
+	}
+
+	Com_Printf ("%d mapped paks (%.1f MB), %d open views, %d freed paks pinned by views.\n", LOG_GENERAL, mapped, (double)mapbytes / 1048576.0, views, retired);
+}
+
 static void FS_Stats_f (void)
 {
 #if BTREE_SEARCH || MAGIC_BTREE
@@ -373,6 +425,8 @@ static void FS_Stats_f (void)
 
 	Com_Printf ("%d entries in linked list hash cache.\n", LOG_GENERAL, i);
 #endif
+
+	FS_MapStats ();
 }
 
 #if BTREE_SEARCH
@@ -570,6 +624,8 @@ int EXPORT FS_FOpenFile (const char *filename, FILE **file, handlestyle_t openHa
 	char			netpath[MAX_OSPATH];
 	char			lowered[MAX_QPATH];
 
+	fs_foundpack = NULL;
+
 	// check for links firstal
 	if (!fs_noextern->intvalue)
 	{
@@ -647,6 +703,8 @@ int EXPORT FS_FOpenFile (const char *filename, FILE **file, handlestyle_t openHa
 			if (cache->fileseek && fseek (*file, cache->fileseek, SEEK_SET))
 				Com_Error (ERR_FATAL, "Couldn't seek to offset %u in %s (cached)", cache->fileseek, cache->filepath);
 		}
+		fs_foundpack = cache->pak;
+		fs_foundpos = cache->fileseek;
 		return cache->filelen;
 	}
 
@@ -725,50 +783,50 @@ int EXPORT FS_FOpenFile (const char *filename, FILE **file, handlestyle_t openHa
 			//r1: optimized btree search
 			pak = search->pack;
 
-			if (pak->type == PAK_QUAKE)
-			{
-				entry = rbfind (lowered, pak->rb);
+			entry = rbfind (lowered, pak->rb);
 
-				if (entry)
-				{
-					entry = *(packfile_t **)entry;
+			if (entry)
+			{
+				entry = *(packfile_t **)entry;
 
 	#ifdef _DEBUG
-					Com_DPrintf ("File '%s' found in %s, (%s)\n", filename, pak->filename, entry->name);
+				Com_DPrintf ("File '%s' found in %s, (%s)\n", filename, pak->filename, entry->name);
 	#endif
-					if (openHandle != HANDLE_NONE)
+				if (openHandle != HANDLE_NONE)
+				{
+					//*file = fopen (pak->filename, "rb");
+					if (openHandle == HANDLE_DUPE)
 					{
-						//*file = fopen (pak->filename, "rb");
-						if (openHandle == HANDLE_DUPE)
-						{
-							*file = fopen (pak->filename, "rb");
-							*closeHandle = true;	
-						}
-						else
-						{
-							*file = pak->h.handle;
-							*closeHandle = false;
-						}
-						//if (!*file)
-						//	Com_Error (ERR_FATAL, "Couldn't reopen pak file %s", pak->filename);	
-
-						if (fseek (*file, entry->filepos, SEEK_SET))
-							Com_Error (ERR_FATAL, "Couldn't seek to offset %u for %s in %s", entry->filepos, entry->name, pak->filename);
+						*file = fopen (pak->filename, "rb");
+						*closeHandle = true;	
 					}
-
-					if (fs_cache->intvalue & 1)
+					else
 					{
+						*file = pak->h.handle;
+						*closeHandle = false;
+					}
+					//if (!*file)
+					//	Com_Error (ERR_FATAL, "Couldn't reopen pak file %s", pak->filename);	
+
+					if (fseek (*file, entry->filepos, SEEK_SET))
+						Com_Error (ERR_FATAL, "Couldn't seek to offset %u for %s in %s", entry->filepos, entry->name, pak->filename);
+				}
+
+				if (fs_cache->intvalue & 1)
+				{
 	#if BTREE_SEARCH
-						FS_AddToCache (pak->filename, entry->filelen, entry->filepos, filename, pak);
+					FS_AddToCache (pak->filename, entry->filelen, entry->filepos, filename, pak);
 	#elif HASH_CACHE
-						FS_AddToCache (hash, pak->filename, entry->filelen, entry->filepos, cache, filename);
+					FS_AddToCache (hash, pak->filename, entry->filelen, entry->filepos, cache, filename);
 	#elif MAGIC_BTREE
-						FS_AddToCache (pak->filename, entry->filelen, entry->filepos, filename, hash);
+					FS_AddToCache (pak->filename, entry->filelen, entry->filepos, filename, hash);
 	#endif
-					}
-
-					return entry->filelen;
 				}
+
+				fs_foundpack = pak;
+				fs_foundpos = entry->filepos;
+
+				return entry->filelen;
 			}
 		}
 		else if (!fs_noextern->intvalue)
@@ -911,15 +969,38 @@ void EXPORT FS_Read (void *buffer, int len, FILE *f)
 	}
 }
 
+/*
+=================
+FS_MapIntact
+
+r1: a mapped pak that is truncated on disk raises SIGBUS when the missing pages
+are touched. check the file still covers the mapping before using it, if it
+doesn't fall back to buffered reads which fail with a normal read error.
+=================
+*/
+static qboolean FS_MapIntact (pack_t *pack)
+{
+#ifndef _WIN32
+	struct stat	st;
+
+	if (fstat (fileno (pack->h.handle), &st) || st.st_size < (off_t)pack->maplength)
+	{
+		Com_Printf ("WARNING: %s changed on disk, not using its mapping.\n", LOG_GENERAL|LOG_WARNING, pack->filename);
+		return false;
+	}
+#endif
+	return true;
+}
+
 /*
 ============
-FS_LoadFile
+FS_LoadFileInternal
 
 Filename are reletive to the quake search path
 a null buffer will just return the file length without loading
 ============
 */
-int EXPORT FS_LoadFile (const char *path, void /*@out@*/ /*@null@*/**buffer)
+static int FS_LoadFileInternal (const char *path, void /*@out@*/ /*@null@*/**buffer, qboolean allowView)
 {
 	FILE		*h;
 	byte		*buf;
@@ -945,12 +1026,32 @@ int EXPORT FS_LoadFile (const char *path, void /*@out@*/ /*@null@*/**buffer)
 
 	if (!len)
 	{
-		fclose (h);
+		if (closeHandle)
+			fclose (h);
 		Com_Printf ("WARNING: 0 byte file: %s\n", LOG_GENERAL|LOG_WARNING, path);
 		*buffer = CopyString ("", TAGMALLOC_FSLOADFILE);
 		return 0;
 	}
 
+	//r1: mapped pak, hand out the mapping itself or copy straight out of it
+	if (fs_foundpack && fs_foundpack->mapped && FS_MapIntact (fs_foundpack))
+	{
+		if (closeHandle)
+			fclose (h);
+
+		if (allowView)
+		{
+			fs_foundpack->views++;
+			*buffer = fs_foundpack->mapped + fs_foundpos;
+			return len;
+		}
+
+		buf = Z_TagMalloc(len, TAGMALLOC_FSLOADFILE);
+		*buffer = buf;
+		memcpy (buf, fs_foundpack->mapped + fs_foundpos, len);
+		return len;
+	}
+
 	buf = Z_TagMalloc(len, TAGMALLOC_FSLOADFILE);
 	*buffer = buf;
 	current_filename = path;
@@ -963,6 +1064,164 @@ int EXPORT FS_LoadFile (const char *path, void /*@out@*/ /*@null@*/**buffer)
 	return len;
 }
 
+int EXPORT FS_LoadFile (const char *path, void /*@out@*/ /*@null@*/**buffer)
+{
+	return FS_LoadFileInternal (path, buffer, false);
+}
+
+/*
+============
+FS_LoadFileView
+
+r1: as FS_LoadFile, but files in a mapped pak are returned as a pointer into
+the mapping instead of a copy. The buffer is read-only and must still be
+released with FS_FreeFile.
+============
+*/
+int FS_LoadFileView (const char *path, void /*@out@*/ /*@null@*/**buffer)
+{
+	return FS_LoadFileInternal (path, buffer, true);
+}
+
+
+/*
+=============
+FS_FileModTime
+
+r1: modification time of whatever the file would be read from (the pak for
+packed files), 0 if it doesn't exist.
+=============
+*/
+uint32 FS_FileModTime (const char *filename)
+{
+	struct stat	statInfo;
+	FILE		*h;
+	qboolean	closeHandle;
+	uint32		mtime;
+
+	if (FS_FOpenFile (filename, &h, HANDLE_DUPE, &closeHandle) == -1)
+		return 0;
+
+	mtime = 0;
+
+	if (!fstat (fileno (h), &statInfo))
+		mtime = (uint32)statInfo.st_mtime;
+
+	if (closeHandle)
+		fclose (h);
+
+	return mtime;
+}
+
+/*
+=================
+FS_MapPack
+
+r1: map the entire pak read-only so files can be served out of the page cache
+without going through the shared stdio handle.
+=================
+*/
+static void FS_MapPack (pack_t *pack, FILE *handle, uint32 length)
+{
+#ifndef _WIN32
+	void	*view;
+#endif
+
+	pack->mapped = NULL;
+	pack->maplength = 0;
+	pack->views = 0;
+	pack->nextretired = NULL;
+
+#ifndef _WIN32
+	if (!fs_mmap->intvalue || !length)
+		return;
+
+	view = mmap (NULL, length, PROT_READ, MAP_SHARED, fileno (handle), 0);
+	if (view == MAP_FAILED)
+	{
+		Com_Printf ("WARNING: Couldn't map %s: %s, using buffered reads\n", LOG_GENERAL|LOG_WARNING, pack->filename, strerror (errno));
+		return;
+	}
+
+	pack->mapped = (byte *)view;
+	pack->maplength = length;
+#endif
+}
+
+static void FS_UnmapPack (pack_t *pack)
+{
+#ifndef _WIN32
+	if (pack->mapped)
+		munmap (pack->mapped, pack->maplength);
+#endif
+	pack->mapped = NULL;
+	pack->maplength = 0;
+}
+
+#define FS_InView(pack,p) ((pack)->mapped && (const byte *)(p) >= (pack)->mapped && (const byte *)(p) < (pack)->mapped + (pack)->maplength)
+
+/*
+=================
+FS_ReleaseView
+
+r1: returns true if buffer was a view into a mapped pak. Paks that were freed
+while views were outstanding are unmapped once the last view goes away.
+=================
+*/
+static qboolean FS_ReleaseView (const void *buffer)
+{
+	searchpath_t	*search;
+	pack_t			*pak, **prev;
+
+	for (search = fs_searchpaths ; search ; search = search->next)
+	{
+		pak = search->pack;
+		if (pak && FS_InView (pak, buffer))
+		{
+			pak->views--;
+			return true;
+		}
+	}
+
+	for (prev = &fs_retiredpacks ; (pak = *prev) ; prev = &pak->nextretired)
+	{
+		if (FS_InView (pak, buffer))
+		{
+			if (!--pak->views)
+			{
+				*prev = pak->nextretired;
+				FS_UnmapPack (pak);
+				Z_Free (pak);
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+=================
+FS_FreePack
+=================
+*/
+static void FS_FreePack (pack_t *pack)
+{
+	fclose (pack->h.handle);
+	//Z_Free (pack->files);
+	rbdestroy (pack->rb);
+
+	//r1: someone is still reading out of the mapping, defer until FS_FreeFile
+	if (pack->views)
+	{
+		pack->nextretired = fs_retiredpacks;
+		fs_retiredpacks = pack;
+		return;
+	}
+
+	FS_UnmapPack (pack);
+	Z_Free (pack);
+}
 
 /*
 =============
@@ -971,9 +1230,45 @@ FS_FreeFile
 */
 void EXPORT FS_FreeFile (void *buffer)
 {
+	//r1: views into mapped paks just drop their reference
+	if (FS_ReleaseView (buffer))
+		return;
+
 	Z_Free (buffer);
 }
 
+#ifndef NO_ZLIB
+/*
+=================
+FS_ZipDataOffset
+
+r1: follow a central directory record to its local header and return the
+offset of the file data, 0 on failure.
+=================
+*/
+static uint32 FS_ZipDataOffset (FILE *handle, uint32 centralofs)
+{
+	byte	hdr[46];
+	uint32	localofs;
+
+	if (fseek (handle, centralofs, SEEK_SET) || fread (hdr, sizeof(hdr), 1, handle) != 1)
+		return 0;
+
+	if (hdr[0] != 'P' || hdr[1] != 'K' || hdr[2] != 1 || hdr[3] != 2)
+		return 0;
+
+	localofs = hdr[42] | (hdr[43] << 8) | (hdr[44] << 16) | ((uint32)hdr[45] << 24);
+
+	if (fseek (handle, localofs, SEEK_SET) || fread (hdr, 30, 1, handle) != 1)
+		return 0;
+
+	if (hdr[0] != 'P' || hdr[1] != 'K' || hdr[2] != 3 || hdr[3] != 4)
+		return 0;
+
+	return localofs + 30 + (hdr[26] | (hdr[27] << 8)) + (hdr[28] | (hdr[29] << 8));
+}
+#endif
+
 /*
 =================
 FS_LoadPackFile
@@ -1069,7 +1364,9 @@ static pack_t /*@null@*/ *FS_LoadPackFile (const char *packfile, const char *ext
 		pack->h.handle = packhandle;
 		pack->numfiles = numpackfiles;
 
-		Com_Printf ("Added packfile %s (%i files)\n", LOG_GENERAL,  packfile, numpackfiles);
+		FS_MapPack (pack, packhandle, pakLen);
+
+		Com_Printf ("Added packfile %s (%i files%s)\n", LOG_GENERAL,  packfile, numpackfiles, pack->mapped ? ", mapped" : "");
 	}
 #ifndef NO_ZLIB
 	else if (!strcmp (ext, "pkz"))
@@ -1078,11 +1375,27 @@ static pack_t /*@null@*/ *FS_LoadPackFile (const char *packfile, const char *ext
 		unz_global_info	zipinfo;
 		char			zipFileName[56];
 		unz_file_info	fileInfo;
+		FILE			*packhandle;
+		unsigned		pakLen;
+		uint32			filepos;
+		int				skipped;
 
 		f = unzOpen (packfile);
 		if (!f)
 			return NULL;
 
+		//r1: stored entries are read straight out of the archive like a .pak
+		packhandle = fopen (packfile, "rb");
+		if (!packhandle)
+		{
+			unzClose (f);
+			return NULL;
+		}
+
+		fseek (packhandle, 0, SEEK_END);
+		pakLen = ftell (packhandle);
+		rewind (packhandle);
+
 		if (unzGetGlobalInfo (f, &zipinfo) != UNZ_OK)
 			Com_Error (ERR_FATAL, "FS_LoadPackFile: Couldn't read .zip info from '%s'", packfile);
 
@@ -1097,6 +1410,7 @@ static pack_t /*@null@*/ *FS_LoadPackFile (const char *packfile, const char *ext
 
 		zipFileName[sizeof(zipFileName)-1] = 0;
 		i = 0;
+		skipped = 0;
 		do
 		{
 			if (unzGetCurrentFileInfo (f, &fileInfo, zipFileName, sizeof(zipFileName)-1, NULL, 0, NULL, 0) == UNZ_OK)
@@ -1104,8 +1418,21 @@ static pack_t /*@null@*/ *FS_LoadPackFile (const char *packfile, const char *ext
 				//directory, ignored
 				if (fileInfo.external_fa & 16)
 					continue;
+
+				//r1: compressed entries can't be seeked into or mapped
+				if (fileInfo.compression_method || fileInfo.compressed_size != fileInfo.uncompressed_size)
+				{
+					skipped++;
+					continue;
+				}
+
+				filepos = FS_ZipDataOffset (packhandle, unzGetOffset (f));
+				if (!filepos || filepos + fileInfo.uncompressed_size > pakLen)
+					Com_Error (ERR_FATAL, "FS_LoadPackFile: File '%.64s' in zpackfile %s has a bad local header. Zip file is possibly corrupt.", MakePrintable (zipFileName, 0), packfile);
+
 				strcpy (info[i].name, zipFileName);
-				info[i].filepos = unzGetOffset (f);
+				fast_strlwr (info[i].name);
+				info[i].filepos = filepos;
 				info[i].filelen = fileInfo.uncompressed_size;
 				newitem = rbsearch (info[i].name, pack->rb);
 				*newitem = &info[i];
@@ -1113,8 +1440,19 @@ static pack_t /*@null@*/ *FS_LoadPackFile (const char *packfile, const char *ext
 			}
 		} while (unzGoToNextFile (f) == UNZ_OK);
 
-		pack->h.zhandle = f;
-		Com_Printf ("Added zpackfile %s (%i files)\n", LOG_GENERAL,  packfile, i);
+		unzClose (f);
+
+		Q_strncpy (pack->filename, packfile, sizeof(pack->filename)-1);
+
+		pack->h.handle = packhandle;
+		pack->numfiles = i;
+
+		FS_MapPack (pack, packhandle, pakLen);
+
+		Com_Printf ("Added zpackfile %s (%i files%s)\n", LOG_GENERAL,  packfile, i, pack->mapped ? ", mapped" : "");
+
+		if (skipped)
+			Com_Printf ("WARNING: %d compressed files in %s were ignored, only stored files are supported\n", LOG_GENERAL|LOG_WARNING, skipped, packfile);
 	}
 #endif
 	else
@@ -1268,7 +1606,7 @@ static void FS_AddGameDirectory (const char *dir)
 	}*/
 
 	FS_LoadPaks (dir, "pak");
-#ifdef _DEBUG
+#ifndef NO_ZLIB
 	FS_LoadPaks (dir, "pkz");
 #endif
 }
@@ -1375,18 +1713,15 @@ void FS_ReloadPAKs (void)
 	while (fs_searchpaths != fs_base_searchpaths)
 	{
 		if (fs_searchpaths->pack)
-		{
-			fclose (fs_searchpaths->pack->h.handle);
-			//Z_Free (fs_searchpaths->pack->files);
-			//RB_Purge (fs_searchpaths->pack->rb);
-			rbdestroy (fs_searchpaths->pack->rb);
-			Z_Free (fs_searchpaths->pack);
-		}
+			FS_FreePack (fs_searchpaths->pack);
 		next = fs_searchpaths->next;
 		Z_Free (fs_searchpaths);
 		fs_searchpaths = next;
 	}
 
+	//r1: cache entries point at the paks we just freed
+	FS_FlushCache ();
+
 	dir = Cvar_VariableString ("gamedir");
 
 	if (dir[0] && strcmp(dir, BASEDIRNAME))
@@ -1417,12 +1752,7 @@ void FS_SetGamedir (const char *dir)
 	while (fs_searchpaths != fs_base_searchpaths)
 	{
 		if (fs_searchpaths->pack)
-		{
-			fclose (fs_searchpaths->pack->h.handle);
-			//Z_Free (fs_searchpaths->pack->files);
-			rbdestroy (fs_searchpaths->pack->rb);
-			Z_Free (fs_searchpaths->pack);
-		}
+			FS_FreePack (fs_searchpaths->pack);
 		next = fs_searchpaths->next;
 		Z_Free (fs_searchpaths);
 		fs_searchpaths = next;
@@ -1712,6 +2042,9 @@ void FS_InitFilesystem (void)
 	fs_cache = Cvar_Get ("fs_cache", "7", 0);
 	fs_noextern = Cvar_Get ("fs_noextern", "0", 0);
 
+	fs_mmap = Cvar_Get ("fs_mmap", "0", 0);
+	fs_mmap->help = "Map pak files into memory so files can be loaded and served without copying through stdio. Applies to paks loaded after it is changed. Do not overwrite or truncate a mapped pak while the server is running, a file read from it at that moment crashes the server with SIGBUS instead of failing. Default 0.\n";
+
 	//
 	// start up with baseq2 by default
 	//
@@ -335,6 +335,11 @@ void NET_Sleep(int msec)
 
 	//Com_Printf ("NET_Sleep (%d)\n", LOG_GENERAL, msec);
 
+#ifdef __linux__
+	if (Sys_EventWait (ip_sockets[NS_SERVER], msec))
+		return;
+#endif
+
 	FD_ZERO(&fdset);
 	FD_SET(ip_sockets[NS_SERVER], &fdset); // network socket
 	timeout.tv_sec = msec/1000;
@@ -137,15 +137,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 //============================================================================
 
-//maximum length of message list. keep in mind unreliable messages are
-//removed every frame, and that any unreliable write will likely be at least 2+
-//bytes, so this number represents the maximum number of reliable messages
-//that are allowed to be pending at once. if this is exceeded, the client is
-//dropped with an overflow.
+//maximum number of reliable messages that are allowed to be pending at once
+//for a client. if this is exceeded, the client is dropped with an overflow.
 
 #define	MAX_MESSAGES_PER_LIST		2048
 
-//don't forget to pad for struct alignment (rest of struct = 1
+//messages up to this size are copied into the client's queue, anything bigger
+//goes into a pooled payload
 #define	MSG_MAX_SIZE_BEFORE_MALLOC	69
 
 typedef struct sizebuf_s
@@ -159,23 +157,17 @@ typedef struct sizebuf_s
 	int			buffsize;
 } sizebuf_t;
 
-typedef struct messagelist_s
+//r1: pooled, reference counted message data. used for anything that doesn't fit
+//in localbuff and shared between all recipients of a multicast.
+typedef struct msgpayload_s
 {
-	//pointer to the message data - this is either localbuff or heap
-	byte					*data;
+	struct msgpayload_s		*next;		//freelist
+	int						refcount;
+	int						sizeclass;
+	int						cursize;
+	byte					data[1];
+} msgpayload_t;
 
-	//next in list
-	struct messagelist_s	*next;
-
-	//message length
-	int16					cursize;
-
-	//is it reliable?
-	byte					reliable;
-
-	//local buffer to avoid lots of mallocs with small size
-	byte					localbuff[MSG_MAX_SIZE_BEFORE_MALLOC];
-} messagelist_t;
 
 void SZ_Init (sizebuf_t /*@out@*/*buf, byte /*@out@*/*data, int length);
 void SZ_Clear (sizebuf_t *buf);
@@ -192,6 +184,7 @@ extern	entity_state_t	null_entity_state;
 extern	usercmd_t		null_usercmd;
 extern	cvar_t			uninitialized_cvar;
 
+void MSG_InitBuffer (void);
 void MSG_WriteChar (int c);
 void MSG_BeginWriting (int c);
 void MSG_WriteByte (int c);
@@ -204,7 +197,10 @@ void MSG_WritePos (vec3_t pos);
 void MSG_WriteAngle (float f);
 void MSG_WriteAngle16 (float f);
 void MSG_EndWriting (sizebuf_t *out);
-void MSG_EndWrite (messagelist_t *out);
+int MSG_EndWrite (byte *out, msgpayload_t **payload);
+int MSG_EndWriteShared (msgpayload_t *payload);
+msgpayload_t *MSG_CreatePayload (void);
+void MSG_ReleasePayload (msgpayload_t *payload);
 void MSG_Write (const void *data, int length);
 void MSG_Print (const char *data);
 
@@ -302,11 +298,16 @@ PROTOCOL
 #define	PROTOCOL_ORIGINAL	34
 #define	PROTOCOL_R1Q2		35
 
-#define	MINOR_VERSION_R1Q2				1905
+#define	MINOR_VERSION_R1Q2				1906
 
 //minimum versions for some features
 #define MINOR_VERSION_R1Q2_UCMD_UPDATES	1904
 #define	MINOR_VERSION_R1Q2_32BIT_SOLID	1905
+#define	MINOR_VERSION_R1Q2_ZDICT		1906	// svc_zpacket may use the preset zlib dictionary
+
+//r1: svc_zpacket extrabit, set when the payload was deflated with the preset
+//dictionary. only configstrings and baselines are, frames share no strings with it.
+#define	ZPACKET_DICTIONARY				0x20
 
 //=========================================
 
@@ -570,7 +571,11 @@ void Cbuf_Execute (void);
 //r1: zlib
 #ifndef NO_ZLIB
 int ZLibCompressChunk(byte *in, int len_in, byte *out, int len_out, int method, int wbits);
-int ZLibDecompress (byte *in, int inlen, byte /*@out@*/*out, int outlen, int wbits);
+const byte *ZLibDictionary (void);
+int ZLibDictionarySize (void);
+z_stream *ZLibDeflateStream (int level, qboolean dictionary);
+int ZLibCompressFrame (byte *in, int len_in, byte *out, int len_out, int level, qboolean dictionary);
+int ZLibDecompress (byte *in, int inlen, byte /*@out@*/*out, int outlen, int wbits, qboolean dictionary);
 #endif
 /*
 
@@ -744,6 +749,10 @@ int			NET_Config (int openFlags);
 int			NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message);
 int			NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t *to);
 
+//r1: while a batch is open NET_SendPacket may only queue, flush sends them all
+void		NET_BeginPacketBatch (netsrc_t sock);
+void		NET_FlushPacketBatch (netsrc_t sock);
+
 #define NET_IsLocalAddress(x) \
 	((x)->ip[0] == 127)
 
@@ -870,8 +879,25 @@ trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
 						  int headnode, int brushmask,
 						  vec3_t origin, vec3_t angles);
 
-byte		*CM_ClusterPVS (int cluster);
-byte		*CM_ClusterPHS (int cluster);
+/*
+==============================================================
+
+BITSET
+
+==============================================================
+*/
+
+//r1: kernels for vis rows and entity bitsets, selected for the cpu by Bit_Init
+void		Bit_Init (void);
+
+extern void		(*Bit_Or) (uint32 *out, const uint32 *in, int words);
+extern void		(*Bit_And) (uint32 *out, const uint32 *in, int words);
+extern qboolean	(*Bit_Intersects) (const uint32 *a, const uint32 *b, int words);
+extern int		(*Bit_Count) (const uint32 *in, int words);
+
+//r1: buffer must hold MAX_MAP_LEAFS/8 bytes, the returned row may not be buffer
+const byte	*CM_ClusterPVS (int cluster, byte *buffer);
+const byte	*CM_ClusterPHS (int cluster, byte *buffer);
 
 int			CM_PointLeafnum (const vec3_t p);
 
@@ -924,6 +950,8 @@ qboolean	CM_HeadnodeVisible (int headnode, const byte *visbits);
 
 void		CM_WritePortalState (FILE *f);
 void		CM_ReadPortalState (FILE *f);
+void		CM_SavePortalState (qboolean *state);
+void		CM_LoadPortalState (const qboolean *state);
 
 /*
 ==============================================================
@@ -972,6 +1000,11 @@ int		EXPORT FS_LoadFile (const char *path, void /*@out@*/ /*@null@*/**buffer);
 // a null buffer will just return the file length without loading
 // a -1 length is not present
 
+int		FS_LoadFileView (const char *path, void /*@out@*/ /*@null@*/**buffer);
+// same as FS_LoadFile but may return a read-only view into a mapped pak
+
+uint32	FS_FileModTime (const char *filename);
+
 void	EXPORT FS_Read (void *buffer, int len, FILE *f);
 // properly handles partial reads
 
@@ -1011,6 +1044,9 @@ void 		Com_Printf (const char *fmt, int level, ...) __attribute__ ((format (prin
 void 		Com_Error (int code, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 void 		Com_Quit (void);
 
+//r1: frees any per-thread state, worker and background threads call it just before exiting
+void		Com_ThreadExit (void);
+
 //extern __inline int			Com_ServerState (void);		// this should have just been a cvar...
 //extern __inline void		Com_SetServerState (int state);
 
@@ -1088,6 +1124,9 @@ enum tagmalloc_tags_e
 	TAGMALLOC_CMDBANS,
 	TAGMALLOC_REDBLACK,
 	TAGMALLOC_LRCON,
+	TAGMALLOC_CLUSTERINDEX,
+	TAGMALLOC_DLCACHE,
+	TAGMALLOC_VISCACHE,
 #ifdef ANTICHEAT
 	TAGMALLOC_ANTICHEAT,
 #endif
@@ -1178,6 +1217,35 @@ void	Sys_SetWindowText(char *buff);
 void	Sys_ProcessTimes_f (void);
 void	Sys_Spinstats_f (void);
 
+#ifdef __linux__
+//r1: waits on epoll for a packet on sock, console input or the frame msec after the
+//current one. returns false if epoll isn't available so the caller can fall back.
+qboolean	Sys_EventWait (int sock, int msec);
+#endif
+
+//r1: simple worker pool. Sys_RunWorkers calls func once for every job index
+//across the workers and the calling thread and returns when all are done.
+#define	MAX_WORKER_THREADS	32
+int		Sys_InitWorkers (int numthreads);
+void	Sys_ShutdownWorkers (void);
+int		Sys_NumWorkers (void);
+void	Sys_RunWorkers (void (*func)(int job), int numjobs);
+
+//r1: a single background thread, Sys_JoinThread waits for func to return.
+void	*Sys_StartThread (void (*func)(void *arg), void *arg);
+void	Sys_JoinThread (void *thread);
+
+//r1: an auto-reset wakeup for such a thread. Sys_WaitSignal blocks for up to
+//msec (forever if < 0) and returns true if it was signalled rather than timed out.
+void	*Sys_CreateSignal (void);
+void	Sys_DestroySignal (void *sig);
+void	Sys_SetSignal (void *sig);
+qboolean	Sys_WaitSignal (void *sig, int msec);
+
+//r1: for data the workers share without a lock. both are full barriers.
+qboolean	Sys_CompareAndSwap (volatile int *value, int oldvalue, int newvalue);
+void	Sys_MemoryBarrier (void);
+
 /*
 ==============================================================
 
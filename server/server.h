@@ -97,6 +97,10 @@ typedef struct
 	//having a stupid 17mb [MAX_CLIENTS][MAX_EDICTS] array.
 	//entity_state_t	*baselines[MAX_CLIENTS]; //[MAX_EDICTS];
 
+	//r1: shared baselines taken when the map spawns. clients only keep their
+	//own copy of the ones that differed by the time they connected.
+	entity_state_t	baselines[MAX_EDICTS];
+
 	// the multicast buffer is used to send a message to a set of clients
 	// it is only used to marshall data until SV_Multicast is called
 	//sizebuf_t	multicast;
@@ -114,6 +118,59 @@ typedef struct
 #define NUM_FOR_EDICT(e) (int)(( ((byte *)(e)-(byte *)ge->edicts ) / ge->edict_size))
 
 
+//r1: a per-client baseline that diverged from sv.baselines
+typedef struct
+{
+	int				number;
+	entity_state_t	s;
+} baseline_t;
+
+//r1: a client's outgoing messages. reliables are framed records in a byte
+//ring and always leave in order. unreliables only live until the next
+//datagram, so they are appended to a flat buffer with a small index that
+//SV_SendClientDatagram makes its priority passes over.
+#define	MSGRING_MINSIZE			16384
+#define	MSGRING_MAXSIZE			1048576
+#define	MSGRING_ALIGN			16		// record size granularity, also the header size
+
+#define	MAX_UNRELIABLE_MESSAGES	256
+
+typedef struct
+{
+	msgpayload_t	*payload;		// shared data, NULL if it follows the header
+	int				cursize;		// 0 pads out the rest of the ring
+} msgrecord_t;
+
+typedef enum
+{
+	MSGPRI_TEMPENT,				// tempents with a sound, always go first
+	MSGPRI_TEMPENT_RANDOM,		// repeated bullet effects, half go first
+	MSGPRI_SOUND,
+	MSGPRI_OTHER
+} msgpriority_t;
+
+typedef struct
+{
+	msgpayload_t	*payload;		// shared data, NULL if in unreliable_buf
+	int				offset;
+	int16			cursize;
+	byte			priority;
+	byte			done;
+} msgindex_t;
+
+typedef struct
+{
+	byte			*ring;
+	int				ringsize;		// power of two
+	uint32			head, tail;		// byte positions, wrap with ringsize
+	int				numreliable;
+
+	int				numunreliable;
+	int				unreliablesize;
+	msgindex_t		unreliable[MAX_UNRELIABLE_MESSAGES];
+	byte			unreliable_buf[MAX_UNRELIABLE_MESSAGES * MSG_MAX_SIZE_BEFORE_MALLOC];
+} msgqueue_t;
+
 typedef enum
 {
 	cs_free,		// can be reused for a new connection
@@ -187,6 +244,9 @@ typedef struct client_s
 
 	char			*downloadFileName;
 
+	//r1: shared precompressed chunks for this download, may be NULL
+	struct dlcache_s	*downloadCache;
+
 	int				lastmessage;		// sv.framenum when packet was last received
 
 	uint32	 		challenge;			// challenge of this user, randomly generated
@@ -207,8 +267,11 @@ typedef struct client_s
 	//r1: don't send game data to this client (bots etc)
 	qboolean		nodata;
 
-	//r1: client-specific last deltas (kind of like dynamic baselines)
-	entity_state_t	*lastlines;
+	//r1: client-specific last deltas (kind of like dynamic baselines). sparse,
+	//sorted by number, only entities set in lastlinebits. use SV_ClientBaseline.
+	baseline_t		*lastlines;
+	int				numlastlines;
+	uint32			lastlinebits[MAX_EDICTS/32];
 
 	//r1: misc flags
 	uint32			notes;
@@ -229,9 +292,8 @@ typedef struct client_s
 	char						reconnect_value[32];
 	qboolean					reconnect_done;
 
-	messagelist_t				*messageListData;
-	messagelist_t				*msgListStart;
-	messagelist_t				*msgListEnd;
+	//r1: NULL once they were dropped for misbehaving or overflowing
+	msgqueue_t					*messages;
 
 	qboolean					moved;
 
@@ -328,13 +390,18 @@ typedef struct
 	ratelimit_t	ratelimit_status;
 	ratelimit_t	ratelimit_badrcon;
 
-	//crazy stats :)
+	//crazy stats :) these are bumped without locking from the sv_threads workers
+	//too, so treat them as approximate.
 #ifndef NPROFILE
 	unsigned long		proto35BytesSaved;
 	unsigned long		proto35CompressionBytes;
 	unsigned long		r1q2OptimizedBytes;
 	unsigned long		r1q2CustomBytes;
 	unsigned long		r1q2AttnBytes;
+	unsigned long		deltaCacheHits;
+	unsigned long		deltaCacheMisses;
+	unsigned long		ncVisCached;
+	unsigned long		ncVisTraced;
 #endif
 
 	sventity_t			entities[MAX_EDICTS];
@@ -362,9 +429,11 @@ extern	cvar_t		*sv_noreload;			// don't reload level state when reentering
 extern	cvar_t		*sv_airaccelerate;		// don't reload level state when reentering
 											// development tool
 extern	cvar_t		*sv_max_download_size;
+extern	cvar_t		*sv_download_cache;
 extern	cvar_t		*sv_downloadserver;
 
 extern	cvar_t		*sv_nc_visibilitycheck;
+extern	cvar_t		*sv_areanode_size;
 extern	cvar_t		*sv_nc_clientsonly;
 
 extern	cvar_t		*sv_max_netdrop;
@@ -419,6 +488,8 @@ extern	cvar_t		*sv_format_string_hack;
 extern	cvar_t		*sv_lag_stats;
 extern	cvar_t		*sv_func_plat_hack;
 extern	cvar_t		*sv_max_packetdup;
+extern	cvar_t		*sv_threads;
+extern	cvar_t		*sv_delta_cache;
 
 extern	cvar_t		*sv_max_player_updates;
 
@@ -482,6 +553,7 @@ extern cvar_t	*sv_deny_q2ace;
 
 extern cvar_t	*sv_gamedebug;
 extern cvar_t	*sv_packetentities_hack;
+extern cvar_t	*sv_zlib_level;
 
 extern cvar_t	*sv_optimize_deltas;
 
@@ -540,6 +612,16 @@ void SV_FlushRedirect (int sv_redirected, char *outputbuf);
 void SV_SendClientMessages (void);
 
 void EXPORT SV_Multicast (vec3_t /*@null@*/origin, multicast_t to);
+
+void SV_ClearMulticastIndex (void);
+// called with SV_ClearWorld, drops all cached client clusters
+
+void SV_InvalidateMulticastIndex (void);
+// forces every client's cluster to be looked up again before the next PVS/PHS multicast
+
+void SV_MulticastClientMoved (int clientnum);
+// same as above for a single client, called when its edict is relinked
+
 void EXPORT SV_StartSound (vec3_t origin, edict_t *entity, int channel,
 					int soundindex, float volume,
 					float attenuation, float timeofs);
@@ -551,28 +633,58 @@ void SV_BroadcastCommand (const char *fmt, ...) __attribute__ ((format (printf,
 //sizebuf_t *MSGQueueAlloc (client_t *cl, int size, byte type);
 //void SV_AddMessageQueue (client_t *client, int extrabytes);
 void SV_AddMessage (client_t *cl, qboolean reliable);
-//void SV_AddMessageSingle (client_t *cl, qboolean reliable);
+//void SV_AddMessageSingle (client_t *cl, qboolean reliable, msgpayload_t *payload);
 
 void SV_WriteReliableMessages (client_t *client, int buffSize);
 
 void SV_ClearMessageList (client_t *client);
 
+msgqueue_t *SV_AllocMessageQueue (void);
+void SV_FreeMessageQueue (client_t *client);
+// the per client outgoing message queue, allocated on connect
+
+qboolean SV_MessagesPending (const client_t *client);
+
 //
 // sv_user.c
 //
 void SV_Nextserver (void);
 void SV_ExecuteClientMessage (client_t *cl);
 
+void SV_ReleaseDownloadCache (client_t *cl);
+// drops the client's reference to the shared download cache entry, if any
+
+void SV_CreateSharedBaseline (void);
+// snapshots the entity baselines all clients start from, after the map spawns
+void SV_FreeBaseline (client_t *cl);
+const entity_state_t *SV_ClientBaseline (const client_t *cl, int entnum);
+// the baseline entnum was sent to this client as
+
+#ifndef NO_ZLIB
+void SV_DownloadCache_f (void);
+#endif
+
 //
 // sv_ccmds.c
 //
 void SV_ReadLevelFile (void);
+void SV_FinishSaveCopy (void);
+// wait for the background autosave copy made on level change
+void SV_FlushLevelBuffers (void);
+// write the transition saves held in memory out to save/current/
+qboolean SV_LevelSaved (void);
+// save/current/ has the current level, in memory or on disk
 
 //
 // sv_ents.c
 //
 void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg);
+void SV_BeginDeltaCache (void);
+// invalidates the shared delta encoding cache, call before encoding each batch of frames
 void SV_RecordDemoMessage (void);
+void SV_BuildVisibility (void);
+// computes sv_nc_visibilitycheck for all client pairs, call before building the frames
+
 void SV_BuildClientFrame (client_t *client);
 
 
@@ -601,6 +713,12 @@ void SV_InitEdict (edict_t *e);
 void SV_ClearWorld (void);
 // called after the world model has been loaded, before linking any entities
 
+void SV_AreaNodes_f (void);
+// console command listing linked edicts per area node
+
+void SV_ClusterEdicts (const byte *pvs, const byte *phs, uint32 *out);
+// marks the entities that may be visible from pvs for SV_BuildClientFrame
+
 void EXPORT SV_UnlinkEdict (edict_t *ent);
 // call before removing an entity, and before trying to move one,
 // so it doesn't clip against itself
@@ -612,6 +730,10 @@ void EXPORT SV_LinkEdict (edict_t *ent);
 // sets ent->leafnums[] for pvs determination even if the entity
 // is not solid
 
+int EXPORT SV_RadiusEdicts (vec3_t origin, float radius, edict_t **list, int maxcount);
+// fills in a table of linked solid and trigger edicts whose bounding box
+// center lies within radius of origin, the findradius test.  reentrant.
+
 int EXPORT SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount, int areatype);
 // fills in a table of edict pointers with edicts that have bounding boxes
 // that intersect the given area.  It is possible for a non-axial bmodel
@@ -641,6 +763,9 @@ trace_t EXPORT SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edi
 
 // passedict is explicitly excluded from clipping checks (normally NULL)
 
+trace_t EXPORT SV_TraceThreadSafe (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int contentmask);
+// SV_Trace that may run on worker threads while the world is not changing
+
 void Sys_InitDlMutex (void);
 void Sys_FreeDlMutex (void);
 void Sys_AcquireDlMutex (void);
@@ -668,6 +793,38 @@ struct netblock_s
 	uint32			mask;
 };
 
+//r1: the lists above keep entries in the order they were added for listing
+//and removal, lookups go through a binary trie on the address bits instead
+//so they don't get slower as the lists grow. each node is one bit of prefix,
+//value is set on the node at the end of an entry's mask.
+typedef struct netnode_s netnode_t;
+
+struct netnode_s
+{
+	netnode_t		*child[2];
+	void			*value;
+};
+
+typedef struct
+{
+	netblock_t		list;
+	netblock_t		*tail;		// last entry for appending, NULL if unknown
+	netnode_t		*trie;
+	int				tag;
+} netblocklist_t;
+
+void		NetTrie_Insert (netnode_t **root, uint32 network_ip, uint32 network_mask, void *value, int tag);
+// an existing entry with the same ip/mask is kept
+
+void		*NetTrie_Match (const netnode_t *root, uint32 network_ip);
+// most specific entry containing network_ip, NULL if none
+
+void		NetTrie_Free (netnode_t **root);
+
+netblock_t	*NetBlock_Add (netblocklist_t *list, uint32 network_ip, uint32 network_mask);
+qboolean	NetBlock_Remove (netblocklist_t *list, uint32 network_ip, uint32 network_mask);
+qboolean	NetBlock_Match (const netblocklist_t *list, uint32 network_ip);
+
 #define	BLACKHOLE_SILENT	0
 #define	BLACKHOLE_MESSAGE	1
 
@@ -679,9 +836,11 @@ struct netblock_s
 #define	CVARBAN_EXEC		6
 
 extern blackhole_t blackholes;
-#ifdef ANTICHEAT
-extern netblock_t anticheat_exceptions;
-#endif
+extern netnode_t *blackhole_trie;
+
+blackhole_t *AddBlackhole (uint32 network_ip, uint32 network_mask, int method, const char *reason);
+blackhole_t *Blackhole_Match (uint32 network_ip);
+void Blackhole_RebuildTrie (void);
 
 typedef struct banmatch_s banmatch_t;
 
@@ -716,7 +875,7 @@ extern	unsigned int		sv_tracecount;
 qboolean StringIsNumeric (const char *s);
 uint32 CalcMask (int32 bits);
 
-extern netblock_t	blackhole_exceptions;
+extern netblocklist_t	blackhole_exceptions;
 
 #ifdef ANTICHEAT
 void SV_AntiCheat_WaitForInitialConnect (void);
@@ -777,8 +936,8 @@ enum
 #define	ACCLIENT_APRSW	0x08
 #define	ACCLIENT_Q2PRO	0x10
 
-extern netblock_t	anticheat_exceptions;
-extern netblock_t	anticheat_requirements;
+extern netblocklist_t	anticheat_exceptions;
+extern netblocklist_t	anticheat_requirements;
 
 extern char anticheat_hashlist_name[256];
 
@@ -803,3 +962,7 @@ extern cvar_t	*g_features;
 
 // inform game DLL of disconnects between level changes
 #define GMF_WANT_ALL_DISCONNECTS 8
+
+// GMF_RADIUSEDICTS (game.h) - server provides the RadiusEdicts import
+// GMF_RUNWORKERS (game.h) - server provides the RunWorkers and TraceThreadSafe imports
+// GMF_MEMLEVELS (game.h) - game provides the WriteLevelBuffer and ReadLevelBuffer exports
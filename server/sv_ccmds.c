@@ -165,8 +165,12 @@ static qboolean ValidateIPMask (char *ip, netadr_t *from, int *outmask)
 	return true;
 }
 
-static void DumpNetBlockList (netblock_t *list)
+static void DumpNetBlockList (netblocklist_t *blocks)
 {
+	netblock_t	*list;
+
+	list = &blocks->list;
+
 	while (list->next)
 	{
 		list = list->next;
@@ -258,6 +262,235 @@ SAVEGAME FILES
 ===============================================================================
 */
 
+//r1: the autosave copy on level change runs on a background thread, anything
+//that touches the save dirs must wait for it with SV_FinishSaveCopy first.
+typedef struct
+{
+	char	src[MAX_OSPATH];
+	char	dst[MAX_OSPATH];
+} savecopyfile_t;
+
+static savecopyfile_t	*savecopy_files;
+static int				savecopy_numfiles;
+static int				savecopy_maxfiles;
+static int				savecopy_failed;
+static void				*savecopy_thread;
+
+/*
+================
+qCopyFile
+================
+*/
+static qboolean qCopyFile (const char *src, const char *dst)
+{
+	FILE		*f1, *f2;
+	long		len;
+	byte		*buffer;
+	qboolean	ok;
+
+	f1 = fopen (src, "rb");
+	if (!f1)
+		return true;
+
+	fseek (f1, 0, SEEK_END);
+	len = ftell (f1);
+	fseek (f1, 0, SEEK_SET);
+
+	if (len < 0)
+	{
+		fclose (f1);
+		return false;
+	}
+
+	//r1: whole file in one read and one write, savegames are small
+	buffer = malloc (len > 0 ? len : 1);
+	if (!buffer)
+	{
+		fclose (f1);
+		return false;
+	}
+
+	ok = (len <= 0 || fread (buffer, len, 1, f1) == 1);
+	fclose (f1);
+
+	if (ok)
+	{
+		f2 = fopen (dst, "wb");
+		if (f2)
+		{
+			ok = (len <= 0 || fwrite (buffer, len, 1, f2) == 1);
+			fclose (f2);
+		}
+	}
+
+	free (buffer);
+	return ok;
+}
+
+static void SV_QueueSaveCopy (const char *src, const char *dst)
+{
+	Com_DPrintf ("qCopyFile (%s, %s)\n", src, dst);
+
+	if (savecopy_numfiles == savecopy_maxfiles)
+	{
+		savecopy_maxfiles = savecopy_maxfiles ? savecopy_maxfiles * 2 : 16;
+		savecopy_files = realloc (savecopy_files, savecopy_maxfiles * sizeof(*savecopy_files));
+		if (!savecopy_files)
+			Com_Error (ERR_FATAL, "SV_QueueSaveCopy: out of memory");
+	}
+
+	Q_strncpy (savecopy_files[savecopy_numfiles].src, src, sizeof(savecopy_files[0].src)-1);
+	Q_strncpy (savecopy_files[savecopy_numfiles].dst, dst, sizeof(savecopy_files[0].dst)-1);
+	savecopy_numfiles++;
+}
+
+//no Com_Printf or Sys_Find* in here, it may be on the copy thread
+static void SV_RunSaveCopy (void *arg)
+{
+	int		i;
+
+	for (i = 0; i < savecopy_numfiles; i++)
+	{
+		if (!qCopyFile (savecopy_files[i].src, savecopy_files[i].dst))
+			savecopy_failed++;
+	}
+
+	savecopy_numfiles = 0;
+}
+
+/*
+================
+SV_FinishSaveCopy
+
+Wait for a background savegame copy to complete.
+================
+*/
+void SV_FinishSaveCopy (void)
+{
+	if (savecopy_thread)
+	{
+		Sys_JoinThread (savecopy_thread);
+		savecopy_thread = NULL;
+	}
+
+	if (savecopy_failed)
+	{
+		Com_Printf ("WARNING: Failed to copy %d savegame file%s.\n", LOG_GENERAL|LOG_WARNING, savecopy_failed, savecopy_failed == 1 ? "" : "s");
+		savecopy_failed = 0;
+	}
+}
+
+//r1: with GMF_MEMLEVELS a level saved on a transition stays in memory,
+//the .sv2 contents and the game's .sav. the buffers are written out to
+//save/current/ before anything copies from it and dropped when it is wiped.
+typedef struct levelbuffer_s
+{
+	struct levelbuffer_s	*next;
+	char					name[MAX_QPATH];
+	char					configstrings[MAX_CONFIGSTRINGS][MAX_QPATH];
+	qboolean				portalopen[MAX_MAP_AREAPORTALS];
+	byte					*data;
+	int						length;
+} levelbuffer_t;
+
+static levelbuffer_t	*levelbuffers;
+
+static levelbuffer_t *SV_FindLevelBuffer (const char *name)
+{
+	levelbuffer_t	*lb;
+
+	for (lb = levelbuffers; lb; lb = lb->next)
+	{
+		if (!strcmp (lb->name, name))
+			return lb;
+	}
+
+	return NULL;
+}
+
+static void SV_FreeLevelBuffer (const char *name)
+{
+	levelbuffer_t	*lb, **prev;
+
+	for (prev = &levelbuffers; (lb = *prev) != NULL; prev = &lb->next)
+	{
+		if (!strcmp (lb->name, name))
+		{
+			*prev = lb->next;
+			free (lb->data);
+			free (lb);
+			return;
+		}
+	}
+}
+
+static void SV_FreeLevelBuffers (void)
+{
+	levelbuffer_t	*lb, *next;
+
+	for (lb = levelbuffers; lb; lb = next)
+	{
+		next = lb->next;
+		free (lb->data);
+		free (lb);
+	}
+
+	levelbuffers = NULL;
+}
+
+/*
+================
+SV_FlushLevelBuffers
+
+Write the levels held in memory out to save/current/.
+================
+*/
+void SV_FlushLevelBuffers (void)
+{
+	char			name[MAX_OSPATH];
+	levelbuffer_t	*lb, **prev;
+	FILE			*f;
+	qboolean		ok;
+
+	prev = &levelbuffers;
+	while ((lb = *prev) != NULL)
+	{
+		Com_sprintf (name, sizeof(name), "%s/save/current/%s.sv2", FS_Gamedir(), lb->name);
+		f = fopen (name, "wb");
+		ok = false;
+		if (f)
+		{
+			ok = (fwrite (lb->configstrings, sizeof(lb->configstrings), 1, f) == 1);
+			ok &= (fwrite (lb->portalopen, sizeof(lb->portalopen), 1, f) == 1);
+			fclose (f);
+		}
+
+		if (ok)
+		{
+			Com_sprintf (name, sizeof(name), "%s/save/current/%s.sav", FS_Gamedir(), lb->name);
+			f = fopen (name, "wb");
+			ok = false;
+			if (f)
+			{
+				ok = (fwrite (lb->data, lb->length, 1, f) == 1);
+				fclose (f);
+			}
+		}
+
+		if (!ok)
+		{
+			//keep it so the level can still be entered
+			Com_Printf ("WARNING: Failed to write %s.\n", LOG_GENERAL|LOG_WARNING, name);
+			prev = &lb->next;
+			continue;
+		}
+
+		*prev = lb->next;
+		free (lb->data);
+		free (lb);
+	}
+}
+
 /*
 =====================
 SV_WipeSavegame
@@ -272,6 +505,11 @@ static void SV_WipeSavegame (char *savename)
 
 	Com_DPrintf("SV_WipeSaveGame(%s)\n", savename);
 
+	SV_FinishSaveCopy ();
+
+	if (!strcmp (savename, "current"))
+		SV_FreeLevelBuffers ();
+
 	Com_sprintf (name, sizeof(name), "%s/save/%s/server.ssv", FS_Gamedir (), savename);
 	remove (name);
 	Com_sprintf (name, sizeof(name), "%s/save/%s/game.ssv", FS_Gamedir (), savename);
@@ -296,53 +534,15 @@ static void SV_WipeSavegame (char *savename)
 }
 
 
-/*
-================
-qCopyFile
-================
-*/
-static void qCopyFile (char *src, char *dst)
-{
-	FILE	*f1, *f2;
-	size_t	l;
-	byte	buffer[65536];
-
-	Com_DPrintf ("qCopyFile (%s, %s)\n", src, dst);
-
-	f1 = fopen (src, "rb");
-	if (!f1)
-		return;
-	f2 = fopen (dst, "wb");
-	if (!f2)
-	{
-		fclose (f1);
-		return;
-	}
-
-	for (;;)
-	{
-		l = fread (buffer, 1, sizeof(buffer), f1);
-		if (!l)
-		{
-			if (ferror (f1))
-				Com_Printf ("WARNING: qCopyFile: fread() failed.\n", LOG_GENERAL|LOG_WARNING);
-			break;
-		}
-
-		fwrite (buffer, 1, l, f2);
-	}
-
-	fclose (f1);
-	fclose (f2);
-}
-
-
 /*
 ================
 SV_CopySaveGame
+
+If background is set the files are copied on a thread and
+the caller carries on, see SV_FinishSaveCopy.
 ================
 */
-static void SV_CopySaveGame (char *src, char *dst)
+static void SV_CopySaveGame (char *src, char *dst, qboolean background)
 {
 	char	name[MAX_OSPATH], name2[MAX_OSPATH];
 	size_t	l;
@@ -351,17 +551,23 @@ static void SV_CopySaveGame (char *src, char *dst)
 
 	Com_DPrintf("SV_CopySaveGame(%s, %s)\n", src, dst);
 
+	//r1: the queue is shared with the copy thread, never touch it while one runs
+	SV_FinishSaveCopy ();
+
+	if (!strcmp (src, "current"))
+		SV_FlushLevelBuffers ();
+
 	SV_WipeSavegame (dst);
 
 	// copy the savegame over
 	Com_sprintf (name, sizeof(name), "%s/save/%s/server.ssv", FS_Gamedir(), src);
 	Com_sprintf (name2, sizeof(name2), "%s/save/%s/server.ssv", FS_Gamedir(), dst);
 	FS_CreatePath (name2);
-	qCopyFile (name, name2);
+	SV_QueueSaveCopy (name, name2);
 
 	Com_sprintf (name, sizeof(name), "%s/save/%s/game.ssv", FS_Gamedir(), src);
 	Com_sprintf (name2, sizeof(name2), "%s/save/%s/game.ssv", FS_Gamedir(), dst);
-	qCopyFile (name, name2);
+	SV_QueueSaveCopy (name, name2);
 
 	Com_sprintf (name, sizeof(name), "%s/save/%s/", FS_Gamedir(), src);
 	len = strlen(name);
@@ -373,18 +579,28 @@ static void SV_CopySaveGame (char *src, char *dst)
 		strcpy (name+len, found+len);
 
 		Com_sprintf (name2, sizeof(name2), "%s/save/%s/%s", FS_Gamedir(), dst, found+len);
-		qCopyFile (name, name2);
+		SV_QueueSaveCopy (name, name2);
 
 		// change sav to sv2
 		l = strlen(name);
 		strcpy (name+l-3, "sv2");
 		l = strlen(name2);
 		strcpy (name2+l-3, "sv2");
-		qCopyFile (name, name2);
+		SV_QueueSaveCopy (name, name2);
 
 		found = Sys_FindNext( 0, 0 );
 	}
 	Sys_FindClose ();
+
+	if (background)
+	{
+		savecopy_thread = Sys_StartThread (SV_RunSaveCopy, NULL);
+		if (savecopy_thread)
+			return;
+	}
+
+	SV_RunSaveCopy (NULL);
+	SV_FinishSaveCopy ();
 }
 
 
@@ -401,6 +617,44 @@ static void SV_WriteLevelFile (void)
 
 	Com_DPrintf("SV_WriteLevelFile()\n");
 
+	SV_FinishSaveCopy ();
+
+	if (svs.game_features & GMF_MEMLEVELS)
+	{
+		levelbuffer_t	*lb;
+		void			*data;
+		int				length;
+
+		data = ge->WriteLevelBuffer (&length);
+
+		SV_FreeLevelBuffer (sv.name);
+
+		lb = malloc (sizeof(*lb));
+		if (!lb)
+			Com_Error (ERR_FATAL, "SV_WriteLevelFile: out of memory");
+
+		lb->data = malloc (length > 0 ? length : 1);
+		if (!lb->data)
+			Com_Error (ERR_FATAL, "SV_WriteLevelFile: out of memory");
+
+		memcpy (lb->data, data, length);
+		lb->length = length;
+		memcpy (lb->configstrings, sv.configstrings, sizeof(lb->configstrings));
+		CM_SavePortalState (lb->portalopen);
+		Q_strncpy (lb->name, sv.name, sizeof(lb->name)-1);
+		lb->next = levelbuffers;
+		levelbuffers = lb;
+
+		//an older copy on disk must not be read instead
+		Com_sprintf (name, sizeof(name), "%s/save/current/%s.sv2", FS_Gamedir(), sv.name);
+		remove (name);
+		Com_sprintf (name, sizeof(name), "%s/save/current/%s.sav", FS_Gamedir(), sv.name);
+		remove (name);
+		return;
+	}
+
+	SV_FreeLevelBuffer (sv.name);
+
 	Com_sprintf (name, sizeof(name), "%s/save/current/%s.sv2", FS_Gamedir(), sv.name);
 	f = fopen(name, "wb");
 	if (!f)
@@ -424,11 +678,21 @@ SV_ReadLevelFile
 */
 void SV_ReadLevelFile (void)
 {
-	char	name[MAX_OSPATH];
-	FILE	*f;
+	char			name[MAX_OSPATH];
+	FILE			*f;
+	levelbuffer_t	*lb;
 
 	Com_DPrintf("SV_ReadLevelFile()\n");
 
+	lb = SV_FindLevelBuffer (sv.name);
+	if (lb)
+	{
+		memcpy (sv.configstrings, lb->configstrings, sizeof(sv.configstrings));
+		CM_LoadPortalState (lb->portalopen);
+		ge->ReadLevelBuffer (lb->data, lb->length);
+		return;
+	}
+
 	Com_sprintf (name, sizeof(name), "%s/save/current/%s.sv2", FS_Gamedir(), sv.name);
 	f = fopen(name, "rb");
 	if (!f)
@@ -444,6 +708,30 @@ void SV_ReadLevelFile (void)
 	ge->ReadLevel (name);
 }
 
+/*
+==============
+SV_LevelSaved
+
+True if save/current/ has the current level, in memory or on disk.
+==============
+*/
+qboolean SV_LevelSaved (void)
+{
+	char	name[MAX_OSPATH];
+	FILE	*f;
+
+	if (SV_FindLevelBuffer (sv.name))
+		return true;
+
+	Com_sprintf (name, sizeof(name), "%s/save/current/%s.sav", FS_Gamedir(), sv.name);
+	f = fopen (name, "rb");
+	if (!f)
+		return false;
+
+	fclose (f);
+	return true;
+}
+
 /*
 ==============
 SV_WriteServerFile
@@ -461,6 +749,8 @@ static void SV_WriteServerFile (qboolean autosave)
 
 	Com_DPrintf("SV_WriteServerFile(%s)\n", autosave ? "true" : "false");
 
+	SV_FinishSaveCopy ();
+
 	Com_sprintf (name, sizeof(name), "%s/save/current/server.ssv", FS_Gamedir());
 	f = fopen (name, "wb");
 	if (!f)
@@ -691,7 +981,7 @@ static void SV_GameMap_f (void)
 	if (!dedicated->intvalue && !Cvar_IntValue ("deathmatch"))
 	{
 		SV_WriteServerFile (true);
-		SV_CopySaveGame ("current", "save0");
+		SV_CopySaveGame ("current", "save0", true);
 	}
 }
 
@@ -796,6 +1086,8 @@ static void SV_Loadgame_f (void)
 		return;
 	}
 
+	SV_FinishSaveCopy ();
+
 	// make sure the server.ssv file exists
 	Com_sprintf (name, sizeof(name), "%s/save/%s/server.ssv", FS_Gamedir(), Cmd_Argv(1));
 	f = fopen (name, "rb");
@@ -808,7 +1100,7 @@ static void SV_Loadgame_f (void)
 
 	Com_Printf ("Loading game...\n", LOG_GENERAL);
 
-	SV_CopySaveGame (Cmd_Argv(1), "current");
+	SV_CopySaveGame (Cmd_Argv(1), "current", false);
 
 	SV_ReadServerFile ();
 
@@ -871,7 +1163,7 @@ static void SV_Savegame_f (void)
 	SV_WriteServerFile (false);
 
 	// copy it off
-	SV_CopySaveGame ("current", dir);
+	SV_CopySaveGame ("current", dir, false);
 
 	Com_Printf ("Done.\n", LOG_GENERAL);
 }
@@ -1527,57 +1819,31 @@ static void SV_Addhole_f (void)
 	Blackhole (&adr, false, mask, method, "%s", Cmd_Args2(3));
 }
 
-static qboolean ValidateAndAddToNetBlockList (char *ip, netblock_t *list, int tag)
+static qboolean ValidateAndAddToNetBlockList (char *ip, netblocklist_t *list)
 {
 	int			mask;
 	netadr_t	from;
-	netblock_t	*n;
 
 	if (!ValidateIPMask (ip, &from, &mask))
 		return false;
 
-	n = list;
-	while (n->next)
-		n = n->next;
-
-	n->next = Z_TagMalloc (sizeof(*n), tag);
-	n = n->next;
-
-	n->ip = *(uint32 *)from.ip;
-	n->mask = NET_htonl (CalcMask(mask));
-	n->next = NULL;
+	NetBlock_Add (list, *(uint32 *)from.ip, NET_htonl (CalcMask(mask)));
 
 	return true;
 }
 
-static qboolean ValidateAndRemoveFromNetBlockList (char *ip, netblock_t *list)
+static qboolean ValidateAndRemoveFromNetBlockList (char *ip, netblocklist_t *list)
 {
 	int			mask;
 	netadr_t	from;
-	netblock_t	*n, *last;
-	uint32		network_ip, network_mask;
 
 	if (!ValidateIPMask (ip, &from, &mask))
 		return -1;
 
-	network_ip = *(uint32 *)from.ip;
-	network_mask = NET_htonl (CalcMask (mask));
-
-	n = last = list;
+	if (!NetBlock_Remove (list, *(uint32 *)from.ip, NET_htonl (CalcMask (mask))))
+		return -2;
 
-	while (n->next)
-	{
-		n = n->next;
-
-		if (n->ip == network_ip && n->mask == network_mask)
-		{
-			last->next = n->next;
-			Z_Free (n);
-			return 0;
-		}
-	}
-
-	return -2;
+	return 0;
 }
 
 static void SV_AddWhiteHole_f (void)
@@ -1590,7 +1856,7 @@ static void SV_AddWhiteHole_f (void)
 		return;
 	}
 
-	if (ValidateAndAddToNetBlockList (Cmd_Argv(1), &blackhole_exceptions, TAGMALLOC_BLACKHOLE))
+	if (ValidateAndAddToNetBlockList (Cmd_Argv(1), &blackhole_exceptions))
 	{
 		if (sv.state)
 			Com_Printf ("Blackhole exception added.\n", LOG_GENERAL);
@@ -1636,7 +1902,7 @@ static void SV_AddACException_f (void)
 		return;
 	}
 
-	if (ValidateAndAddToNetBlockList (Cmd_Argv(1), &anticheat_exceptions, TAGMALLOC_ANTICHEAT))
+	if (ValidateAndAddToNetBlockList (Cmd_Argv(1), &anticheat_exceptions))
 	{
 		if (sv.state)
 			Com_Printf ("Anticheat exception added.\n", LOG_GENERAL);
@@ -1681,7 +1947,7 @@ static void SV_AddACRequirement_f (void)
 		return;
 	}
 
-	if (ValidateAndAddToNetBlockList (Cmd_Argv(1), &anticheat_requirements, TAGMALLOC_ANTICHEAT))
+	if (ValidateAndAddToNetBlockList (Cmd_Argv(1), &anticheat_requirements))
 	{
 		if (sv.state)
 			Com_Printf ("Anticheat requirement added.\n", LOG_GENERAL);
@@ -1717,6 +1983,138 @@ static void SV_ListACRequirements_f (void)
 }
 #endif
 
+/*
+==================
+SV_LoadNetBlocks_f
+
+r1: bulk loads one of the netblock lists from a file, one ip/mask per line.
+blackhole lines may be followed by SILENT or MESSAGE and a reason as for
+addhole. lines starting with # or // are ignored.
+==================
+*/
+static void SV_LoadNetBlocks_f (void)
+{
+	char			line[256];
+	char			*buff, *p, *end, *reason;
+	const char		*listname;
+	netblocklist_t	*list;
+	netadr_t		adr;
+	int				len, mask, method, added, failed, i;
+
+	if (Cmd_Argc() < 3)
+	{
+		Com_Printf ("Purpose: Add all the IP blocks in a file to a list.\n"
+					"Syntax : loadnetblocks <holes|whiteholes"
+#ifdef ANTICHEAT
+					"|acexceptions|acrequirements"
+#endif
+					"> <filename>\n"
+					"Example: loadnetblocks holes badnets.txt\n", LOG_GENERAL);
+		return;
+	}
+
+	listname = Cmd_Argv(1);
+
+	if (!Q_stricmp (listname, "holes"))
+		list = NULL;
+	else if (!Q_stricmp (listname, "whiteholes"))
+		list = &blackhole_exceptions;
+#ifdef ANTICHEAT
+	else if (!Q_stricmp (listname, "acexceptions"))
+		list = &anticheat_exceptions;
+	else if (!Q_stricmp (listname, "acrequirements"))
+		list = &anticheat_requirements;
+#endif
+	else
+	{
+		Com_Printf ("Unknown netblock list '%s'\n", LOG_GENERAL, listname);
+		return;
+	}
+
+	len = FS_LoadFile (Cmd_Argv(2), (void **)&buff);
+	if (len == -1)
+	{
+		Com_Printf ("Couldn't load %s\n", LOG_GENERAL, Cmd_Argv(2));
+		return;
+	}
+
+	added = failed = 0;
+
+	p = buff;
+	end = buff + len;
+
+	while (p < end)
+	{
+		//copy out one line
+		for (i = 0; p < end && *p != '\n' && *p != '\r'; p++)
+		{
+			if (i < sizeof(line)-1)
+				line[i++] = *p;
+		}
+		line[i] = 0;
+
+		while (p < end && (*p == '\n' || *p == '\r'))
+			p++;
+
+		if (!line[0] || line[0] == '#' || (line[0] == '/' && line[1] == '/'))
+			continue;
+
+		//split off the address
+		reason = strchr (line, ' ');
+		if (!reason)
+			reason = strchr (line, '\t');
+
+		if (reason)
+		{
+			*reason++ = 0;
+			while (*reason == ' ' || *reason == '\t')
+				reason++;
+		}
+
+		if (!ValidateIPMask (line, &adr, &mask))
+		{
+			failed++;
+			continue;
+		}
+
+		if (list)
+		{
+			NetBlock_Add (list, *(uint32 *)adr.ip, NET_htonl (CalcMask(mask)));
+		}
+		else
+		{
+			method = BLACKHOLE_SILENT;
+
+			if (reason)
+			{
+				if (!Q_strncasecmp (reason, "MESSAGE", 7) && (!reason[7] || reason[7] == ' ' || reason[7] == '\t'))
+				{
+					method = BLACKHOLE_MESSAGE;
+					reason += 7;
+				}
+				else if (!Q_strncasecmp (reason, "SILENT", 6) && (!reason[6] || reason[6] == ' ' || reason[6] == '\t'))
+				{
+					reason += 6;
+				}
+
+				while (*reason == ' ' || *reason == '\t')
+					reason++;
+			}
+
+			AddBlackhole (*(uint32 *)adr.ip, NET_htonl (CalcMask(mask)), method, (reason && reason[0]) ? reason : va("loaded from %s", Cmd_Argv(2)));
+		}
+
+		added++;
+	}
+
+	FS_FreeFile (buff);
+
+	Com_Printf ("Added %d entries from %s to %s", LOG_GENERAL, added, Cmd_Argv(2), listname);
+	if (failed)
+		Com_Printf (", %d invalid", LOG_GENERAL, failed);
+	Com_Printf (".\n", LOG_GENERAL);
+}
+
 /*
 ==================
 SV_Kick_f
@@ -2217,6 +2615,8 @@ static void SV_Status_f (void)
 		Com_Printf ("R1Q2 entity quantization optimization has saved %lu bytes.\n", LOG_GENERAL, r1q2DeltaOptimizedBytes);
 		Com_Printf ("R1Q2 custom delta management has saved %lu bytes.\n", LOG_GENERAL, svs.r1q2CustomBytes);
 		Com_Printf ("R1Q2 sv_func_entities_hack has saved %lu bytes.\n", LOG_GENERAL, svs.r1q2AttnBytes);
+		Com_Printf ("Delta encoding cache: %lu hits, %lu misses.\n", LOG_GENERAL, svs.deltaCacheHits, svs.deltaCacheMisses);
+		Com_Printf ("Visibility checks: %lu precomputed, %lu traced in frame.\n", LOG_GENERAL, svs.ncVisCached, svs.ncVisTraced);
 
 		total = svs.proto35BytesSaved + svs.proto35CompressionBytes + svs.r1q2OptimizedBytes + svs.r1q2CustomBytes + r1q2DeltaOptimizedBytes + svs.r1q2AttnBytes + r1q2UserCmdOptimizedBytes;
 
@@ -2681,6 +3081,11 @@ void SV_InitOperatorCommands (void)
 	Cmd_AddCommand ("addwhitehole", SV_AddWhiteHole_f);
 	Cmd_AddCommand ("delwhitehole", SV_DelWhiteHole_f);
 	Cmd_AddCommand ("listwhiteholes", SV_ListWhiteHoles_f);
+	Cmd_AddCommand ("loadnetblocks", SV_LoadNetBlocks_f);
+	Cmd_AddCommand ("areanodes", SV_AreaNodes_f);
+#ifndef NO_ZLIB
+	Cmd_AddCommand ("dlcache", SV_DownloadCache_f);
+#endif
 
 	//r1: service support
 #ifdef _WIN32
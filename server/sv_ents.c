@@ -341,6 +341,129 @@ void SV_WriteDeltaEntity (const entity_state_t *from, const entity_state_t *to,
 	}
 }
 
+/*
+=============================================================================
+
+r1: shared delta encoding cache. clients that ack the same frame end up
+deltaing the same entity_state_t pairs, so the encoded bytes are kept for the
+current batch of frames and copied out for everyone else. entries are keyed
+on the full from/to states rather than frame numbers since what a client sees
+of an entity (events, nocheat, owned missiles) can differ per client and
+client frame numbers depend on their fps. entries are filled at most once per
+batch and published with a CAS so sv_threads workers share them lock free.
+
+=============================================================================
+*/
+
+#define	DELTA_CACHE_WAYS	4
+#define	DELTA_CACHE_MAXLEN	48		// worst case delta is 47 bytes
+
+#define	DELTA_WRITING		1
+#define	DELTA_READY			2
+
+typedef struct
+{
+	volatile int	stamp;			// delta_batch << 2 | DELTA_WRITING / DELTA_READY
+	int				protocol;
+	int				protocol_version;
+	qboolean		force;
+	qboolean		newentity;
+	int				length;
+	entity_state_t	from;
+	entity_state_t	to;
+	byte			data[DELTA_CACHE_MAXLEN];
+} deltacache_t;
+
+static deltacache_t	delta_cache[MAX_EDICTS][DELTA_CACHE_WAYS];
+static int			delta_batch;
+
+void SV_BeginDeltaCache (void)
+{
+	//stamps only ever have to differ from the current batch
+	if (++delta_batch >= 0x1FFFFFFF)
+	{
+		memset (delta_cache, 0, sizeof(delta_cache));
+		delta_batch = 1;
+	}
+}
+
+static void SV_WriteCachedDeltaEntity (const entity_state_t *from, const entity_state_t *to, qboolean force, qboolean newentity, const client_t *cl)
+{
+	deltacache_t	*entry, *slot;
+	int				i, stamp, ready, writing;
+	int				start, length;
+
+	if (!sv_delta_cache->intvalue || to->number < 1 || to->number >= MAX_EDICTS)
+	{
+		SV_WriteDeltaEntity (from, to, force, newentity, cl->protocol, cl->protocol_version);
+		return;
+	}
+
+	ready = (delta_batch << 2) | DELTA_READY;
+	writing = (delta_batch << 2) | DELTA_WRITING;
+
+	for (i = 0, entry = delta_cache[to->number]; i < DELTA_CACHE_WAYS; i++, entry++)
+	{
+		if (entry->stamp != ready)
+			continue;
+
+		Sys_MemoryBarrier ();
+
+		if (entry->protocol == cl->protocol && entry->protocol_version == cl->protocol_version &&
+			entry->force == force && entry->newentity == newentity &&
+			!memcmp (&entry->to, to, sizeof(*to)) && !memcmp (&entry->from, from, sizeof(*from)))
+		{
+			if (entry->length)
+				MSG_Write (entry->data, entry->length);
+#ifndef NPROFILE
+			svs.deltaCacheHits++;
+#endif
+			return;
+		}
+	}
+
+	//claim a way nobody has used this batch. if they're all taken we just
+	//don't cache this one.
+	slot = NULL;
+	for (i = 0, entry = delta_cache[to->number]; i < DELTA_CACHE_WAYS; i++, entry++)
+	{
+		stamp = entry->stamp;
+		if ((stamp >> 2) != delta_batch && Sys_CompareAndSwap (&entry->stamp, stamp, writing))
+		{
+			slot = entry;
+			break;
+		}
+	}
+
+#ifndef NPROFILE
+	svs.deltaCacheMisses++;
+#endif
+
+	start = MSG_GetLength ();
+	SV_WriteDeltaEntity (from, to, force, newentity, cl->protocol, cl->protocol_version);
+
+	if (!slot)
+		return;
+
+	length = MSG_GetLength () - start;
+	if (length > DELTA_CACHE_MAXLEN)
+	{
+		Sys_CompareAndSwap (&slot->stamp, writing, 0);
+		return;
+	}
+
+	slot->protocol = cl->protocol;
+	slot->protocol_version = cl->protocol_version;
+	slot->force = force;
+	slot->newentity = newentity;
+	slot->from = *from;
+	slot->to = *to;
+	slot->length = length;
+	memcpy (slot->data, MSG_GetData () + start, length);
+
+	Sys_CompareAndSwap (&slot->stamp, writing, ready);
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -428,7 +551,7 @@ static void SV_EmitPacketEntities (const client_t *cl, const client_frame_t /*@n
 			// note that players are always 'newentities', this updates their oldorigin always
 			// and prevents warping
 
-			SV_WriteDeltaEntity (oldent, newent, false, newent->number <= maxclients->intvalue, cl->protocol, cl->protocol_version);
+			SV_WriteCachedDeltaEntity (oldent, newent, false, newent->number <= maxclients->intvalue, cl);
 
 			oldindex++;
 			newindex++;
@@ -437,7 +560,7 @@ static void SV_EmitPacketEntities (const client_t *cl, const client_frame_t /*@n
 	
 		if (newnum < oldnum)
 		{	// this is a new entity, send it from the baseline
-			SV_WriteDeltaEntity (&cl->lastlines[newnum], newent, true, true, cl->protocol, cl->protocol_version);
+			SV_WriteCachedDeltaEntity (SV_ClientBaseline (cl, newnum), newent, true, true, cl);
 			newindex++;
 			continue;
 		}
@@ -1183,8 +1306,6 @@ Build a client frame structure
 =============================================================================
 */
 
-static byte		fatpvs[65536/8];	// 32767 is MAX_MAP_LEAFS
-
 /*
 ============
 SV_FatPVS
@@ -1193,12 +1314,13 @@ The client will interpolate the view position,
 so we can't use a single PVS point
 ===========
 */
-static void SV_FatPVS (vec3_t org)
+static void SV_FatPVS (vec3_t org, byte *fatpvs)
 {
-	int		leafs[64];
-	int		i, j, count;
-	int		longs;
-	byte	*src;
+	int			leafs[64];
+	int			i, j, count;
+	int			longs;
+	byte		buffer[MAX_MAP_LEAFS/8];
+	const byte	*src;
 	vec3_t	mins, maxs;
 
 	mins[0] = org[0] - 8;
@@ -1217,7 +1339,7 @@ static void SV_FatPVS (vec3_t org)
 	for (i=0 ; i<count ; i++)
 		leafs[i] = CM_LeafCluster(leafs[i]);
 
-	memcpy (fatpvs, CM_ClusterPVS(leafs[0]), longs<<2);
+	memcpy (fatpvs, CM_ClusterPVS(leafs[0], buffer), longs<<2);
 	// or in all the other leaf bits
 	for (i=1 ; i<count ; i++)
 	{
@@ -1226,18 +1348,95 @@ static void SV_FatPVS (vec3_t org)
 				break;
 		if (j != i)
 			continue;		// already have the cluster we want
-		src = CM_ClusterPVS(leafs[i]);
-		for (j=0 ; j<longs ; j++)
-			((int32 *)fatpvs)[j] |= ((int32 *)src)[j];
+		src = CM_ClusterPVS(leafs[i], buffer);
+		Bit_Or ((uint32 *)fatpvs, (const uint32 *)src, longs);
 	}
 }
 
+/*
+=============================================================================
+
+Nocheat visibility
+
+=============================================================================
+*/
+
+//r1: results of the sv_nc_visibilitycheck traces for every (viewer, target
+//client) pair that passed the pvs test, filled in on the workers by
+//SV_BuildVisibility before any client frame is built.
+#define	NCVIS_UNKNOWN	0
+#define	NCVIS_VISIBLE	1
+#define	NCVIS_HIDDEN	2
+
+static byte				nc_visible[MAX_CLIENTS][MAX_CLIENTS];
+static int				nc_rowstamp[MAX_CLIENTS];
+static int				nc_visstamp;
+
+static int				nc_viewers[MAX_CLIENTS];
+static int				nc_numviewers;
+
+//brush models that can block sight, gathered once per frame
+static const edict_t	*nc_brushents[MAX_EDICTS];
+static int				nc_brushheadnodes[MAX_EDICTS];
+static int				nc_numbrushents;
+
+/*
+=============
+SV_LineOfSight
+
+Equivalent to an SV_Trace point trace with CONTENTS_SOLID, but only looks at
+the world and the brush models from SV_BuildVisibility. It doesn't use the
+area nodes, box hull or trace counter so it is safe on the workers.
+=============
+*/
+static qboolean SV_LineOfSight (vec3_t start, vec3_t end)
+{
+	int				i, j;
+	trace_t			trace;
+	const edict_t	*ent;
+	vec3_t			mins, maxs;
+
+	trace = CM_BoxTrace (start, end, vec3_origin, vec3_origin, 0, CONTENTS_SOLID);
+	if (trace.fraction != 1)
+		return false;
+
+	for (j = 0; j < 3; j++)
+	{
+		if (end[j] > start[j])
+		{
+			mins[j] = start[j] - 1;
+			maxs[j] = end[j] + 1;
+		}
+		else
+		{
+			mins[j] = end[j] - 1;
+			maxs[j] = start[j] + 1;
+		}
+	}
+
+	for (i = 0; i < nc_numbrushents; i++)
+	{
+		ent = nc_brushents[i];
+
+		if (ent->absmin[0] > maxs[0] || ent->absmin[1] > maxs[1] || ent->absmin[2] > maxs[2] ||
+			ent->absmax[0] < mins[0] || ent->absmax[1] < mins[1] || ent->absmax[2] < mins[2])
+			continue;
+
+		trace = CM_TransformedBoxTrace (start, end, vec3_origin, vec3_origin, nc_brushheadnodes[i],
+			CONTENTS_SOLID, (float *)ent->s.origin, (float *)ent->s.angles);
+
+		if (trace.fraction != 1)
+			return false;
+	}
+
+	return true;
+}
+
 static qboolean SV_CheckPlayerVisible(vec3_t Angles, vec3_t start, const edict_t *ent, qboolean fullCheck, qboolean predictEnt)
 {
 	int		i;
 	vec3_t	ends[9];
 	vec3_t	entOrigin;
-	trace_t	trace;
 	int		num;
 
 	FastVectorCopy (ent->s.origin, entOrigin);
@@ -1292,15 +1491,203 @@ static qboolean SV_CheckPlayerVisible(vec3_t Angles, vec3_t start, const edict_t
 	}
 
 	for (i = 0; i < num; i++) {
-		trace = SV_Trace(start, NULL, NULL, ends[i], NULL, CONTENTS_SOLID);
-
-		if (trace.fraction == 1)
+		if (SV_LineOfSight (start, ends[i]))
 			return true;
 	}
 
 	return false;
 }
 
+/*
+=============
+SV_NCPlayerVisible
+
+Runs the sv_nc_visibilitycheck tests for ent as seen from clent's eye at org.
+=============
+*/
+static qboolean SV_NCPlayerVisible (const edict_t *clent, const vec3_t org, const edict_t *ent)
+{
+	int			i;
+	qboolean	visible;
+	vec3_t		start;
+
+	// *********** NiceAss Start ************
+	FastVectorCopy (*org, start);
+	visible = SV_CheckPlayerVisible (clent->client->ps.viewangles, start, ent, true, false);
+
+	if (!visible)
+	{
+		FastVectorCopy (*org, start);
+
+		// If the first direct check didn't see the player, check a little ahead
+		// of yourself based on your current velocity, lag, frame update speed (100ms). 
+		// This will compensate for clients predicting where they will be due to lag
+		// (cl_predict)
+		for (i = 0; i < 3; i++)
+			start[i] += clent->client->ps.pmove.velocity[i] * 0.125f * ( 0.15f + (float)clent->client->ping * 0.001f );
+			
+		visible = SV_CheckPlayerVisible (clent->client->ps.viewangles, start, ent, false, true);
+
+		if ( !visible )
+		{
+			FastVectorCopy (*org, start);
+			// If the first/second direct check didn't see the player, check a little above
+			// of yourself based on your current velocity. This will compensate for
+			// clients predicting where they will be due to lag (cl_predict)
+			start[2] += ent->maxs[2];
+			visible = SV_CheckPlayerVisible (clent->client->ps.viewangles, start, ent, false, true);
+		}
+	}
+	// ***********  NiceAss End  ************
+
+	return visible;
+}
+
+static void SV_ViewOrigin (const edict_t *clent, vec3_t org)
+{
+	int		i;
+
+	for (i=0 ; i<3 ; i++)
+		org[i] = clent->client->ps.pmove.origin[i]*0.125f + clent->client->ps.viewoffset[i];
+}
+
+/*
+=============
+SV_NCVisibilityRow
+
+Worker job, fills nc_visible for one viewer against every target client in
+its pvs. Only reads game state.
+=============
+*/
+static void SV_NCVisibilityRow (int job)
+{
+	int				j, l;
+	int				viewer;
+	int				leafnum, clientarea;
+	vec3_t			org;
+	byte			fatpvs[MAX_MAP_LEAFS/8];
+	const client_t	*cl;
+	const edict_t	*clent, *ent;
+	byte			*row;
+
+	viewer = nc_viewers[job];
+	cl = svs.clients + viewer;
+	clent = cl->edict;
+	row = nc_visible[viewer];
+
+	SV_ViewOrigin (clent, org);
+
+	leafnum = CM_PointLeafnum (org);
+	clientarea = CM_LeafArea (leafnum);
+
+	SV_FatPVS (org, fatpvs);
+
+	for (j = 0; j < maxclients->intvalue; j++)
+	{
+		if (svs.clients[j].state != cs_spawned)
+			continue;
+
+		ent = svs.clients[j].edict;
+
+		if (!ent->inuse || (ent->svflags & SVF_NOCLIENT) || ent->solid == SOLID_BSP || ent->solid == SOLID_TRIGGER)
+			continue;
+
+		//the viewer's own entity skips the pvs tests, as in SV_BuildClientFrame
+		if (ent == clent)
+		{
+			row[j] = SV_NCPlayerVisible (clent, org, ent) ? NCVIS_VISIBLE : NCVIS_HIDDEN;
+			continue;
+		}
+
+		//skip anything SV_BuildClientFrame would reject before tracing
+		if (!CM_AreasConnected (clientarea, ent->areanum))
+		{
+			if (!ent->areanum2 || !CM_AreasConnected (clientarea, ent->areanum2))
+				continue;
+		}
+
+		if (ent->num_clusters == -1)
+		{
+			if (!CM_HeadnodeVisible (ent->headnode, fatpvs))
+				continue;
+		}
+		else
+		{
+			for (l = 0; l < ent->num_clusters; l++)
+			{
+				if (fatpvs[ent->clusternums[l] >> 3] & (1 << (ent->clusternums[l] & 7)))
+					break;
+			}
+			if (l == ent->num_clusters)
+				continue;
+		}
+
+		row[j] = SV_NCPlayerVisible (clent, org, ent) ? NCVIS_VISIBLE : NCVIS_HIDDEN;
+	}
+}
+
+/*
+=============
+SV_BuildVisibility
+
+Main thread, once per server frame before the client frames are built.
+Gathers the blocking brush models and, with worker threads, computes the
+nocheat visibility of every client pair in parallel.
+=============
+*/
+void SV_BuildVisibility (void)
+{
+	int				i;
+	const edict_t	*ent;
+	const cmodel_t	*model;
+	client_t		*cl;
+
+	//invalidates every row from previous frames
+	nc_visstamp++;
+	nc_numbrushents = 0;
+	nc_numviewers = 0;
+
+	if (!sv_nc_visibilitycheck->intvalue || sv.state != ss_game)
+		return;
+
+	for (i = 1; i < ge->num_edicts; i++)
+	{
+		ent = EDICT_NUM(i);
+
+		if (!ent->inuse || ent->solid != SOLID_BSP || !ent->area.prev)
+			continue;
+
+		model = sv.models[ent->s.modelindex];
+		if (!model)
+			continue;
+
+		nc_brushents[nc_numbrushents] = ent;
+		nc_brushheadnodes[nc_numbrushents] = model->headnode;
+		nc_numbrushents++;
+	}
+
+	//without workers the checks are done on demand in SV_BuildClientFrame
+	if (!Sys_NumWorkers ())
+		return;
+
+	for (i = 0, cl = svs.clients; i < maxclients->intvalue; i++, cl++)
+	{
+		if (cl->state != cs_spawned || cl->nodata || !cl->edict->client)
+			continue;
+
+		// same test as SV_SendClientMessages, only clients getting a frame now
+		if (sv.time % (1000 / cl->settings[CLSET_FPS]) != 0)
+			continue;
+
+		memset (nc_visible[i], NCVIS_UNKNOWN, maxclients->intvalue);
+		nc_rowstamp[i] = nc_visstamp;
+		nc_viewers[nc_numviewers++] = i;
+	}
+
+	if (nc_numviewers)
+		Sys_RunWorkers (SV_NCVisibilityRow, nc_numviewers);
+}
+
 
 /*
 =============
@@ -1323,12 +1710,15 @@ void SV_BuildClientFrame (client_t *client)
 	int						clientarea, clientcluster;
 	int						leafnum, framenum;
 	int						c_fullsend;
+	int						viewer;
 	const byte				*clientphs;
 	const byte				*bitvector;
+	byte					fatpvs[MAX_MAP_LEAFS/8];
+	byte					phsbuffer[MAX_MAP_LEAFS/8];
+	uint32					visents[MAX_EDICTS/32];
 
 	// *********** NiceAss Start ************
 	qboolean	visible;
-	vec3_t		start;
 	// ***********  NiceAss End  ************
 
 	//union player_state_t	*hax;
@@ -1359,10 +1749,8 @@ void SV_BuildClientFrame (client_t *client)
 	//	ps = (player_state_t *)&hax->old_ps;
 
 	// find the client's PVS
-	for (i=0 ; i<3 ; i++)
-	{
-			org[i] = clent->client->ps.pmove.origin[i]*0.125f + clent->client->ps.viewoffset[i];
-	}
+	SV_ViewOrigin (clent, org);
+	viewer = (int)(client - svs.clients);
 
 	leafnum = CM_PointLeafnum (org);
 	clientarea = CM_LeafArea (leafnum);
@@ -1374,8 +1762,13 @@ void SV_BuildClientFrame (client_t *client)
 	// grab the current player_state_t
 	frame->ps = clent->client->ps;
 
-	SV_FatPVS (org);
-	clientphs = CM_ClusterPHS (clientcluster);
+	SV_FatPVS (org, fatpvs);
+	clientphs = CM_ClusterPHS (clientcluster, phsbuffer);
+
+	//r1: only bother with entities touching a cluster we can see (or ourselves)
+	SV_ClusterEdicts (fatpvs, clientphs, visents);
+	e = NUM_FOR_EDICT (clent);
+	visents[e >> 5] |= 1U << (e & 31);
 
 	// build up the list of visible entities
 	frame->num_entities = 0;
@@ -1385,6 +1778,14 @@ void SV_BuildClientFrame (client_t *client)
 
 	for (e=1 ; e<ge->num_edicts ; e++)
 	{
+		if (!(visents[e >> 5] & (1U << (e & 31))))
+		{
+			//skip the rest of an empty word
+			if (!visents[e >> 5])
+				e |= 31;
+			continue;
+		}
+
 		ent = EDICT_NUM(e);
 
 		// ignore ents without visible models
@@ -1482,32 +1883,20 @@ void SV_BuildClientFrame (client_t *client)
 
 		if (visible && sv_nc_visibilitycheck->intvalue && !(sv_nc_clientsonly->intvalue && !ent->client) && ent->solid != SOLID_BSP && ent->solid != SOLID_TRIGGER)
 		{
-			// *********** NiceAss Start ************
-			FastVectorCopy (org, start);
-			visible = SV_CheckPlayerVisible (clent->client->ps.viewangles, start, ent, true, false);
-		
-			if (!visible)
+			//r1: use the answer from SV_BuildVisibility if the workers already did this pair
+			if (nc_rowstamp[viewer] == nc_visstamp && e <= maxclients->intvalue && nc_visible[viewer][e-1] != NCVIS_UNKNOWN)
 			{
-				FastVectorCopy (org, start);
-
-				// If the first direct check didn't see the player, check a little ahead
-				// of yourself based on your current velocity, lag, frame update speed (100ms). 
-				// This will compensate for clients predicting where they will be due to lag
-				// (cl_predict)
-				for (i = 0; i < 3; i++)
-					start[i] += clent->client->ps.pmove.velocity[i] * 0.125f * ( 0.15f + (float)clent->client->ping * 0.001f );
-					
-				visible = SV_CheckPlayerVisible (clent->client->ps.viewangles, start, ent, false, true);
-
-				if ( !visible )
-				{
-					FastVectorCopy (org, start);
-					// If the first/second direct check didn't see the player, check a little above
-					// of yourself based on your current velocity. This will compensate for
-					// clients predicting where they will be due to lag (cl_predict)
-					start[2] += ent->maxs[2];
-					visible = SV_CheckPlayerVisible (clent->client->ps.viewangles, start, ent, false, true);
-				}
+				visible = (nc_visible[viewer][e-1] == NCVIS_VISIBLE);
+#ifndef NPROFILE
+				svs.ncVisCached++;
+#endif
+			}
+			else
+			{
+				visible = SV_NCPlayerVisible (clent, org, ent);
+#ifndef NPROFILE
+				svs.ncVisTraced++;
+#endif
 			}
 
 			// Don't send player at all. 100% secure but no footsteps unless you see the person.
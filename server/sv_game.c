@@ -617,12 +617,13 @@ qboolean EXPORT  PF_inPVS (vec3_t p1, vec3_t p2)
 	int		leafnum;
 	int		cluster;
 	int		area1, area2;
-	byte	*mask;
+	byte	buffer[MAX_MAP_LEAFS/8];
+	const byte	*mask;
 
 	leafnum = CM_PointLeafnum (p1);
 	cluster = CM_LeafCluster (leafnum);
 	area1 = CM_LeafArea (leafnum);
-	mask = CM_ClusterPVS (cluster);
+	mask = CM_ClusterPVS (cluster, buffer);
 
 	leafnum = CM_PointLeafnum (p2);
 	cluster = CM_LeafCluster (leafnum);
@@ -647,12 +648,13 @@ qboolean EXPORT PF_inPHS (vec3_t p1, vec3_t p2)
 	int		leafnum;
 	int		cluster;
 	int		area1, area2;
-	byte	*mask;
+	byte	buffer[MAX_MAP_LEAFS/8];
+	const byte	*mask;
 
 	leafnum = CM_PointLeafnum (p1);
 	cluster = CM_LeafCluster (leafnum);
 	area1 = CM_LeafArea (leafnum);
-	mask = CM_ClusterPHS (cluster);
+	mask = CM_ClusterPHS (cluster, buffer);
 
 	leafnum = CM_PointLeafnum (p2);
 	cluster = CM_LeafCluster (leafnum);
@@ -859,6 +861,15 @@ void EXPORT SCR_DebugGraph (float value, int color)
 }
 #endif
 
+//r1: lets the game spread read-only work over the server's worker threads
+static void EXPORT PF_RunWorkers (void (*func)(int job), int numjobs)
+{
+	if (!func || numjobs <= 0)
+		return;
+
+	Sys_RunWorkers (func, numjobs);
+}
+
 void SV_InitGameProgs (void)
 {
 	edict_t			*ent;
@@ -920,6 +931,9 @@ void SV_InitGameProgs (void)
 	import.AddCommandString = Cbuf_AddText;
 
 	import.DebugGraph = SCR_DebugGraph;
+	import.RadiusEdicts = SV_RadiusEdicts;
+	import.RunWorkers = PF_RunWorkers;
+	import.TraceThreadSafe = SV_TraceThreadSafe;
 	import.SetAreaPortalState = CM_SetAreaPortalState;
 	import.AreasConnected = CM_AreasConnected;
 
@@ -954,11 +968,17 @@ void SV_InitGameProgs (void)
 	if (g_features->intvalue)
 	{
 		svs.game_features = g_features->intvalue;
-		Com_Printf ("Extended game features enabled:%s%s%s%s\n", LOG_SERVER,
+
+		//r1: don't trust the bit without the exports
+		if ((svs.game_features & GMF_MEMLEVELS) && (!ge->WriteLevelBuffer || !ge->ReadLevelBuffer))
+			svs.game_features &= ~GMF_MEMLEVELS;
+
+		Com_Printf ("Extended game features enabled:%s%s%s%s%s\n", LOG_SERVER,
 			svs.game_features & GMF_CLIENTNUM ? " GMF_CLIENTNUM" : "", 
 			svs.game_features & GMF_WANT_ALL_DISCONNECTS ? " GMF_WANT_ALL_DISCONNECTS" : "", 
 			svs.game_features & GMF_PROPERINUSE ? " GMF_PROPERINUSE" : "", 
-			svs.game_features & GMF_MVDSPEC ? " GMF_MVDSPEC" : "");
+			svs.game_features & GMF_MVDSPEC ? " GMF_MVDSPEC" : "",
+			svs.game_features & GMF_MEMLEVELS ? " GMF_MEMLEVELS" : "");
 	}
 	else
 		svs.game_features = 0;
@@ -140,8 +140,6 @@ SV_CheckForSavegame
 */
 static void SV_CheckForSavegame (void)
 {
-	char		name[MAX_OSPATH];
-	FILE		*f;
 	int			i;
 
 	if (sv_noreload->intvalue)
@@ -150,13 +148,9 @@ static void SV_CheckForSavegame (void)
 	if (Cvar_IntValue ("deathmatch"))
 		return;
 
-	Com_sprintf (name, sizeof(name), "%s/save/current/%s.sav", FS_Gamedir(), sv.name);
-	f = fopen (name, "rb");
-	if (!f)
+	if (!SV_LevelSaved ())
 		return;		// no savegame
 
-	fclose (f);
-
 	SV_ClearWorld ();
 
 	// get configstrings and areaportals
@@ -365,14 +359,16 @@ static void SV_SpawnServer (const char *server, const char *spawnpoint, server_s
 	sv.state = serverstate;
 	Com_SetServerState (sv.state);
 	
-	// create a baseline for more efficient communications
-
-	//r1: baslines are now allocated on a per client basis
-	//SV_CreateBaseline ();
-
 	// check for a savegame
 	SV_CheckForSavegame ();
 
+	// create a baseline for more efficient communications
+
+	//r1: baslines are now allocated on a per client basis, on top of a
+	//shared set taken here. this must come after the savegame is read and
+	//settled or it describes a world that no longer exists.
+	SV_CreateSharedBaseline ();
+
 	// set serverinfo variable
 	Cvar_FullSet ("mapname", sv.name, CVAR_SERVERINFO | CVAR_NOSET);
 
@@ -94,6 +94,7 @@ cvar_t	*sv_connectmessage;
 
 //r1: for nocheat mods
 cvar_t  *sv_nc_visibilitycheck;
+cvar_t	*sv_areanode_size;
 cvar_t	*sv_nc_clientsonly;
 
 //r1: max backup packets to allow from client
@@ -146,6 +147,7 @@ cvar_t	*sv_validate_playerskins;
 
 cvar_t	*sv_idlekick;
 cvar_t	*sv_packetentities_hack;
+cvar_t	*sv_zlib_level;
 cvar_t	*sv_entity_inuse_hack;
 
 cvar_t	*sv_force_reconnect;
@@ -171,6 +173,8 @@ cvar_t	*sv_format_string_hack;
 cvar_t	*sv_lag_stats;
 cvar_t	*sv_func_plat_hack;
 cvar_t	*sv_max_packetdup;
+cvar_t	*sv_threads;
+cvar_t	*sv_delta_cache;
 cvar_t	*sv_redirect_address;
 cvar_t	*sv_fps;
 
@@ -217,8 +221,8 @@ cvar_t	*sv_anticheat_disable_play;
 cvar_t	*sv_anticheat_client_restrictions;
 cvar_t	*sv_anticheat_force_protocol35;
 
-netblock_t	anticheat_exceptions;
-netblock_t	anticheat_requirements;
+netblocklist_t	anticheat_exceptions = {{0}, NULL, NULL, TAGMALLOC_ANTICHEAT};
+netblocklist_t	anticheat_requirements = {{0}, NULL, NULL, TAGMALLOC_ANTICHEAT};
 #endif
 
 //r1: not needed
@@ -227,6 +231,7 @@ netblock_t	anticheat_requirements;
 time_t	server_start_time;
 
 blackhole_t			blackholes;
+netnode_t			*blackhole_trie;
 varban_t			cvarbans;
 varban_t			userinfobans;
 bannedcommands_t	bannedcommands;
@@ -235,7 +240,7 @@ linkednamelist_t	lrconcmds;
 linkedvaluelist_t	serveraliases;
 
 //i hate you snake
-netblock_t			blackhole_exceptions;
+netblocklist_t		blackhole_exceptions = {{0}, NULL, NULL, TAGMALLOC_BLACKHOLE};
 
 unsigned			cheaternet_token;
 netadr_t			cheaternet_adr;
@@ -310,13 +315,7 @@ void SV_DropClient (client_t *drop, qboolean notify)
 	else
 	{
 		//they did something naughty so they won't be seeing anything else from us...
-		if (drop->messageListData)
-		{
-			SV_ClearMessageList (drop);
-			Z_Free (drop->messageListData);
-		}
-
-		drop->messageListData = drop->msgListEnd = drop->msgListStart = NULL;
+		SV_FreeMessageQueue (drop);
 	}
 
 	if ((svs.game_features & GMF_WANT_ALL_DISCONNECTS) || drop->state == cs_spawned)
@@ -354,15 +353,8 @@ void SV_CleanClient (client_t *drop)
 	linkednamelist_t	*bad, *last;
 #endif
 
-	//r1: drop message list
-	if (drop->messageListData)
-	{
-		SV_ClearMessageList (drop);
-		Z_Free (drop->messageListData);
-	}
-
-	//shouldn't be necessary, but...
-	drop->messageListData = drop->msgListEnd = drop->msgListStart = NULL;
+	//r1: drop message queue
+	SV_FreeMessageQueue (drop);
 
 	//r1: free version string
 	if (drop->versionString)
@@ -379,6 +371,8 @@ void SV_CleanClient (client_t *drop)
 	}
 
 	//r1: download data
+	SV_ReleaseDownloadCache (drop);
+
 	if (drop->download)
 	{
 		FS_FreeFile (drop->download);
@@ -386,11 +380,7 @@ void SV_CleanClient (client_t *drop)
 	}
 
 	//r1: free baselines
-	if (drop->lastlines)
-	{
-		Z_Free (drop->lastlines);
-		drop->lastlines = NULL;
-	}
+	SV_FreeBaseline (drop);
 
 	//r1: disconnected before cheatnet message could show?
 	if (drop->cheaternet_message)
@@ -1580,7 +1570,7 @@ gotnewcl:
 	
 	sv_client = newcl;
 
-	if (newcl->messageListData || newcl->versionString || newcl->downloadFileName || newcl->download || newcl->lastlines)
+	if (newcl->messages || newcl->versionString || newcl->downloadFileName || newcl->download || newcl->lastlines)
 	{
 		Com_Printf ("WARNING: Client %d never got cleaned up, possible memory leak.\n", LOG_SERVER|LOG_WARNING, (int)(newcl - svs.clients));
 		SV_CleanClient (newcl);
@@ -1653,39 +1643,22 @@ gotnewcl:
 	if (sv_require_anticheat->intvalue && reconnected && SV_AntiCheat_IsConnected())
 	{
 		uint32		network_ip;
-		netblock_t	*n;
 
 		ac = " ac=1";
 
 		network_ip = *(uint32 *)net_from.ip;
 
-		n = &anticheat_requirements;
-
 		newcl->anticheat_required = ANTICHEAT_NORMAL;
 
 		//r1: forced list
-		while (n->next)
-		{
-			n = n->next;
-			if ((network_ip & n->mask) == (n->ip & n->mask))
-			{
-				newcl->anticheat_required = ANTICHEAT_REQUIRED;
-				break;
-			}
-		}
-
-		n = &anticheat_exceptions;
+		if (NetBlock_Match (&anticheat_requirements, network_ip))
+			newcl->anticheat_required = ANTICHEAT_REQUIRED;
 
 		//r1: exception list
-		while (n->next)
+		if (NetBlock_Match (&anticheat_exceptions, network_ip))
 		{
-			n = n->next;
-			if ((network_ip & n->mask) == (n->ip & n->mask))
-			{
-				newcl->anticheat_required = ANTICHEAT_EXEMPT;
-				ac = "";
-				break;
-			}
+			newcl->anticheat_required = ANTICHEAT_EXEMPT;
+			ac = "";
 		}
 
 		if (ac[0])
@@ -1727,16 +1700,10 @@ gotnewcl:
 	newcl->protocol = protocol;
 	newcl->state = cs_connected;
 
-	newcl->messageListData = Z_TagMalloc (sizeof(messagelist_t) * MAX_MESSAGES_PER_LIST, TAGMALLOC_CL_MESSAGES);
-	memset (newcl->messageListData, 0, sizeof(messagelist_t) * MAX_MESSAGES_PER_LIST);
+	newcl->messages = SV_AllocMessageQueue ();
 
-	newcl->msgListEnd = newcl->msgListStart = newcl->messageListData;
-	newcl->msgListStart->data = NULL;
-
-	newcl->lastlines = Z_TagMalloc (sizeof(entity_state_t) * MAX_EDICTS, TAGMALLOC_CL_BASELINES);
-	//memset (newcl->lastlines, 0, sizeof(entity_state_t) * MAX_EDICTS);
-
-	//r1: per client baselines are now used
+	//r1: per client baselines are now used, allocated in SV_New_f once they
+	//are known to differ from sv.baselines
 	//SV_CreateBaseline (newcl);
 	
 	//r1: concept of datagram buffer no longer exists
@@ -1767,15 +1734,159 @@ uint32 CalcMask (int32 bits)
 	return 0xFFFFFFFF << (32 - bits);
 }
 
-void Blackhole (netadr_t *from, qboolean isAutomatic, int mask, int method, const char *fmt, ...)
+/*
+=================
+Netblock tries
+=================
+*/
+void NetTrie_Insert (netnode_t **root, uint32 network_ip, uint32 network_mask, void *value, int tag)
 {
-	blackhole_t *temp;
-	va_list		argptr;
+	netnode_t	**node;
+	uint32		ip, mask, bit;
 
-	if (isAutomatic && !sv_blackholes->intvalue)
+	ip = NET_ntohl (network_ip);
+	mask = NET_ntohl (network_mask);
+
+	node = root;
+
+	for (bit = 0x80000000; ; bit >>= 1)
+	{
+		if (!*node)
+		{
+			*node = Z_TagMalloc (sizeof(netnode_t), tag);
+			memset (*node, 0, sizeof(netnode_t));
+		}
+
+		//end of the prefix
+		if (!bit || !(mask & bit))
+			break;
+
+		node = &(*node)->child[(ip & bit) ? 1 : 0];
+	}
+
+	if (!(*node)->value)
+		(*node)->value = value;
+}
+
+void *NetTrie_Match (const netnode_t *node, uint32 network_ip)
+{
+	void		*best;
+	uint32		ip, bit;
+
+	ip = NET_ntohl (network_ip);
+	best = NULL;
+
+	for (bit = 0x80000000; node; bit >>= 1)
+	{
+		if (node->value)
+			best = node->value;
+
+		if (!bit)
+			break;
+
+		node = node->child[(ip & bit) ? 1 : 0];
+	}
+
+	return best;
+}
+
+void NetTrie_Free (netnode_t **root)
+{
+	if (!*root)
 		return;
 
-	temp = &blackholes;
+	NetTrie_Free (&(*root)->child[0]);
+	NetTrie_Free (&(*root)->child[1]);
+
+	Z_Free (*root);
+	*root = NULL;
+}
+
+//removing from a trie is fiddly and rare, so the whole thing is rebuilt
+static void NetBlock_RebuildTrie (netblocklist_t *list)
+{
+	netblock_t	*n;
+
+	NetTrie_Free (&list->trie);
+
+	for (n = list->list.next; n; n = n->next)
+		NetTrie_Insert (&list->trie, n->ip, n->mask, n, list->tag);
+}
+
+netblock_t *NetBlock_Add (netblocklist_t *list, uint32 network_ip, uint32 network_mask)
+{
+	netblock_t	*n;
+
+	n = list->tail ? list->tail : &list->list;
+	while (n->next)
+		n = n->next;
+
+	n->next = Z_TagMalloc (sizeof(*n), list->tag);
+	n = n->next;
+
+	n->ip = network_ip;
+	n->mask = network_mask;
+	n->next = NULL;
+
+	NetTrie_Insert (&list->trie, n->ip, n->mask, n, list->tag);
+
+	list->tail = n;
+
+	return n;
+}
+
+qboolean NetBlock_Remove (netblocklist_t *list, uint32 network_ip, uint32 network_mask)
+{
+	netblock_t	*n, *last;
+
+	n = last = &list->list;
+
+	while (n->next)
+	{
+		last = n;
+		n = n->next;
+
+		if (n->ip == network_ip && n->mask == network_mask)
+		{
+			last->next = n->next;
+			Z_Free (n);
+			list->tail = NULL;
+			NetBlock_RebuildTrie (list);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+qboolean NetBlock_Match (const netblocklist_t *list, uint32 network_ip)
+{
+	return NetTrie_Match (list->trie, network_ip) != NULL;
+}
+
+blackhole_t *Blackhole_Match (uint32 network_ip)
+{
+	return (blackhole_t *)NetTrie_Match (blackhole_trie, network_ip);
+}
+
+void Blackhole_RebuildTrie (void)
+{
+	blackhole_t	*b;
+
+	NetTrie_Free (&blackhole_trie);
+
+	for (b = blackholes.next; b; b = b->next)
+		NetTrie_Insert (&blackhole_trie, b->ip, b->mask, b, TAGMALLOC_BLACKHOLE);
+}
+
+//r1: end of the blackhole list so bulk loads aren't quadratic, NULL if unknown
+static blackhole_t	*blackholes_tail;
+
+blackhole_t *AddBlackhole (uint32 network_ip, uint32 network_mask, int method, const char *reason)
+{
+	blackhole_t *temp;
+
+	temp = blackholes_tail ? blackholes_tail : &blackholes;
 
 	while (temp->next)
 		temp = temp->next;
@@ -1785,18 +1896,40 @@ void Blackhole (netadr_t *from, qboolean isAutomatic, int mask, int method, cons
 
 	temp->next = NULL;
 
-	temp->ip = *(uint32 *)from->ip;
-	temp->mask = NET_htonl (CalcMask(mask));
+	temp->ip = network_ip;
+	temp->mask = network_mask;
 	temp->method = method;
 
 	temp->ratelimit.period = 1000;
+	temp->ratelimit.count = 0;
+	temp->ratelimit.time = 0;
+
+	Q_strncpy (temp->reason, reason, sizeof(temp->reason)-1);
+
+	NetTrie_Insert (&blackhole_trie, temp->ip, temp->mask, temp, TAGMALLOC_BLACKHOLE);
+
+	blackholes_tail = temp;
+
+	return temp;
+}
+
+void Blackhole (netadr_t *from, qboolean isAutomatic, int mask, int method, const char *fmt, ...)
+{
+	blackhole_t *temp;
+	va_list		argptr;
+	char		reason[128];
+
+	if (isAutomatic && !sv_blackholes->intvalue)
+		return;
 
 	va_start (argptr,fmt);
-	vsnprintf (temp->reason, sizeof(temp->reason)-1, fmt, argptr);
+	vsnprintf (reason, sizeof(reason)-1, fmt, argptr);
 	va_end (argptr);
 
 	//terminate
-	temp->reason[sizeof(temp->reason)-1] = 0;
+	reason[sizeof(reason)-1] = 0;
+
+	temp = AddBlackhole (*(uint32 *)from->ip, NET_htonl (CalcMask(mask)), method, reason);
 
 	if (sv.state)
 		Com_Printf ("Added %s/%d to blackholes for %s.\n", LOG_SERVER|LOG_EXPLOIT, NET_inet_ntoa (temp->ip), mask, temp->reason);
@@ -1830,6 +1963,9 @@ qboolean UnBlackhole (int index)
 
 	Z_Free (temp);
 
+	blackholes_tail = NULL;
+	Blackhole_RebuildTrie ();
+
 	return true;
 }
 
@@ -2045,46 +2181,25 @@ connectionless packets.
 */
 static void SV_ConnectionlessPacket (void)
 {
-	netblock_t	*whitehole = &blackhole_exceptions;
-	blackhole_t *blackhole = &blackholes;
+	blackhole_t *blackhole;
 	char		*s;
 	char		*c;
-	qboolean	whiteholed;
 	uint32		network_ip;
 
 	network_ip = *(uint32 *)net_from.ip;
 
-	whiteholed = false;
-
-	//r1: whiteholes (thanks WORM!)
-	while (whitehole->next)
-	{
-		whitehole = whitehole->next;
-		if ((network_ip & whitehole->mask) == (whitehole->ip & whitehole->mask))
-		{
-			whiteholed = true;
-			break;
-		}
-	}
-
-	//r1: ignore packets if IP is blackholed for abuse
-	if (!whiteholed)
+	//r1: ignore packets if IP is blackholed for abuse, unless whiteholed (thanks WORM!)
+	blackhole = Blackhole_Match (network_ip);
+	if (blackhole && !NetBlock_Match (&blackhole_exceptions, network_ip))
 	{
-		while (blackhole->next)
+		//do rate limiting in case there is some long-ish reason
+		if (blackhole->method == BLACKHOLE_MESSAGE)
 		{
-			blackhole = blackhole->next;
-			if ((network_ip & blackhole->mask) == (blackhole->ip & blackhole->mask))
-			{
-				//do rate limiting in case there is some long-ish reason
-				if (blackhole->method == BLACKHOLE_MESSAGE)
-				{
-					RateSample (&blackhole->ratelimit);
-					if (!RateLimited (&blackhole->ratelimit, 2))
-						Netchan_OutOfBandPrint (NS_SERVER, &net_from, "print\n%s\n", blackhole->reason);
-				}
-				return;
-			}
+			RateSample (&blackhole->ratelimit);
+			if (!RateLimited (&blackhole->ratelimit, 2))
+				Netchan_OutOfBandPrint (NS_SERVER, &net_from, "print\n%s\n", blackhole->reason);
 		}
+		return;
 	}
 
 	//r1: should never happen, don't even bother trying to parse it
@@ -2588,7 +2703,7 @@ static void SV_ReadPackets (void)
 					cl->packetCount++;
 
 					//r1: send a reply immediately if the client is connecting
-					if ((cl->state == cs_connected || cl->state == cs_spawning) && cl->msgListStart->next)
+					if ((cl->state == cs_connected || cl->state == cs_spawning) && SV_MessagesPending (cl))
 					{
 						SV_WriteReliableMessages (cl, cl->netchan.message.buffsize);
 						Netchan_Transmit (&cl->netchan, 0, NULL);
@@ -2761,6 +2876,9 @@ static void SV_RunGameFrame (void)
 
 	sv_tracecount = 0;
 
+	//r1: catch anything that moved clients without relinking them
+	SV_InvalidateMulticastIndex ();
+
 	// don't run if paused
 	if (!sv_paused->intvalue || maxclients->intvalue > 1)
 	{
@@ -3194,6 +3312,22 @@ static void _password_changed (cvar_t *var, char *oldvalue, char *newvalue)
 		Cvar_FullSet ("needpass", "1", CVAR_SERVERINFO);
 }
 
+static void _threads_changed (cvar_t *var, char *oldvalue, char *newvalue)
+{
+	if (var->intvalue < 0)
+	{
+		Cvar_Set (var->name, "0");
+		return;
+	}
+	else if (var->intvalue > MAX_WORKER_THREADS)
+	{
+		Cvar_SetValue (var->name, MAX_WORKER_THREADS);
+		return;
+	}
+
+	Sys_InitWorkers (var->intvalue);
+}
+
 static void _rcon_buffsize_changed (cvar_t *var, char *oldvalue, char *newvalue)
 {
 	if (var->intvalue > SV_OUTPUTBUF_LENGTH)
@@ -3206,6 +3340,14 @@ static void _rcon_buffsize_changed (cvar_t *var, char *oldvalue, char *newvalue)
 	}
 }
 
+static void _zlib_level_changed (cvar_t *var, char *oldvalue, char *newvalue)
+{
+	if (var->intvalue > Z_BEST_COMPRESSION)
+		Cvar_SetValue (var->name, Z_BEST_COMPRESSION);
+	else if (var->intvalue < Z_BEST_SPEED)
+		Cvar_SetValue (var->name, Z_BEST_SPEED);
+}
+
 #ifdef ANTICHEAT
 
 static void _expand_cvar_newlines (cvar_t *var, char *o, char *n)
@@ -3347,6 +3489,9 @@ void SV_Init (void)
 	sv_nc_visibilitycheck = Cvar_Get ("sv_nc_visibilitycheck", "0", 0);
 	sv_nc_visibilitycheck->help = "Attempt to calculate player visibility server-side to thwart wall-hacks and other cheats. CPU intensive. Default 0.\n";
 
+	sv_areanode_size = Cvar_Get ("sv_areanode_size", "1024", 0);
+	sv_areanode_size->help = "Size in world units at which the area node tree used for traces and entity searches stops subdividing. Smaller values make a deeper tree, useful for big maps with many entities. Takes effect on the next map. Default 1024.\n";
+
 	sv_nc_clientsonly = Cvar_Get ("sv_nc_clientsonly", "1", 0);
 	sv_nc_clientsonly->help = "Only apply sv_nc_visibilitycheck checking to other players. Default 1.\n";
 
@@ -3358,6 +3503,10 @@ void SV_Init (void)
 	sv_max_download_size = Cvar_Get ("sv_max_download_size", "8388608", 0);
 	sv_max_download_size->help = "Maximum file size in bytes that a client may attempt to auto download. Default 8388608 (8MB).\n";
 
+	//r1: memory for precompressed zlib download chunks (kb)
+	sv_download_cache = Cvar_Get ("sv_download_cache", "32768", 0);
+	sv_download_cache->help = "Memory in KB used to keep compressed download chunks so files fetched by several clients (eg a new map) are only compressed once. Default 32768.\n0: Disabled\n";
+
 	//r1: max backup packets to allow from lagged clients (id.default=20)
 	sv_max_netdrop = Cvar_Get ("sv_max_netdrop", "20", 0);
 	sv_max_netdrop->help = "Maximum number of movements to replay from lagged clients. Lower this to limit 'warping' effects. Default 20.\n";
@@ -3471,6 +3620,11 @@ void SV_Init (void)
 	sv_packetentities_hack = Cvar_Get ("sv_packetentities_hack", "0", 0);
 	sv_packetentities_hack->help = "Help to avoid SZ_Getspace: overflow and 'freezing' effects on the client by only sending partial amounts of packetentities. This will break delta state and may cause odd effects on the client. Default 0.\n0: Disabled\n1: Enabled, single pass (no attempt at compressing for protocol 35)\n2: Enabled, two pass (attempts to compress for protocol 35 clients)\n";
 
+	//r1: zlib level for svc_frame zpackets, these are made every frame so speed matters
+	sv_zlib_level = Cvar_Get ("sv_zlib_level", "6", 0);
+	sv_zlib_level->changed = _zlib_level_changed;
+	sv_zlib_level->help = "Compression level (1-9) used for oversized frames sent to protocol 35 clients. Lower values use less CPU but may not shrink the frame enough to fit in a packet. Default 6.\n";
+
 	//r1: don't send ents that are marked !inuse?
 	sv_entity_inuse_hack = Cvar_Get ("sv_entity_inuse_hack", "0", 0);
 	sv_entity_inuse_hack->help = "Save network bandwidth by not sending entities that are marked as no longer in use. This only applies to buggy mods that do not mark entities as unused when they are no longer in use. Note that some mods may have problems with this if set to 1. Default 0.\n";
@@ -3540,6 +3694,14 @@ void SV_Init (void)
 	sv_redirect_address = Cvar_Get ("sv_redirect_address", "", 0);
 	sv_redirect_address->help = "Address to redirect clients to if the server is full. Can be a hostname or IP. Default empty.\n";
 
+	sv_threads = Cvar_Get ("sv_threads", "0", 0);
+	sv_threads->changed = _threads_changed;
+	sv_threads->changed (sv_threads, sv_threads->string, sv_threads->string);
+	sv_threads->help = "Number of worker threads used to encode client frames in parallel. Useful on servers with many clients and multiple cores. Default 0.\n0: Disabled, encode on the main thread\n";
+
+	sv_delta_cache = Cvar_Get ("sv_delta_cache", "1", 0);
+	sv_delta_cache->help = "Share encoded entity deltas between clients that delta from the same states in a frame, so each distinct update is only encoded once. Default 1.\n";
+
 	sv_fps = Cvar_Get ("sv_fps", "10", CVAR_LATCH);
 	sv_fps->help = "FPS to run server at. Do not touch unless you know what you're doing. Default 10.\n";
 
@@ -3579,7 +3741,7 @@ void SV_Init (void)
 	sv_timescale_skew_kick = Cvar_Get ("sv_timescale_skew_kick", "0", 0);
 	sv_timescale_skew_kick->help = "Kick clients that exhibit sudden time skew exeeding this many milliseconds. Default 0.\n";
 
-	sv_features = Cvar_Get ("sv_features", va("%d", GMF_CLIENTNUM | GMF_WANT_ALL_DISCONNECTS | GMF_PROPERINUSE), CVAR_NOSET);
+	sv_features = Cvar_Get ("sv_features", va("%d", GMF_CLIENTNUM | GMF_WANT_ALL_DISCONNECTS | GMF_PROPERINUSE | GMF_RADIUSEDICTS | GMF_RUNWORKERS), CVAR_NOSET);
 	sv_features->help = "Read-only bitmask of extended server features for the Game DLL. Do not modify.\n";
 
 	g_features = Cvar_Get ("g_features", "0", CVAR_NOSET);
@@ -3720,6 +3882,9 @@ before Sys_Quit or Sys_Error
 */
 void SV_Shutdown (char *finalmsg, qboolean reconnect, qboolean crashing)
 {
+	SV_FinishSaveCopy ();
+	SV_FlushLevelBuffers ();
+
 	if (svs.clients)
 		SV_FinalMessage (finalmsg, reconnect);
 
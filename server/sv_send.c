@@ -59,21 +59,6 @@ EVENT MESSAGES
 =============================================================================
 */
 
-static void SV_MSGListIntegrityCheck (client_t *cl)
-{
-#ifndef NDEBUG
-	messagelist_t	*msg;
-
-	msg = cl->msgListStart;
-
-	while (msg->next)
-		msg = msg->next;
-
-	if (msg != cl->msgListEnd)
-		Com_Error (ERR_FATAL, "SV_MSGListIntegrityCheck: messagelist_t corrupted!");
-#endif
-}
-
 /*
 =================
 SV_ClientPrintf
@@ -104,6 +89,8 @@ void SV_ClientPrintf (client_t *cl, int level, const char *fmt, ...)
 	SV_AddMessage (cl, true);
 }
 
+static void SV_AddMessageSingle (client_t *cl, qboolean reliable, msgpayload_t *payload);
+
 /*
 =================
 SV_BroadcastPrintf
@@ -115,9 +102,10 @@ void EXPORT SV_BroadcastPrintf (int level, const char *fmt, ...)
 {
 	va_list		argptr;
 	char		string[MAX_USABLEMSG-3];
-	client_t	*cl;
+	client_t	*cl, *first;
 	int			i;
 	int			msglen;
+	msgpayload_t	*payload;
 
 	va_start (argptr,fmt);
 	msglen = Q_vsnprintf (string, sizeof(string)-1, fmt,argptr);
@@ -137,6 +125,10 @@ void EXPORT SV_BroadcastPrintf (int level, const char *fmt, ...)
 			Com_Printf ("%s", LOG_SERVER, string);
 	}
 
+	//r1: build the message once instead of per client, see SV_Multicast
+	first = NULL;
+	payload = NULL;
+
 	for (i=0, cl = svs.clients ; i<maxclients->intvalue; i++, cl++)
 	{
 		if (level < cl->messagelevel)
@@ -145,54 +137,260 @@ void EXPORT SV_BroadcastPrintf (int level, const char *fmt, ...)
 		if (cl->state != cs_spawned)
 			continue;
 
-		MSG_BeginWriting (svc_print);
-		MSG_WriteByte (level);
-		MSG_WriteString (string);
-		SV_AddMessage (cl, true);
+		if (!first)
+		{
+			MSG_BeginWriting (svc_print);
+			MSG_WriteByte (level);
+			MSG_WriteString (string);
+			first = cl;
+			continue;
+		}
+
+		if (!payload)
+		{
+			payload = MSG_CreatePayload ();
+			SV_AddMessageSingle (first, true, payload);
+		}
+
+		SV_AddMessageSingle (cl, true, payload);
 	}
+
+	if (first)
+	{
+		if (payload)
+			MSG_ReleasePayload (payload);
+		else
+			SV_AddMessageSingle (first, true, NULL);
+		MSG_FreeData ();
+	}
+}
+
+/*
+=================
+Message queue
+
+r1: see msgqueue_t. every record in the reliable ring is MSGRING_ALIGN bytes of
+header followed by the inline data rounded up to MSGRING_ALIGN. records never
+wrap, a zero length record pads out the end of the ring instead.
+=================
+*/
+#define	MSGRING_RECORD(q,pos)	((msgrecord_t *)((q)->ring + ((pos) & ((q)->ringsize - 1))))
+#define	MSGRING_DATA(r)			((r)->payload ? (r)->payload->data : (byte *)(r) + MSGRING_ALIGN)
+
+static int SV_RecordLength (int cursize, qboolean inline_data)
+{
+	if (!inline_data)
+		return MSGRING_ALIGN;
+
+	return MSGRING_ALIGN + ((cursize + MSGRING_ALIGN - 1) & ~(MSGRING_ALIGN - 1));
 }
 
-static messagelist_t * SV_DeleteMessage (client_t *cl, messagelist_t *message, messagelist_t *last)
+msgqueue_t *SV_AllocMessageQueue (void)
 {
-	//only free if it was malloced
-	if (message->cursize > MSG_MAX_SIZE_BEFORE_MALLOC)
-		free (message->data);
+	msgqueue_t	*q;
 
-	last->next = message->next;
-	
-	//end of the list
-	if (message == cl->msgListEnd)
-		cl->msgListEnd = last;
+	q = Z_TagMalloc (sizeof(*q), TAGMALLOC_CL_MESSAGES);
+	memset (q, 0, sizeof(*q));
 
-#ifdef _DEBUG
-	memset (message, 0xCC, sizeof(*message));
-#endif
+	q->ringsize = MSGRING_MINSIZE;
+	q->ring = Z_TagMalloc (q->ringsize, TAGMALLOC_CL_MESSAGES);
 
-	return last;
+	return q;
 }
 
-void SV_ClearMessageList (client_t *client)
+void SV_FreeMessageQueue (client_t *client)
+{
+	if (!client->messages)
+		return;
+
+	SV_ClearMessageList (client);
+
+	Z_Free (client->messages->ring);
+	Z_Free (client->messages);
+	client->messages = NULL;
+}
+
+qboolean SV_MessagesPending (const client_t *client)
+{
+	return client->messages && (client->messages->numreliable || client->messages->numunreliable);
+}
+
+//oldest reliable message, NULL if there are none
+static msgrecord_t *SV_FirstReliable (const msgqueue_t *q)
+{
+	msgrecord_t	*rec;
+
+	if (!q->numreliable)
+		return NULL;
+
+	rec = MSGRING_RECORD (q, q->head);
+
+	//padding at the end of the ring, real record is at the start
+	if (!rec->cursize)
+		rec = (msgrecord_t *)q->ring;
+
+	return rec;
+}
+
+static void SV_PopReliable (msgqueue_t *q)
+{
+	msgrecord_t	*rec;
+
+	rec = MSGRING_RECORD (q, q->head);
+	if (!rec->cursize)
+	{
+		q->head += q->ringsize - (q->head & (q->ringsize - 1));
+		rec = MSGRING_RECORD (q, q->head);
+	}
+
+	if (rec->payload)
+		MSG_ReleasePayload (rec->payload);
+
+	q->head += SV_RecordLength (rec->cursize, !rec->payload);
+	q->numreliable--;
+
+	//empty, start again from the beginning to keep things contiguous
+	if (!q->numreliable)
+		q->head = q->tail = 0;
+}
+
+//doubles the ring, copying the pending records to the start of the new one
+static qboolean SV_GrowRing (msgqueue_t *q)
 {
-	messagelist_t *message, *last;
+	byte		*ring;
+	int			len, i;
+	uint32		pos, out;
+	msgrecord_t	*rec;
+
+	if (q->ringsize >= MSGRING_MAXSIZE)
+		return false;
+
+	ring = Z_TagMalloc (q->ringsize * 2, TAGMALLOC_CL_MESSAGES);
 
-	message = client->msgListStart;
+	pos = q->head;
+	out = 0;
+
+	for (i = 0; i < q->numreliable; i++)
+	{
+		rec = MSGRING_RECORD (q, pos);
+		if (!rec->cursize)
+		{
+			pos += q->ringsize - (pos & (q->ringsize - 1));
+			rec = MSGRING_RECORD (q, pos);
+		}
+
+		len = SV_RecordLength (rec->cursize, !rec->payload);
+		memcpy (ring + out, rec, len);
+		pos += len;
+		out += len;
+	}
+
+	Z_Free (q->ring);
+
+	q->ring = ring;
+	q->ringsize *= 2;
+	q->head = 0;
+	q->tail = out;
+
+	return true;
+}
+
+//reserves a record at the tail of the ring, NULL if the client overflowed
+static msgrecord_t *SV_AllocReliable (msgqueue_t *q, int len)
+{
+	msgrecord_t	*rec;
+	int			contig;
 
 	for (;;)
 	{
-		last = message;
-		message = message->next;
+		contig = q->ringsize - (q->tail & (q->ringsize - 1));
 
-		if (!message)
+		//room at the end, or room at the start after padding the end
+		if (len <= contig)
+		{
+			if (q->ringsize - (int)(q->tail - q->head) >= len)
+				break;
+		}
+		else if (q->ringsize - (int)(q->tail - q->head) >= contig + len)
+		{
+			rec = MSGRING_RECORD (q, q->tail);
+			rec->payload = NULL;
+			rec->cursize = 0;
+			q->tail += contig;
 			break;
+		}
 
-		message = SV_DeleteMessage (client, message, last);
+		if (!SV_GrowRing (q))
+			return NULL;
 	}
+
+	rec = MSGRING_RECORD (q, q->tail);
+	q->tail += len;
+	q->numreliable++;
+
+	return rec;
+}
+
+static void SV_ClearUnreliable (msgqueue_t *q)
+{
+	int		i;
+
+	for (i = 0; i < q->numunreliable; i++)
+	{
+		if (q->unreliable[i].payload)
+			MSG_ReleasePayload (q->unreliable[i].payload);
+	}
+
+	q->numunreliable = 0;
+	q->unreliablesize = 0;
 }
 
-static void SV_AddMessageSingle (client_t *cl, qboolean reliable)
+static byte *SV_UnreliableData (msgqueue_t *q, const msgindex_t *index)
 {
-	int				index;
-	messagelist_t	*next;
+	return index->payload ? index->payload->data : q->unreliable_buf + index->offset;
+}
+
+static msgpriority_t SV_MessagePriority (const byte *data)
+{
+	if (data[0] == svc_temp_entity)
+	{
+		//trivial ones go in with everything else
+		if (data[1] == TE_BLOOD || data[1] == TE_SPLASH)
+			return MSGPRI_OTHER;
+
+		//semi-useless repeated effects
+		if (data[1] == TE_GUNSHOT || data[1] == TE_BULLET_SPARKS || data[1] == TE_SHOTGUN)
+			return MSGPRI_TEMPENT_RANDOM;
+
+		return MSGPRI_TEMPENT;
+	}
+
+	if (data[0] == svc_sound)
+		return MSGPRI_SOUND;
+
+	return MSGPRI_OTHER;
+}
+
+void SV_ClearMessageList (client_t *client)
+{
+	msgqueue_t	*q;
+
+	q = client->messages;
+
+	while (q->numreliable)
+		SV_PopReliable (q);
+
+	SV_ClearUnreliable (q);
+}
+
+//payload is used instead of the current message if not NULL
+static void SV_AddMessageSingle (client_t *cl, qboolean reliable, msgpayload_t *payload)
+{
+	int				cursize;
+	qboolean		inline_data;
+	msgqueue_t		*q;
+	msgrecord_t		*rec;
+	msgindex_t		*index;
 
 	if (cl->state <= cs_zombie)
 	{
@@ -206,21 +404,23 @@ static void SV_AddMessageSingle (client_t *cl, qboolean reliable)
 		return;
 	}
 
+	q = cl->messages;
+
 	//an overflown client
-	if (!cl->messageListData || ((cl->notes & NOTE_OVERFLOWED) && !(cl->notes & NOTE_OVERFLOW_DONE)))
+	if (!q || ((cl->notes & NOTE_OVERFLOWED) && !(cl->notes & NOTE_OVERFLOW_DONE)))
 		return;
 
 	//doesn't want unreliables (irc bots/etc)
 	if (cl->nodata && !reliable)
 		return;
 
-	//get next message position
-	index = (int)((cl->msgListEnd - cl->msgListStart)) + 1;
+	cursize = payload ? payload->cursize : MSG_GetLength ();
 
-	//have they overflown?
-	if (index >= MAX_MESSAGES_PER_LIST-1)
+	//check its sane, should never happen...
+	if (cursize >= cl->netchan.message.buffsize)
 	{
-		Com_Printf ("WARNING: Index overflow (%d) for %s.\n", LOG_SERVER|LOG_WARNING, index, cl->name);
+		//uh oh...
+		Com_Printf ("ALERT: SV_AddMessageSingle: Message size %d to %s is larger than MAX_USABLEMSG (%d)!!\n", LOG_SERVER|LOG_WARNING, cursize, cl->name, cl->netchan.message.buffsize);
 
 		//clear the buffer for overflow print and malloc cleanup
 		SV_ClearMessageList (cl);
@@ -230,36 +430,61 @@ static void SV_AddMessageSingle (client_t *cl, qboolean reliable)
 		return;
 	}
 
-	//set up links
-	next = &cl->messageListData[index];
-	cl->msgListEnd->next = next;
+	inline_data = (!payload && cursize <= MSG_MAX_SIZE_BEFORE_MALLOC);
 
-	cl->msgListEnd = next;
-	next->next = NULL;
+	if (reliable)
+	{
+		rec = NULL;
 
-	SV_MSGListIntegrityCheck (cl);
+		if (q->numreliable < MAX_MESSAGES_PER_LIST - 1)
+			rec = SV_AllocReliable (q, SV_RecordLength (cursize, inline_data));
 
-	//write message to this buffer
-	MSG_EndWrite (next);
+		//have they overflown?
+		if (!rec)
+		{
+			Com_Printf ("WARNING: Index overflow (%d) for %s.\n", LOG_SERVER|LOG_WARNING, q->numreliable, cl->name);
 
-	SV_MSGListIntegrityCheck (cl);
+			//clear the buffer for overflow print and malloc cleanup
+			SV_ClearMessageList (cl);
 
-	//check its sane, should never happen...
-	if (next->cursize >= cl->netchan.message.buffsize)
-	{
-		//uh oh...
-		Com_Printf ("ALERT: SV_AddMessageSingle: Message size %d to %s is larger than MAX_USABLEMSG (%d)!!\n", LOG_SERVER|LOG_WARNING, next->cursize, cl->name, cl->netchan.message.buffsize);
+			//drop them
+			cl->notes |= NOTE_OVERFLOWED;
+			return;
+		}
 
-		//clear the buffer for overflow print and malloc cleanup
-		SV_ClearMessageList (cl);
+		//write message to this record
+		if (payload)
+			rec->cursize = MSG_EndWriteShared (payload);
+		else
+			rec->cursize = MSG_EndWrite ((byte *)rec + MSGRING_ALIGN, &payload);
 
-		//drop them
-		cl->notes |= NOTE_OVERFLOWED;
-		return;
+		rec->payload = payload;
 	}
+	else
+	{
+		//unreliables are thrown away every datagram anyway, just lose this one
+		if (q->numunreliable == MAX_UNRELIABLE_MESSAGES)
+		{
+			Com_DPrintf ("SV_AddMessageSingle: Dropped an unreliable message to %s, queue is full.\n", cl->name);
+			return;
+		}
+
+		index = &q->unreliable[q->numunreliable++];
+		index->offset = q->unreliablesize;
+		index->done = false;
+
+		if (payload)
+			index->cursize = MSG_EndWriteShared (payload);
+		else
+			index->cursize = MSG_EndWrite (q->unreliable_buf + index->offset, &payload);
+
+		index->payload = payload;
 
-	//set reliable flag
-	next->reliable = reliable;
+		if (!payload)
+			q->unreliablesize += index->cursize;
+
+		index->priority = SV_MessagePriority (SV_UnreliableData (q, index));
+	}
 }
 
 /*
@@ -316,7 +541,7 @@ static void SV_CheckForOverflow ()
 
 void SV_AddMessage (client_t *cl, qboolean reliable)
 {
-	SV_AddMessageSingle (cl, reliable);
+	SV_AddMessageSingle (cl, reliable, NULL);
 	MSG_FreeData ();
 	//SV_CheckForOverflowSingle (cl);
 }
@@ -331,7 +556,7 @@ void SV_AddMessage (client_t *cl, qboolean reliable)
 		if (cl->state <= cs_zombie)
 			continue;
 
-		SV_AddMessageSingle (cl, reliable);
+		SV_AddMessageSingle (cl, reliable, NULL);
 	}
 	MSG_FreeData();
 	SV_CheckForOverflow ();
@@ -364,6 +589,182 @@ void SV_BroadcastCommand (const char *fmt, ...)
 }
 
 
+/*
+=============================================================================
+
+MULTICAST RECIPIENT CACHE
+
+r1: each client's cluster and area are looked up once per frame, or when the
+client edict is relinked, rather than descending the BSP for every client on
+every PVS/PHS multicast. clients are also indexed by cluster so a multicast
+only has to test the clusters that actually contain someone.
+
+=============================================================================
+*/
+
+#define	CLIENT_WORDS	(MAX_CLIENTS/32)
+
+static int		mc_numclusters;
+static uint32	*mc_cluster_clients;		//mc_numclusters rows of CLIENT_WORDS
+static int		*mc_cluster_count;
+static int		*mc_occupied;				//clusters with at least one client
+static int		*mc_occupied_index;
+static int		mc_num_occupied;
+
+static int		mc_cluster[MAX_CLIENTS];	//-1 if not indexed
+static int		mc_area[MAX_CLIENTS];
+static uint32	mc_stale[CLIENT_WORDS];
+static qboolean	mc_any_stale;
+
+void SV_ClearMulticastIndex (void)
+{
+	int		i;
+
+	if (mc_cluster_clients)
+	{
+		Z_Free (mc_cluster_clients);
+		Z_Free (mc_cluster_count);
+		Z_Free (mc_occupied);
+		Z_Free (mc_occupied_index);
+		mc_cluster_clients = NULL;
+	}
+
+	mc_num_occupied = 0;
+	mc_numclusters = CM_NumClusters;
+
+	for (i = 0; i < MAX_CLIENTS; i++)
+		mc_cluster[i] = -1;
+
+	SV_InvalidateMulticastIndex ();
+
+	if (mc_numclusters <= 0)
+		return;
+
+	mc_cluster_clients = Z_TagMalloc (mc_numclusters * CLIENT_WORDS * sizeof(uint32), TAGMALLOC_CLUSTERINDEX);
+	mc_cluster_count = Z_TagMalloc (mc_numclusters * sizeof(int), TAGMALLOC_CLUSTERINDEX);
+	mc_occupied = Z_TagMalloc (mc_numclusters * sizeof(int), TAGMALLOC_CLUSTERINDEX);
+	mc_occupied_index = Z_TagMalloc (mc_numclusters * sizeof(int), TAGMALLOC_CLUSTERINDEX);
+
+	memset (mc_cluster_clients, 0, mc_numclusters * CLIENT_WORDS * sizeof(uint32));
+	memset (mc_cluster_count, 0, mc_numclusters * sizeof(int));
+}
+
+void SV_InvalidateMulticastIndex (void)
+{
+	memset (mc_stale, 0xFF, sizeof(mc_stale));
+	mc_any_stale = true;
+}
+
+void SV_MulticastClientMoved (int clientnum)
+{
+	mc_stale[clientnum >> 5] |= 1U << (clientnum & 31);
+	mc_any_stale = true;
+}
+
+static void SV_MulticastIndexRemove (int clientnum)
+{
+	int		cluster;
+	int		last;
+
+	cluster = mc_cluster[clientnum];
+	if (cluster == -1)
+		return;
+
+	mc_cluster[clientnum] = -1;
+	mc_cluster_clients[cluster * CLIENT_WORDS + (clientnum >> 5)] &= ~(1U << (clientnum & 31));
+
+	if (!--mc_cluster_count[cluster])
+	{
+		last = mc_occupied[--mc_num_occupied];
+		mc_occupied[mc_occupied_index[cluster]] = last;
+		mc_occupied_index[last] = mc_occupied_index[cluster];
+	}
+}
+
+static void SV_MulticastIndexAdd (int clientnum, int cluster)
+{
+	mc_cluster[clientnum] = cluster;
+	mc_cluster_clients[cluster * CLIENT_WORDS + (clientnum >> 5)] |= 1U << (clientnum & 31);
+
+	if (!mc_cluster_count[cluster]++)
+	{
+		mc_occupied_index[cluster] = mc_num_occupied;
+		mc_occupied[mc_num_occupied++] = cluster;
+	}
+}
+
+static void SV_RefreshMulticastIndex (void)
+{
+	client_t	*cl;
+	uint32		bits;
+	int			i, j;
+	int			leafnum, cluster;
+
+	if (!mc_any_stale || !mc_cluster_clients)
+		return;
+
+	for (i = 0; i < CLIENT_WORDS; i++)
+	{
+		bits = mc_stale[i];
+		if (!bits)
+			continue;
+
+		mc_stale[i] = 0;
+
+		for (j = i << 5; bits; j++, bits >>= 1)
+		{
+			if (!(bits & 1))
+				continue;
+
+			if (j >= maxclients->intvalue)
+				break;
+
+			cl = svs.clients + j;
+
+			if (cl->state <= cs_zombie || !cl->edict)
+			{
+				SV_MulticastIndexRemove (j);
+				continue;
+			}
+
+			leafnum = CM_PointLeafnum (cl->edict->s.origin);
+			cluster = CM_LeafCluster (leafnum);
+			mc_area[j] = CM_LeafArea (leafnum);
+
+			if (cluster == mc_cluster[j])
+				continue;
+
+			SV_MulticastIndexRemove (j);
+
+			if (cluster != -1)
+				SV_MulticastIndexAdd (j, cluster);
+		}
+	}
+
+	mc_any_stale = false;
+}
+
+//sets the bits of clients in any cluster visible in mask
+static void SV_MulticastRecipients (const byte *mask, uint32 *out)
+{
+	const uint32	*row;
+	int				i, j;
+	int				cluster;
+
+	memset (out, 0, CLIENT_WORDS * sizeof(uint32));
+
+	for (i = 0; i < mc_num_occupied; i++)
+	{
+		cluster = mc_occupied[i];
+		if (!(mask[cluster >> 3] & (1 << (cluster & 7))))
+			continue;
+
+		row = mc_cluster_clients + cluster * CLIENT_WORDS;
+		for (j = 0; j < CLIENT_WORDS; j++)
+			out[j] |= row[j];
+	}
+}
+
 /*
 =================
 SV_Multicast
@@ -379,13 +780,19 @@ MULTICAST_PHS	send to clients potentially hearable from org
 void EXPORT SV_Multicast (vec3_t /*@null@*/ origin, multicast_t to)
 {
 	client_t		*client;
-	byte			*mask;
+	byte			buffer[MAX_MAP_LEAFS/8];
+	const byte		*mask;
 	int				leafnum, cluster;
 	int				j;
 	qboolean		reliable;
-	int				area1, area2;
+	int				area1;
+	msgpayload_t	*payload;
+	client_t		*first;
+	uint32			recipients[CLIENT_WORDS];
 
 	reliable = false;
+	payload = NULL;
+	first = NULL;
 
 	if (to != MULTICAST_ALL_R && to != MULTICAST_ALL)
 	{
@@ -435,7 +842,7 @@ void EXPORT SV_Multicast (vec3_t /*@null@*/ origin, multicast_t to)
 	case MULTICAST_PHS:
 		leafnum = CM_PointLeafnum (origin);
 		cluster = CM_LeafCluster (leafnum);
-		mask = CM_ClusterPHS (cluster);
+		mask = CM_ClusterPHS (cluster, buffer);
 		break;
 
 	case MULTICAST_PVS_R:
@@ -443,7 +850,7 @@ void EXPORT SV_Multicast (vec3_t /*@null@*/ origin, multicast_t to)
 	case MULTICAST_PVS:
 		leafnum = CM_PointLeafnum (origin);
 		cluster = CM_LeafCluster (leafnum);
-		mask = CM_ClusterPVS (cluster);
+		mask = CM_ClusterPVS (cluster, buffer);
 		break;
 
 	default:
@@ -454,6 +861,12 @@ void EXPORT SV_Multicast (vec3_t /*@null@*/ origin, multicast_t to)
 		return;
 	}
 
+	if (mask)
+	{
+		SV_RefreshMulticastIndex ();
+		SV_MulticastRecipients (mask, recipients);
+	}
+
 	// send the data to all relevent clients
 	for (j = 0, client = svs.clients; j < maxclients->intvalue; j++, client++)
 	{
@@ -479,18 +892,35 @@ void EXPORT SV_Multicast (vec3_t /*@null@*/ origin, multicast_t to)
 
 		if (mask)
 		{
-			leafnum = CM_PointLeafnum (client->edict->s.origin);
-			cluster = CM_LeafCluster (leafnum);
-			area2 = CM_LeafArea (leafnum);
-			if (!CM_AreasConnected (area1, area2))
+			if (!(recipients[j>>5] & (1U << (j&31))))
 				continue;
-			if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
+			if (!CM_AreasConnected (area1, mc_area[j]))
 				continue;
 		}
 
-		SV_AddMessageSingle (client, reliable);
+		//r1: once there is a second recipient the message is stored once and
+		//shared by all of them, whatever its size. a single recipient takes
+		//the inline copy, that is cheaper than a payload for one reference.
+		if (!first)
+		{
+			first = client;
+			continue;
+		}
+
+		if (!payload)
+		{
+			payload = MSG_CreatePayload ();
+			SV_AddMessageSingle (first, reliable, payload);
+		}
+
+		SV_AddMessageSingle (client, reliable, payload);
 	}
 
+	if (payload)
+		MSG_ReleasePayload (payload);
+	else if (first)
+		SV_AddMessageSingle (first, reliable, NULL);
+
 	MSG_FreeData();
 	//SV_CheckForOverflow();
 }
@@ -750,51 +1180,38 @@ void SV_WriteReliableMessages (client_t *client, int buffSize)
 	}
 
 	//writing to overflowed client, don't bother trying to get any final messages through
-	if (client->messageListData == NULL)
+	if (!client->messages)
 		return;
 
 	//if the reliable is free, let's fill it up
 	if (!client->netchan.reliable_length)
 	{
-		messagelist_t	*message, *last;
+		msgrecord_t	*message;
 		
 		client->netchan.message.maxsize = buffSize;
 
-		message = client->msgListStart;
-
-		for (;;)
+		//reliables go out strictly in order, stop at the first that doesn't fit
+		while ((message = SV_FirstReliable (client->messages)) != NULL)
 		{
-			last = message;
-			message = message->next;
-
-			if (!message)
-				break;
-
-			//its a reliable message
-			if (message->reliable)
+			//but it wouldn't fit.
+			if (message->cursize + client->netchan.message.cursize > client->netchan.message.maxsize)
 			{
-				//but it wouldn't fit.
-				if (message->cursize + client->netchan.message.cursize > client->netchan.message.maxsize)
+				if (!client->netchan.message.cursize)
 				{
-					if (!client->netchan.message.cursize)
-					{
-						Com_Printf ("SV_WriteReliableMessages: Reliable message of type %s (%d bytes) too big for maxsize %d!\n", LOG_SERVER|LOG_WARNING, svc_strings[message->data[0]], message->cursize, client->netchan.message.maxsize);
-						SV_DropClient (client, false);
-						return;
-					}
-					break;
+					Com_Printf ("SV_WriteReliableMessages: Reliable message of type %s (%d bytes) too big for maxsize %d!\n", LOG_SERVER|LOG_WARNING, svc_strings[MSGRING_DATA(message)[0]], message->cursize, client->netchan.message.maxsize);
+					SV_DropClient (client, false);
+					return;
 				}
+				break;
+			}
 
-				//it fits, write it in
-				SZ_Write (&client->netchan.message, message->data, message->cursize);
+			//it fits, write it in
+			SZ_Write (&client->netchan.message, MSGRING_DATA(message), message->cursize);
 
-				//and delete from the message list
-				message = SV_DeleteMessage (client, message, last);
-			}
+			//and delete from the queue
+			SV_PopReliable (client->messages);
 		}
 
-		SV_MSGListIntegrityCheck (client);
-
 		//something very bad happened if this occurs
 		if (client->netchan.message.overflowed)
 			Com_Error (ERR_DROP, "SV_SendClientDatagram: netchan message overflow! (this should never happen)");
@@ -803,120 +1220,280 @@ void SV_WriteReliableMessages (client_t *client, int buffSize)
 
 /*
 =======================
-SV_SendClientDatagram
+Frame jobs
+
+r1: the svc_frame for each client is encoded into a framejob_t so it can be done
+on the worker pool (sv_threads). building the frame (client_entities ring) and
+everything touching the message list or netchan stays on the main thread, the
+workers only read the built frame and write into the job.
 =======================
 */
-static qboolean SV_SendClientDatagram (client_t *client)
+typedef struct
 {
-	byte			msg_buf[MAX_USABLEMSG];
-	sizebuf_t		msg;
-	int				ret;
-	messagelist_t	*message, *last;
+	client_t		*client;
 
-#ifndef NDEBUG
-	byte			*wanted;
+	//datagram space left after reserving the first reliable message
+	int				maxsize;
+	msgrecord_t		*reserved;
+
+	sizebuf_t		frame;
+	byte			frame_buf[4096];
+
+#ifndef NO_ZLIB
+	byte			compressed_buf[4096];
+	int				compressed_len;
+	int				zlib_level;
+
+	//sv_packetentities_hack 2 re-encode, for the debug message
+	qboolean		retried;
+	int				retry_frame_len;
+	int				retry_compressed_len;
 #endif
+} framejob_t;
 
-	//init unreliable portion
-	SZ_Init (&msg, msg_buf, client->netchan.message.buffsize);
+static framejob_t	*framejobs;
+static int			num_framejobs;
+static int			max_framejobs;
 
-	msg.allowoverflow = true;
+static void SV_AllocFrameJobs (void)
+{
+	if (max_framejobs >= maxclients->intvalue)
+		return;
+
+	if (framejobs)
+		Z_Free (framejobs);
+
+	max_framejobs = maxclients->intvalue;
+	framejobs = Z_TagMalloc (sizeof(framejob_t) * max_framejobs, TAGMALLOC_CLIENTS);
+}
+
+/*
+=======================
+SV_DatagramSpace
+
+How much of the packet the unreliable part may use.
+=======================
+*/
+static int SV_DatagramSpace (const client_t *client, msgrecord_t **reserved)
+{
+	msgrecord_t		*message;
+	int				maxsize;
+
+	maxsize = client->netchan.message.buffsize;
+	*reserved = NULL;
 
 	if (client->netchan.reliable_length)
 	{
 		//fix up maxsize for how much space we can fill up safely.
 		//reliable is full, so we can fill up remainder of the packet.
-		msg.maxsize -= client->netchan.reliable_length;
+		maxsize -= client->netchan.reliable_length;
 	}
 	else
 	{
 		//reliable is empty - we must allow for at least one reliable message, set available space appropriately.
-		message = client->msgListStart;
-		for (;;)
+		message = SV_FirstReliable (client->messages);
+		if (message)
 		{
-			message = message->next;
+			//keep track of this message so we can ensure it was delivered (debug builds)
+			*reserved = message;
+			maxsize -= message->cursize;
+			//Com_Printf ("SV_SendClientDatagram: Reserving %d bytes of buffer space for %s. Have %d for unreliable.\n", LOG_GENERAL, message->cursize, client->name, maxsize);
+		}
+	}
 
-			if (!message)
-				break;
+	return maxsize;
+}
 
-			if (message->reliable)
-			{
-#ifndef NDEBUG
-				//for debugging, keep track of this message so we can ensure it was delivered. if not, error out.
-				wanted = message->data;
+/*
+=======================
+SV_PrepareClientFrame
+
+Main thread. Builds the entity list for the client and sets up a job to encode it.
+=======================
+*/
+static framejob_t *SV_PrepareClientFrame (client_t *client)
+{
+	framejob_t	*job;
+
+	job = &framejobs[num_framejobs++];
+
+	job->client = client;
+	job->maxsize = SV_DatagramSpace (client, &job->reserved);
+
+	//we write svc_frame to it's own buffer to allow for compression
+	SZ_Init (&job->frame, job->frame_buf, sizeof(job->frame_buf));
+	job->frame.allowoverflow = true;
+
+#ifndef NO_ZLIB
+	job->compressed_len = -1;
+	job->retried = false;
+	job->zlib_level = sv_zlib_level->intvalue;
 #endif
-				msg.maxsize -= message->cursize;
-				//Com_Printf ("SV_SendClientDatagram: Reserving %d bytes of buffer space for %s. Have %d for unreliable.\n", LOG_GENERAL, message->cursize, client->name, msg.maxsize);
-				break;
-			}
-		}
-	}
 
-	//this will write an unreliable svc_frame to the message list
-	if (!client->nodata)
-	{
-		byte		frame_buf[4096];
-		sizebuf_t	frame;
+	if (client->nodata)
+		return job;
 
-		SV_BuildClientFrame (client);
+	SV_BuildClientFrame (client);
 
-		//we write svc_frame to it's own buffer to allow for compression
-		SZ_Init (&frame, frame_buf, sizeof(frame_buf));
-		frame.allowoverflow = true;
+	//adjust for packetentities hack
+	if (sv_packetentities_hack->intvalue == 1 || client->protocol == PROTOCOL_ORIGINAL)
+		job->frame.maxsize = job->maxsize;
 
-		//adjust for packetentities hack
-		if (sv_packetentities_hack->intvalue == 1 || client->protocol == PROTOCOL_ORIGINAL)
-			frame.maxsize = msg.maxsize;
+	return job;
+}
+
+/*
+=======================
+SV_EncodeClientFrame
+
+Any thread. Writes the svc_frame built by SV_PrepareClientFrame and compresses it
+if it won't fit into one packet. Must not touch anything but the job and its client.
+=======================
+*/
+static void SV_EncodeClientFrame (int jobnum)
+{
+	framejob_t	*job;
+
+	job = &framejobs[jobnum];
+
+	if (job->client->nodata)
+		return;
+
+	MSG_InitBuffer ();
 
 #ifndef NO_ZLIB
 retryframe:
 #endif
 
-		// send over all the relevant entity_state_t
-		// and the player_state_t
-		SV_WriteFrameToClient (client, &frame);
+	// send over all the relevant entity_state_t
+	// and the player_state_t
+	SV_WriteFrameToClient (job->client, &job->frame);
 
-		//if frame overflowed, we're screwed either way :)
-		if (!frame.overflowed)
+	//if frame overflowed, we're screwed either way :)
+	if (job->frame.overflowed)
+		return;
+
+	//try to fit it into one udp packet if at all possible
+	if (job->frame.cursize > job->maxsize || job->frame.cursize > 1490)
+	{
+#ifndef NO_ZLIB
+		//r1q2 clients get compressed frame, normal clients get nothing. frames are
+		//binary deltas with none of the dictionary's strings, so it isn't used here.
+		job->compressed_len = ZLibCompressFrame (job->frame_buf, job->frame.cursize, job->compressed_buf, sizeof(job->compressed_buf),
+			job->zlib_level, false);
+
+		if (job->compressed_len == -1 || job->compressed_len > job->maxsize - 5)
 		{
-			//try to fit it into one udp packet if at all possible
-			if (frame.cursize > msg.maxsize || frame.cursize > 1490)
+			if (sv_packetentities_hack->intvalue == 2 && !job->retried)
 			{
-#ifndef NO_ZLIB
-				//r1q2 clients get compressed frame, normal clients get nothing
-				byte	compressed_frame[4096];
-				int		compressed_frame_len;
+				job->retried = true;
+				job->retry_frame_len = job->frame.cursize;
+				job->retry_compressed_len = job->compressed_len;
+				job->compressed_len = -1;
+				SZ_Clear (&job->frame);
+				job->frame.maxsize = job->maxsize;
+				goto retryframe;
+			}
+		}
+#endif
+	}
+}
 
-				compressed_frame_len = ZLibCompressChunk (frame_buf, frame.cursize, compressed_frame, sizeof(compressed_frame), Z_DEFAULT_COMPRESSION, -15);
+/*
+=======================
+SV_WriteUnreliables
 
-				if (compressed_frame_len != -1 && compressed_frame_len <= msg.maxsize - 5)
-				{
-					Com_DPrintf ("SV_SendClientDatagram: svc_frame for %s: %d -> %d\n", client->name, frame.cursize, compressed_frame_len);
-					SZ_WriteByte (&msg, svc_zpacket);
-					SZ_WriteShort (&msg, compressed_frame_len);
-					SZ_WriteShort (&msg, frame.cursize);
-					SZ_Write (&msg, compressed_frame, compressed_frame_len);
-#ifndef NPROFILE
-					svs.proto35CompressionBytes += frame.cursize - compressed_frame_len;
-#endif
-				}
-				else
-				{
-					if (sv_packetentities_hack->intvalue == 2)
-					{
-						Com_DPrintf ("SV_SendClientDatagram: zlib svc_frame %d -> %d for %s still didn't fit, using msg.maxsize of %d\n", frame.cursize, compressed_frame_len, client->name, msg.maxsize);
-						SZ_Clear (&frame);
-						frame.maxsize = msg.maxsize;
-						goto retryframe;
-					}
-				}
-#endif
+One pass over the unreliable index. MSGPRI_TEMPENT also takes a random half of
+the MSGPRI_TEMPENT_RANDOM ones, MSGPRI_OTHER takes whatever is left.
+=======================
+*/
+static void SV_WriteUnreliables (msgqueue_t *q, sizebuf_t *msg, msgpriority_t priority)
+{
+	int			i;
+	msgindex_t	*message;
+
+	for (i = 0; i < q->numunreliable; i++)
+	{
+		message = &q->unreliable[i];
+
+		if (message->done)
+			continue;
+
+		if (priority == MSGPRI_TEMPENT)
+		{
+			if (message->priority == MSGPRI_TEMPENT_RANDOM)
+			{
+				//randomly drop some of these
+				if (randomMT() & 1)
+					continue;
 			}
-			else
+			else if (message->priority != MSGPRI_TEMPENT)
+				continue;
+		}
+		else if (priority != MSGPRI_OTHER && message->priority != priority)
+			continue;
+
+		message->done = true;
+
+		//not gonna fit, try another one
+		if (msg->cursize + message->cursize > msg->maxsize)
+			continue;
+
+		//write it in
+		SZ_Write (msg, SV_UnreliableData (q, message), message->cursize);
+	}
+}
+
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+static qboolean SV_SendClientDatagram (framejob_t *job)
+{
+	byte			msg_buf[MAX_USABLEMSG];
+	sizebuf_t		msg;
+	int				ret, i;
+	client_t		*client;
+	msgqueue_t		*q;
+
+	client = job->client;
+	q = client->messages;
+
+	//init unreliable portion
+	SZ_Init (&msg, msg_buf, client->netchan.message.buffsize);
+
+	msg.allowoverflow = true;
+	msg.maxsize = job->maxsize;
+
+	//this will write an unreliable svc_frame to the message list
+	if (!client->nodata && !job->frame.overflowed)
+	{
+#ifndef NO_ZLIB
+		if (job->retried)
+			Com_DPrintf ("SV_SendClientDatagram: zlib svc_frame %d -> %d for %s still didn't fit, using msg.maxsize of %d\n", job->retry_frame_len, job->retry_compressed_len, client->name, msg.maxsize);
+#endif
+
+		if (job->frame.cursize > msg.maxsize || job->frame.cursize > 1490)
+		{
+#ifndef NO_ZLIB
+			if (job->compressed_len != -1 && job->compressed_len <= msg.maxsize - 5)
 			{
-				//it fits as-is, write it out
-				SZ_Write (&msg, frame_buf, frame.cursize);
+				Com_DPrintf ("SV_SendClientDatagram: svc_frame for %s: %d -> %d\n", client->name, job->frame.cursize, job->compressed_len);
+				SZ_WriteByte (&msg, svc_zpacket);
+				SZ_WriteShort (&msg, job->compressed_len);
+				SZ_WriteShort (&msg, job->frame.cursize);
+				SZ_Write (&msg, job->compressed_buf, job->compressed_len);
+#ifndef NPROFILE
+				svs.proto35CompressionBytes += job->frame.cursize - job->compressed_len;
+#endif
 			}
+#endif
+		}
+		else
+		{
+			//it fits as-is, write it out
+			SZ_Write (&msg, job->frame_buf, job->frame.cursize);
 		}
 	}
 
@@ -933,115 +1510,19 @@ retryframe:
 	//first we check if we have enough room for even bothering - packetentities may have filled it up!
 	if (msg.cursize + 8 < msg.maxsize)
 	{
-		message = client->msgListStart;
-		for (;;)
-		{
-			last = message;
-			message = message->next;
-
-			if (!message)
-				break;
-
-			if (!message->reliable)
-			{
-				if (message->data[0] == svc_temp_entity)
-				{
-					//don't include trivial in this part
-					if (message->data[1] == TE_BLOOD || message->data[1] == TE_SPLASH)
-						continue;
-
-					//drop some semi-useless repeated effects
-					if (message->data[1] == TE_GUNSHOT || message->data[1] == TE_BULLET_SPARKS || message->data[1] == TE_SHOTGUN)
-					{
-						//randomly drop some of these
-						if (randomMT() & 1)
-							continue;
-					}
-
-					//not gonna fit, try another one
-					if (msg.cursize + message->cursize > msg.maxsize)
-					{
-						message = SV_DeleteMessage (client, message, last);
-						continue;
-					}
-
-					//write it in
-					SZ_Write (&msg, message->data, message->cursize);
-
-					//free it
-					message = SV_DeleteMessage (client, message, last);
-				}
-			}
-		}
-
-		SV_MSGListIntegrityCheck (client);
+		SV_WriteUnreliables (q, &msg, MSGPRI_TEMPENT);
 
 		//recheck how much space we have
 		if (msg.cursize + 8 < msg.maxsize)
 		{
 			//now we write sounds
-			message = client->msgListStart;
-			for (;;)
-			{
-				last = message;
-				message = message->next;
-
-				if (!message)
-					break;
-
-				if (!message->reliable)
-				{
-					if (message->data[0] == svc_sound)
-					{
-						//not gonna fit, try another one
-						if (msg.cursize + message->cursize > msg.maxsize)
-						{
-							message = SV_DeleteMessage (client, message, last);
-							continue;
-						}
-
-						//write it in
-						SZ_Write (&msg, message->data, message->cursize);
-
-						//free it
-						message = SV_DeleteMessage (client, message, last);
-					}
-				}
-			}
-
-			SV_MSGListIntegrityCheck (client);
+			SV_WriteUnreliables (q, &msg, MSGPRI_SOUND);
 
 			//recheck how much space is available
 			if (msg.cursize + 8 < msg.maxsize)
 			{
 				//everything else we can fit
-				message = client->msgListStart;
-				for (;;)
-				{
-					last = message;
-					message = message->next;
-
-					if (!message)
-						break;
-
-					if (!message->reliable)
-					{
-						//not gonna fit, try another one
-						if (msg.cursize + message->cursize > msg.maxsize)
-						{
-							message = SV_DeleteMessage (client, message, last);
-							continue;
-						}
-
-						//write it in
-						SZ_Write (&msg, message->data, message->cursize);
-
-						//free it
-						message = SV_DeleteMessage (client, message, last);
-					}
-				}
-
-				SV_MSGListIntegrityCheck (client);
+				SV_WriteUnreliables (q, &msg, MSGPRI_OTHER);
 			}
 		}
 	}
@@ -1052,23 +1533,13 @@ retryframe:
 
 	//now we nuke all remaining unreliable content
 	//unreliable is by nature time sensitive - no point queueing it.
-	message = client->msgListStart;
-	for (;;)
+	for (i = 0; i < q->numunreliable; i++)
 	{
-		last = message;
-		message = message->next;
-
-		if (!message)
-			break;
-
-		if (!message->reliable)
-		{
-			Com_DPrintf ("SCD: Dropped an unreliable %s to %s.\n", svc_strings[*message->data], client->name);
-			message = SV_DeleteMessage (client, message, last);
-		}
+		if (!q->unreliable[i].done)
+			Com_DPrintf ("SCD: Dropped an unreliable %s to %s.\n", svc_strings[*SV_UnreliableData (q, &q->unreliable[i])], client->name);
 	}
 
-	SV_MSGListIntegrityCheck (client);
+	SV_ClearUnreliable (q);
 
 	//now we fill the reliable portion if it's empty -- but not too much so we can hopefully always
 	//fit an svc_frame so we measure using hacks and frameSize. however we must commit to delivering
@@ -1077,24 +1548,8 @@ retryframe:
 	SV_WriteReliableMessages (client, client->netchan.message.buffsize - msg.cursize);
 
 #ifndef NDEBUG
-	if (!client->netchan.reliable_length)
-	{
-		message = client->msgListStart;
-		for (;;)
-		{
-			message = message->next;
-
-			if (!message)
-				break;
-
-			if (message->reliable)
-			{
-				if (message->data == wanted)
-					Com_Error (ERR_FATAL, "SV_SendClientDatagram: wanted to send message but it never got written!");
-				break;
-			}
-		}
-	}
+	if (!client->netchan.reliable_length && job->reserved && SV_FirstReliable (q) == job->reserved)
+		Com_Error (ERR_FATAL, "SV_SendClientDatagram: wanted to send message but it never got written!");
 #endif
 
 	// send the datagram
@@ -1193,11 +1648,26 @@ void SV_SendClientMessages (void)
 	int			msglen;
 	byte		msgbuf[MAX_MSGLEN];
 	size_t		r;
+	qboolean	threaded;
+	framejob_t	*job;
 
 	msglen = 0;
 
 	SV_CheckForOverflow ();
 
+	SV_AllocFrameJobs ();
+	num_framejobs = 0;
+
+	//r1: with worker threads, frames for all clients are built first, encoded in
+	//parallel and then sent in a second pass.
+	threaded = (Sys_NumWorkers () > 0);
+
+	//r1: entity deltas encoded for one client this batch are reused by the rest
+	SV_BeginDeltaCache ();
+
+	//r1: nocheat visibility for all client pairs, on the workers if we have them
+	SV_BuildVisibility ();
+
 	// read the next demo message if needed
 	if (sv.demofile && sv.state == ss_demo)
 	{
@@ -1233,6 +1703,9 @@ void SV_SendClientMessages (void)
 		}
 	}
 
+	//r1: queue up datagrams so they go out in as few syscalls as possible
+	NET_BeginPacketBatch (NS_SERVER);
+
 	// send a message to each connected client
 	for (i=0, c = svs.clients ; i<maxclients->intvalue; i++, c++)
 	{
@@ -1263,7 +1736,14 @@ void SV_SendClientMessages (void)
 			if (SV_RateDrop (c))
 				continue;
 
-			SV_SendClientDatagram (c);
+			job = SV_PrepareClientFrame (c);
+
+			if (!threaded)
+			{
+				SV_EncodeClientFrame (0);
+				SV_SendClientDatagram (job);
+				num_framejobs = 0;
+			}
 		}
 		else
 		{
@@ -1274,5 +1754,21 @@ void SV_SendClientMessages (void)
 				Netchan_Transmit (&c->netchan, 0, NULL);
 		}
 	}
+
+	if (num_framejobs)
+	{
+		Sys_RunWorkers (SV_EncodeClientFrame, num_framejobs);
+
+		for (i = 0, job = framejobs; i < num_framejobs; i++, job++)
+		{
+			//may have been dropped while sending to an earlier client
+			if (job->client->state != cs_spawned)
+				continue;
+
+			SV_SendClientDatagram (job);
+		}
+	}
+
+	NET_FlushPacketBatch (NS_SERVER);
 }
 
@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 edict_t	*sv_player;
 
 cvar_t	*sv_max_download_size;
+cvar_t	*sv_download_cache;
 
 char	svConnectStuffString[1100];
 char	svBeginStuffString[1100];
@@ -58,6 +59,104 @@ static void SV_BeginDemoserver (void)
 		Com_Error (ERR_HARD, "Couldn't open demo %s", name);
 }
 
+/*
+================
+SV_MakeBaseline
+
+Take the current state of entnum as a baseline, leaves an empty state if
+the entity isn't worth sending.
+================
+*/
+static void SV_MakeBaseline (int entnum, entity_state_t *base)
+{
+	edict_t			*svent;
+
+	memset (base, 0, sizeof(*base));
+
+	if (entnum >= ge->num_edicts)
+		return;
+
+	svent = EDICT_NUM(entnum);
+
+	if (!svent->inuse)
+		return;
+
+	if (!svent->s.modelindex && !svent->s.sound && !svent->s.effects)
+		return;
+
+	svent->s.number = entnum;
+
+	//
+	// take current state as baseline
+	//
+	//VectorCopy (svent->s.origin, svent->s.old_origin);
+	*base = svent->s;
+	FastVectorCopy (base->origin, base->old_origin);
+}
+
+/*
+================
+SV_CreateSharedBaseline
+
+r1: baselines every client starts from, taken once the map has settled.
+================
+*/
+void SV_CreateSharedBaseline (void)
+{
+	int		entnum;
+
+	memset (&sv.baselines[0], 0, sizeof(sv.baselines[0]));
+
+	for (entnum = 1; entnum < MAX_EDICTS; entnum++)
+		SV_MakeBaseline (entnum, &sv.baselines[entnum]);
+}
+
+void SV_FreeBaseline (client_t *cl)
+{
+	if (cl->lastlines)
+	{
+		Z_Free (cl->lastlines);
+		cl->lastlines = NULL;
+	}
+
+	cl->numlastlines = 0;
+	memset (cl->lastlinebits, 0, sizeof(cl->lastlinebits));
+}
+
+/*
+================
+SV_ClientBaseline
+================
+*/
+const entity_state_t *SV_ClientBaseline (const client_t *cl, int entnum)
+{
+	const baseline_t	*base;
+	int					lo, hi, mid;
+
+	if (!(cl->lastlinebits[entnum >> 5] & (1U << (entnum & 31))))
+		return &sv.baselines[entnum];
+
+	lo = 0;
+	hi = cl->numlastlines - 1;
+
+	while (lo <= hi)
+	{
+		mid = (lo + hi) >> 1;
+		base = &cl->lastlines[mid];
+
+		if (base->number == entnum)
+			return &base->s;
+
+		if (base->number < entnum)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	Com_Error (ERR_FATAL, "SV_ClientBaseline: entity %d missing from baselines of %s", entnum, cl->name);
+	return NULL;
+}
+
 /*
 ================
 SV_CreateBaseline
@@ -65,33 +164,42 @@ SV_CreateBaseline
 Entity baselines are used to compress the update messages
 to the clients -- only the fields that differ from the
 baseline will be transmitted
+
+r1: only entities whose state differs from sv.baselines are stored.
 ================
 */
 static void SV_CreateBaseline (client_t *cl)
 {
-	edict_t			*svent;
+	entity_state_t	base;
 	int				entnum;
+	int				count;
 
-	memset (cl->lastlines, 0, sizeof(entity_state_t) * MAX_EDICTS);
+	SV_FreeBaseline (cl);
 
-	for (entnum = 1; entnum < ge->num_edicts ; entnum++)
+	count = 0;
+	for (entnum = 1; entnum < MAX_EDICTS; entnum++)
 	{
-		svent = EDICT_NUM(entnum);
+		SV_MakeBaseline (entnum, &base);
+		if (memcmp (&base, &sv.baselines[entnum], sizeof(base)))
+			count++;
+	}
 
-		if (!svent->inuse)
-			continue;
+	if (!count)
+		return;
 
-		if (!svent->s.modelindex && !svent->s.sound && !svent->s.effects)
+	cl->lastlines = Z_TagMalloc (sizeof(baseline_t) * count, TAGMALLOC_CL_BASELINES);
+
+	for (entnum = 1; entnum < MAX_EDICTS; entnum++)
+	{
+		SV_MakeBaseline (entnum, &base);
+		if (!memcmp (&base, &sv.baselines[entnum], sizeof(base)))
 			continue;
 
-		svent->s.number = entnum;
+		cl->lastlines[cl->numlastlines].number = entnum;
+		cl->lastlines[cl->numlastlines].s = base;
+		cl->numlastlines++;
 
-		//
-		// take current state as baseline
-		//
-		//VectorCopy (svent->s.origin, svent->s.old_origin);
-		cl->lastlines[entnum] = svent->s;
-		FastVectorCopy (cl->lastlines[entnum].origin, cl->lastlines[entnum].old_origin);
+		cl->lastlinebits[entnum >> 5] |= 1U << (entnum & 31);
 	}
 }
 
@@ -173,6 +281,14 @@ plainStrings:
 				goto plainStrings;
 			}
 
+			//r1: newer clients inflate zpackets with the preset dictionary
+			if (sv_client->protocol_version >= MINOR_VERSION_R1Q2_ZDICT && deflateSetDictionary (&z, ZLibDictionary (), ZLibDictionarySize ()) != Z_OK)
+			{
+				deflateEnd (&z);
+				SV_ClientPrintf (sv_client, PRINT_HIGH, "deflateSetDictionary() failed.\n");
+				goto plainStrings;
+			}
+
 			SZ_Init (&zBuff, tempConfigStringPacket, sizeof (tempConfigStringPacket));
 
 			index = start;
@@ -245,7 +361,7 @@ plainStrings:
 
 			Com_DPrintf ("SV_Configstrings_f: wrote %d bytes in a %lu byte zPacket\n", realBytes, z.total_out);
 
-			MSG_BeginWriting (svc_zpacket);
+			MSG_BeginWriting (svc_zpacket | (sv_client->protocol_version >= MINOR_VERSION_R1Q2_ZDICT ? ZPACKET_DICTIONARY : 0));
 			MSG_WriteShort (z.total_out);
 			MSG_WriteShort (realBytes);
 			MSG_Write (compressedStringStream, z.total_out);
@@ -596,7 +712,7 @@ static void SV_BaselinesMessage (qboolean userCmd)
 	int				start;
 	int				wrote;
 
-	entity_state_t	*base;
+	const entity_state_t	*base;
 
 	Com_DPrintf ("Baselines() from %s\n", sv_client->name);
 
@@ -647,7 +763,7 @@ plainLines:
 		start = startPos;
 		while (start < MAX_EDICTS)
 		{
-			base = &sv_client->lastlines[start];
+			base = SV_ClientBaseline (sv_client, start);
 			if (base->number)
 			{
 				MSG_BeginWriting (svc_spawnbaseline);
@@ -693,6 +809,14 @@ plainLines:
 				goto plainLines;
 			}
 
+			//r1: newer clients inflate zpackets with the preset dictionary
+			if (sv_client->protocol_version >= MINOR_VERSION_R1Q2_ZDICT && deflateSetDictionary (&z, ZLibDictionary (), ZLibDictionarySize ()) != Z_OK)
+			{
+				deflateEnd (&z);
+				SV_ClientPrintf (sv_client, PRINT_HIGH, "deflateSetDictionary() failed.\n");
+				goto plainLines;
+			}
+
 			SZ_Init (&zBuff, tempBaseLinePacket, sizeof (tempBaseLinePacket));
 
 			while ( z.total_out < sv_client->netchan.message.buffsize - 200 )
@@ -700,7 +824,7 @@ plainLines:
 				SZ_Clear (&zBuff);
 				while (start < MAX_EDICTS)
 				{
-					base = &sv_client->lastlines[start];
+					base = SV_ClientBaseline (sv_client, start);
 					if (base->number)
 					{
 						MSG_BeginWriting (svc_spawnbaseline);
@@ -759,7 +883,7 @@ plainLines:
 
 			Com_DPrintf ("SV_Baselines_f: wrote %d bytes in a %lu byte zPacket\n", realBytes, z.total_out);
 
-			MSG_BeginWriting (svc_zpacket);
+			MSG_BeginWriting (svc_zpacket | (sv_client->protocol_version >= MINOR_VERSION_R1Q2_ZDICT ? ZPACKET_DICTIONARY : 0));
 			MSG_WriteShort (z.total_out);
 			MSG_WriteShort (realBytes);
 			MSG_Write (compressedLineStream, z.total_out);
@@ -1059,123 +1183,468 @@ static void SV_Begin_f (void)
 
 /*
 ==================
-SV_NextDownload_f
+Download cache
+
+r1: zdownload chunks are compressed once per file and kept around so that
+every other client fetching the same file only needs a memcpy. a chunk's
+boundaries depend on where the previous one ended and on the client's
+message size, so each cache entry is a sequence of chunks from offset 0 for
+one buffsize. entries are filled in as the first client progresses through
+the file, clients resuming from an offset that isn't a chunk boundary are
+compressed on the fly as before.
 ==================
 */
-static void SV_NextDownload_f (void)
+#ifndef NO_ZLIB
+typedef struct dlchunk_s
 {
-	uint32		r;
-	int			percent;
-	int			size;
-	int			remaining;
+	uint32				offset;
+	uint32				realBytes;
+	uint32				dataofs;
+	int					zlen;			//0 = send uncompressed
+} dlchunk_t;
 
-//	sizebuf_t	*queue;
+typedef struct dlcache_s
+{
+	struct dlcache_s	*next;
+	char				name[MAX_QPATH];
+	uint32				mtime;
+	int					filelen;
+	int					buffsize;
+	int					refcount;
+	qboolean			unlinked;		//stale, freed once the last client is done
+	qboolean			full;			//hit sv_download_cache, no more chunks are added
+	unsigned			lastused;
+
+	uint32				endoffset;		//where the next chunk starts
+	int					numchunks;
+	int					maxchunks;
+	dlchunk_t			*chunks;
+
+	byte				*data;
+	int					datalen;
+	int					datasize;
+} dlcache_t;
+
+static dlcache_t	*dlcache_list;
+static int			dlcache_bytes;
 
-	if (!sv_client->download)
-		return;
+#ifndef NPROFILE
+static int			dlcache_hits;
+static int			dlcache_misses;
+#endif
 
-	remaining = sv_client->downloadsize - sv_client->downloadcount;
-	
-#ifndef NO_ZLIB
-	if (sv_client->downloadCompressed)
+static void SV_FreeDownloadCache (dlcache_t *cache)
+{
+	dlcache_bytes -= cache->datasize + cache->maxchunks * sizeof(dlchunk_t);
+
+	if (cache->data)
+		Z_Free (cache->data);
+
+	if (cache->chunks)
+		Z_Free (cache->chunks);
+
+	Z_Free (cache);
+}
+
+static void SV_UnlinkDownloadCache (dlcache_t *cache)
+{
+	dlcache_t	**prev;
+
+	for (prev = &dlcache_list; *prev; prev = &(*prev)->next)
 	{
-		byte		zOut[0xFFFF];
-		byte		*buff;
-		z_stream	z = {0};
-		int			i, j;
-		uint32		realBytes;
-		int			result;
+		if (*prev == cache)
+		{
+			*prev = cache->next;
+			break;
+		}
+	}
+
+	cache->unlinked = true;
+
+	if (!cache->refcount)
+		SV_FreeDownloadCache (cache);
+}
+
+//throw out least recently used entries nobody is downloading until needed bytes fit
+static qboolean SV_TrimDownloadCache (int needed)
+{
+	dlcache_t	*cache, *oldest;
+	int			limit;
 
-		z.next_out = zOut;
-		z.avail_out = sizeof(zOut);
+	limit = sv_download_cache->intvalue * 1024;
 
-		realBytes = 0;
+	while (dlcache_bytes + needed > limit)
+	{
+		oldest = NULL;
 
-		if (deflateInit2 (&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		for (cache = dlcache_list; cache; cache = cache->next)
 		{
-			SV_ClientPrintf (sv_client, PRINT_HIGH, "deflateInit2() failed.\n");
-			SV_DropClient (sv_client, true);
-			return;
+			if (cache->refcount)
+				continue;
+
+			if (!oldest || cache->lastused < oldest->lastused)
+				oldest = cache;
 		}
 
-		j = 0;
+		if (!oldest)
+			return false;
 
-		//r = sv_client->downloadsize - sv_client->downloadcount;
+		SV_UnlinkDownloadCache (oldest);
+	}
 
-		if (remaining > sv_client->netchan.message.buffsize - 300)
-			r = sv_client->netchan.message.buffsize - 300;
-		else
-			r = remaining;
+	return true;
+}
+
+static dlcache_t *SV_GetDownloadCache (const char *name, int filelen, int buffsize)
+{
+	dlcache_t	*cache, *next;
+	uint32		mtime;
+
+	if (sv_download_cache->intvalue <= 0)
+		return NULL;
 
-		//if (r + sv_client->datagram.cursize >= MAX_USABLEMSG)
-		//	r = MAX_USABLEMSG - sv_client->datagram.cursize - 400;
+	mtime = FS_FileModTime (name);
 
-		//if (sv_client->downloadcount >= 871224)
-		//	Sys_DebugBreak ();
+	for (cache = dlcache_list; cache; cache = next)
+	{
+		next = cache->next;
+
+		if (strcmp (cache->name, name))
+			continue;
 
-		while ( z.total_out < r )
+		//file changed on disk
+		if (cache->mtime != mtime || cache->filelen != filelen)
 		{
-			i = 300;
+			SV_UnlinkDownloadCache (cache);
+			continue;
+		}
 
-			if (sv_client->downloadcount + j + i > sv_client->downloadsize)
-				i = sv_client->downloadsize - (sv_client->downloadcount + j);
+		if (cache->buffsize == buffsize)
+		{
+			cache->refcount++;
+			cache->lastused = curtime;
+			return cache;
+		}
+	}
 
-			//in case of really good compression...
-			if (realBytes + i > 0xFFFF)
-				break;
+	if (!SV_TrimDownloadCache (0))
+		return NULL;
 
-			buff = sv_client->download + sv_client->downloadcount + j;
+	cache = Z_TagMalloc (sizeof(*cache), TAGMALLOC_DLCACHE);
+	memset (cache, 0, sizeof(*cache));
 
-			z.avail_in = i;
-			z.next_in = buff;
+	Q_strncpy (cache->name, name, sizeof(cache->name)-1);
+	cache->mtime = mtime;
+	cache->filelen = filelen;
+	cache->buffsize = buffsize;
+	cache->refcount = 1;
+	cache->lastused = curtime;
 
-			realBytes += i;
+	cache->next = dlcache_list;
+	dlcache_list = cache;
 
-			j += i;
+	return cache;
+}
 
-			result = deflate(&z, Z_SYNC_FLUSH);
-			if (result != Z_OK)
-			{
-				SV_ClientPrintf (sv_client, PRINT_HIGH, "deflate() Z_SYNC_FLUSH failed.\n");
-				SV_DropClient (sv_client, true);
-				return;
-			}
+void SV_ReleaseDownloadCache (client_t *cl)
+{
+	dlcache_t	*cache;
 
-			if (z.avail_out == 0)
-			{
-				SV_ClientPrintf (sv_client, PRINT_HIGH, "deflate() ran out of buffer space.\n");
-				SV_DropClient (sv_client, true);
-				return;
-			}
+	cache = cl->downloadCache;
+	if (!cache)
+		return;
 
-			if (sv_client->downloadcount + j == sv_client->downloadsize)
-				break;
+	cl->downloadCache = NULL;
+
+	if (!--cache->refcount && cache->unlinked)
+		SV_FreeDownloadCache (cache);
+}
+
+static void SV_AppendDownloadCache (dlcache_t *cache, uint32 realBytes, const byte *zdata, int zlen)
+{
+	dlchunk_t	*chunk;
+	void		*buff;
+	int			newsize;
+
+	if (cache->full)
+		return;
+
+	if (cache->numchunks == cache->maxchunks)
+	{
+		newsize = cache->maxchunks ? cache->maxchunks * 2 : 64;
+
+		if (!SV_TrimDownloadCache ((newsize - cache->maxchunks) * sizeof(dlchunk_t)))
+		{
+			cache->full = true;
+			return;
 		}
 
-		result = deflate(&z, Z_FINISH);
-		if (result != Z_STREAM_END)
+		buff = Z_TagMalloc (newsize * sizeof(dlchunk_t), TAGMALLOC_DLCACHE);
+		if (cache->chunks)
 		{
-			SV_ClientPrintf (sv_client, PRINT_HIGH, "deflate() Z_FINISH failed.\n");
-			SV_DropClient (sv_client, true);
+			memcpy (buff, cache->chunks, cache->numchunks * sizeof(dlchunk_t));
+			Z_Free (cache->chunks);
+		}
+
+		dlcache_bytes += (newsize - cache->maxchunks) * sizeof(dlchunk_t);
+		cache->chunks = buff;
+		cache->maxchunks = newsize;
+	}
+
+	if (cache->datalen + zlen > cache->datasize)
+	{
+		newsize = cache->datasize ? cache->datasize * 2 : 0x10000;
+		while (newsize < cache->datalen + zlen)
+			newsize *= 2;
+
+		if (!SV_TrimDownloadCache (newsize - cache->datasize))
+		{
+			cache->full = true;
 			return;
 		}
 
-		result = deflateEnd(&z);
+		buff = Z_TagMalloc (newsize, TAGMALLOC_DLCACHE);
+		if (cache->data)
+		{
+			memcpy (buff, cache->data, cache->datalen);
+			Z_Free (cache->data);
+		}
+
+		dlcache_bytes += newsize - cache->datasize;
+		cache->data = buff;
+		cache->datasize = newsize;
+	}
+
+	chunk = cache->chunks + cache->numchunks++;
+	chunk->offset = cache->endoffset;
+	chunk->realBytes = realBytes;
+	chunk->dataofs = cache->datalen;
+	chunk->zlen = zlen;
+
+	memcpy (cache->data + cache->datalen, zdata, zlen);
+	cache->datalen += zlen;
+	cache->endoffset += realBytes;
+}
+
+static const dlchunk_t *SV_FindDownloadChunk (const dlcache_t *cache, uint32 offset)
+{
+	int		lo, hi, mid;
+
+	lo = 0;
+	hi = cache->numchunks - 1;
+
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+
+		if (cache->chunks[mid].offset == offset)
+			return cache->chunks + mid;
+		else if (cache->chunks[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return NULL;
+}
+
+/*
+==================
+SV_DeflateDownloadChunk
+
+Compresses the chunk of file starting at offset into out. Returns the compressed
+size, 0 if the chunk isn't worth compressing or -1 on failure with *error set.
+==================
+*/
+static int SV_DeflateDownloadChunk (const byte *file, int filelen, int offset, int buffsize, byte *out, int outsize, uint32 *realBytes, const char **error)
+{
+	z_stream	*z;
+	int			i, j;
+	uint32		r;
+	int			remaining;
+	int			result;
+
+	*realBytes = 0;
+
+	//r1: reuse the per thread stream, setting one up costs more than a chunk
+	z = ZLibDeflateStream (Z_DEFAULT_COMPRESSION, false);
+	if (!z)
+	{
+		*error = "ZLibDeflateStream() failed.\n";
+		return -1;
+	}
+
+	z->next_out = out;
+	z->avail_out = outsize;
+
+	j = 0;
+
+	remaining = filelen - offset;
+
+	if (remaining > buffsize - 300)
+		r = buffsize - 300;
+	else
+		r = remaining;
+
+	while ( z->total_out < r )
+	{
+		i = 300;
+
+		if (offset + j + i > filelen)
+			i = filelen - (offset + j);
+
+		//in case of really good compression...
+		if (*realBytes + i > 0xFFFF)
+			break;
+
+		z->avail_in = i;
+		z->next_in = (byte *)file + offset + j;
+
+		*realBytes += i;
+
+		j += i;
+
+		result = deflate(z, Z_SYNC_FLUSH);
 		if (result != Z_OK)
 		{
-			SV_ClientPrintf (sv_client, PRINT_HIGH, "deflateEnd() failed.\n");
-			SV_DropClient (sv_client, true);
-			return;
+			*error = "deflate() Z_SYNC_FLUSH failed.\n";
+			return -1;
+		}
+
+		if (z->avail_out == 0)
+		{
+			*error = "deflate() ran out of buffer space.\n";
+			return -1;
+		}
+
+		if (offset + j == filelen)
+			break;
+	}
+
+	result = deflate(z, Z_FINISH);
+	if (result != Z_STREAM_END)
+	{
+		*error = "deflate() Z_FINISH failed.\n";
+		return -1;
+	}
+
+	if (z->total_out >= *realBytes || z->total_out >= (buffsize - 6) || *realBytes < buffsize - 100)
+		return 0;
+
+	return z->total_out;
+}
+
+void SV_DownloadCache_f (void)
+{
+	dlcache_t	*cache;
+	int			num;
+
+	num = 0;
+
+	Com_Printf ("size     chunks clients buffsize name\n"
+				"-------- ------ ------- -------- ----\n", LOG_GENERAL);
+
+	for (cache = dlcache_list; cache; cache = cache->next, num++)
+		Com_Printf ("%8d %6d %7d %8d %s%s\n", LOG_GENERAL, cache->datalen, cache->numchunks, cache->refcount, cache->buffsize, cache->name, cache->full ? " (full)" : "");
+
+	Com_Printf ("%d entries, %d bytes used\n", LOG_GENERAL, num, dlcache_bytes);
+
+#ifndef NPROFILE
+	Com_Printf ("%d chunks served from cache, %d compressed on the fly\n", LOG_GENERAL, dlcache_hits, dlcache_misses);
+#endif
+}
+#else
+void SV_ReleaseDownloadCache (client_t *cl)
+{
+}
+#endif
+
+/*
+==================
+SV_NextDownload_f
+==================
+*/
+static void SV_NextDownload_f (void)
+{
+	uint32		r;
+	int			percent;
+	int			size;
+	int			remaining;
+
+//	sizebuf_t	*queue;
+
+	if (!sv_client->download)
+		return;
+
+	remaining = sv_client->downloadsize - sv_client->downloadcount;
+	
+#ifndef NO_ZLIB
+	if (sv_client->downloadCompressed)
+	{
+		byte			zOut[0xFFFF];
+		const byte		*zData;
+		int				zLen;
+		uint32			realBytes;
+		const char		*error;
+		const dlchunk_t	*chunk;
+		dlcache_t		*cache;
+
+		cache = sv_client->downloadCache;
+		chunk = NULL;
+
+		if (cache)
+		{
+			cache->lastused = curtime;
+			chunk = SV_FindDownloadChunk (cache, sv_client->downloadcount);
 		}
 
-		if (z.total_out >= realBytes || z.total_out >= (sv_client->netchan.message.buffsize - 6) || realBytes < sv_client->netchan.message.buffsize - 100)
+		if (chunk)
+		{
+#ifndef NPROFILE
+			dlcache_hits++;
+#endif
+			zData = cache->data + chunk->dataofs;
+			zLen = chunk->zlen;
+			realBytes = chunk->realBytes;
+		}
+		else
+		{
+#ifndef NPROFILE
+			dlcache_misses++;
+#endif
+			zData = zOut;
+			zLen = SV_DeflateDownloadChunk (sv_client->download, sv_client->downloadsize, sv_client->downloadcount,
+				sv_client->netchan.message.buffsize, zOut, sizeof(zOut), &realBytes, &error);
+
+			if (zLen == -1)
+			{
+				SV_ClientPrintf (sv_client, PRINT_HIGH, "%s", error);
+				SV_DropClient (sv_client, true);
+				return;
+			}
+
+			//this client is at the end of what's been cached so far, keep the result
+			if (cache && sv_client->downloadcount == cache->endoffset)
+			{
+				if (!zLen)
+				{
+					if (remaining > sv_client->netchan.message.buffsize - 100)
+						realBytes = sv_client->netchan.message.buffsize - 100;
+					else
+						realBytes = remaining;
+				}
+				SV_AppendDownloadCache (cache, realBytes, zOut, zLen);
+			}
+		}
+
+		if (!zLen)
 			goto olddownload;
 
 		//r1: use message queue so other reliable messages put in the stream perhaps by game won't cause overflow
 		//queue = MSGQueueAlloc (sv_client, 6 + z.total_out, svc_zdownload);
 
 		MSG_BeginWriting (svc_zdownload);
-		MSG_WriteShort (z.total_out);
+		MSG_WriteShort (zLen);
 
 		size = sv_client->downloadsize;
 
@@ -1188,10 +1657,10 @@ static void SV_NextDownload_f (void)
 		MSG_WriteByte (percent);
 
 		MSG_WriteShort (realBytes);
-		MSG_Write (zOut, z.total_out);
+		MSG_Write (zData, zLen);
 		SV_AddMessage (sv_client, true);
 #ifndef NPROFILE
-		svs.proto35CompressionBytes += realBytes - z.total_out;
+		svs.proto35CompressionBytes += realBytes - zLen;
 #endif
 	}
 	else
@@ -1227,6 +1696,8 @@ olddownload:
 	if (sv_client->downloadcount != sv_client->downloadsize)
 		return;
 
+	SV_ReleaseDownloadCache (sv_client);
+
 	FS_FreeFile (sv_client->download);
 	sv_client->download = NULL;
 	sv_client->downloadsize = 0;
@@ -1447,6 +1918,8 @@ static void SV_BeginDownload_f(void)
 	{
 		Com_Printf ("WARNING: Client %s started a download '%s' with an already existing download of '%s'.\n", LOG_SERVER|LOG_WARNING, sv_client->name, name, sv_client->downloadFileName);
 
+		SV_ReleaseDownloadCache (sv_client);
+
 		FS_FreeFile (sv_client->download);
 		sv_client->download = NULL;
 
@@ -1527,7 +2000,7 @@ static void SV_BeginDownload_f(void)
 	}
 
 	//download should be ok by here
-	FS_LoadFile (name, (void **)&sv_client->download);
+	FS_LoadFileView (name, (void **)&sv_client->download);
 
 	sv_client->downloadcount = offset;
 
@@ -1552,7 +2025,10 @@ static void SV_BeginDownload_f(void)
 	//r1: r1q2 zlib udp downloads?
 #ifndef NO_ZLIB
 	if (!Q_stricmp (Cmd_Argv(3), "udp-zlib"))
+	{
 		sv_client->downloadCompressed = true;
+		sv_client->downloadCache = SV_GetDownloadCache (name, sv_client->downloadsize, sv_client->netchan.message.buffsize);
+	}
 	else
 #endif
 		sv_client->downloadCompressed = false;
@@ -43,20 +43,29 @@ typedef struct areanode_s
 	struct	areanode_s *children[2];
 	link_t	trigger_edicts;
 	link_t	solid_edicts;
+	int		depth;
 } areanode_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	32
+//r1: depth now depends on the world size (sv_areanode_size), this is just the limit
+#define	AREA_MAX_DEPTH	10
+#define	AREA_NODES		(1 << (AREA_MAX_DEPTH + 1))
 
 unsigned int		sv_tracecount;
 
 static areanode_t	sv_areanodes[AREA_NODES];
 static int			sv_numareanodes;
 
-static const float		*area_mins, *area_maxs;
-static edict_t	**area_list;
-static int		area_count, area_maxcount;
-static int		area_type;
+//r1: area queries keep their state on the stack so traces can run on workers
+typedef struct
+{
+	const float	*mins, *maxs;
+	edict_t		**list;
+	int			count, maxcount;
+	int			type;
+} areaquery_t;
+
+//serializes the shared box hull for TraceThreadSafe
+static volatile int	boxhull_lock;
 
 static int SV_HullForEntity (const edict_t *ent);
 
@@ -85,7 +94,9 @@ __inline void InsertLinkBefore (link_t *l, link_t *before)
 ===============
 SV_CreateAreaNode
 
-Builds a uniformly subdivided tree for the given world size
+Builds a subdivided tree for the given world size. r1: each node is split
+along its longest axis (including Z) until it is no bigger than
+sv_areanode_size, so big open maps get a deeper tree than small ones.
 ===============
 */
 static areanode_t *SV_CreateAreaNode (int depth, const vec3_t mins, const vec3_t maxs)
@@ -93,26 +104,35 @@ static areanode_t *SV_CreateAreaNode (int depth, const vec3_t mins, const vec3_t
 	areanode_t	*anode;
 	vec3_t		size;
 	vec3_t		mins1, maxs1, mins2, maxs2;
+	float		leafsize;
 
 	anode = &sv_areanodes[sv_numareanodes];
 	sv_numareanodes++;
 
 	ClearLink (&anode->trigger_edicts);
 	ClearLink (&anode->solid_edicts);
-	
-	if (depth == AREA_DEPTH)
+
+	anode->depth = depth;
+
+	VectorSubtract (maxs, mins, size);
+	if (size[0] >= size[1] && size[0] >= size[2])
+		anode->axis = 0;
+	else if (size[1] >= size[2])
+		anode->axis = 1;
+	else
+		anode->axis = 2;
+
+	leafsize = sv_areanode_size->value;
+	if (leafsize < 64)
+		leafsize = 64;
+
+	if (depth == AREA_MAX_DEPTH || size[anode->axis] <= leafsize)
 	{
 		anode->axis = -1;
 		anode->children[0] = anode->children[1] = NULL;
 		return anode;
 	}
 	
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1])
-		anode->axis = 0;
-	else
-		anode->axis = 1;
-	
 	anode->dist = 0.5f * (maxs[anode->axis] + mins[anode->axis]);
 
 	FastVectorCopy (*mins, mins1);	
@@ -128,6 +148,203 @@ static areanode_t *SV_CreateAreaNode (int depth, const vec3_t mins, const vec3_t
 	return anode;
 }
 
+/*
+===============================================================================
+
+CLUSTER INDEX
+
+r1: for each PVS cluster, the set of entities whose clusternums include it, so
+SV_BuildClientFrame only has to look at entities near the client instead of
+every edict. entries are updated whenever SV_LinkEdict recalculates clusters.
+unlinking leaves them alone since an unlinked entity keeps its old clusternums
+and is still sent from there. stale entries (eg freed edicts) only cost a bit
+of time, the frame builder still does the full checks on every candidate.
+===============================================================================
+*/
+
+#define	EDICT_WORDS	(MAX_EDICTS/32)
+
+static uint32		*cluster_ents;				// numclusters rows of EDICT_WORDS
+static int			*cluster_entcount;
+static int			*occupied_clusters;			// clusters with at least one entity
+static int			*occupied_index;
+static int			num_occupied;
+static int			index_numclusters;
+
+static uint32		headnode_ents[EDICT_WORDS];	// num_clusters == -1, always candidates
+static uint32		nocluster_ents[EDICT_WORDS];	// linked outside any cluster, only beams care
+
+static int			ent_numclusters[MAX_EDICTS];
+static int			ent_clusters[MAX_EDICTS][MAX_ENT_CLUSTERS];
+
+static void SV_ClearClusterIndex (void)
+{
+	if (cluster_ents)
+	{
+		Z_Free (cluster_ents);
+		Z_Free (cluster_entcount);
+		Z_Free (occupied_clusters);
+		Z_Free (occupied_index);
+		cluster_ents = NULL;
+	}
+
+	num_occupied = 0;
+	index_numclusters = CM_NumClusters;
+
+	memset (headnode_ents, 0, sizeof(headnode_ents));
+	memset (nocluster_ents, 0, sizeof(nocluster_ents));
+	memset (ent_numclusters, 0, sizeof(ent_numclusters));
+
+	if (index_numclusters <= 0)
+		return;
+
+	cluster_ents = Z_TagMalloc (index_numclusters * EDICT_WORDS * sizeof(uint32), TAGMALLOC_CLUSTERINDEX);
+	cluster_entcount = Z_TagMalloc (index_numclusters * sizeof(int), TAGMALLOC_CLUSTERINDEX);
+	occupied_clusters = Z_TagMalloc (index_numclusters * sizeof(int), TAGMALLOC_CLUSTERINDEX);
+	occupied_index = Z_TagMalloc (index_numclusters * sizeof(int), TAGMALLOC_CLUSTERINDEX);
+
+	memset (cluster_ents, 0, index_numclusters * EDICT_WORDS * sizeof(uint32));
+	memset (cluster_entcount, 0, index_numclusters * sizeof(int));
+}
+
+static void SV_ClusterAddEdict (int cluster, int num)
+{
+	cluster_ents[cluster * EDICT_WORDS + (num >> 5)] |= 1U << (num & 31);
+
+	if (!cluster_entcount[cluster]++)
+	{
+		occupied_index[cluster] = num_occupied;
+		occupied_clusters[num_occupied++] = cluster;
+	}
+}
+
+static void SV_ClusterRemoveEdict (int cluster, int num)
+{
+	int		last;
+
+	cluster_ents[cluster * EDICT_WORDS + (num >> 5)] &= ~(1U << (num & 31));
+
+	if (!--cluster_entcount[cluster])
+	{
+		last = occupied_clusters[--num_occupied];
+		occupied_clusters[occupied_index[cluster]] = last;
+		occupied_index[last] = occupied_index[cluster];
+	}
+}
+
+/*
+===============
+SV_IndexEdictClusters
+
+Brings the index in line with the clusters SV_LinkEdict just worked out.
+===============
+*/
+static void SV_IndexEdictClusters (const edict_t *ent, int num)
+{
+	int		i, n;
+	uint32	bit;
+
+	if (!cluster_ents)
+		return;
+
+	n = ent_numclusters[num];
+
+	//most relinks don't change clusters
+	if (n == ent->num_clusters && n > 0 && !memcmp (ent_clusters[num], ent->clusternums, n * sizeof(int)))
+		return;
+
+	bit = 1U << (num & 31);
+
+	if (n == -1)
+		headnode_ents[num >> 5] &= ~bit;
+	else if (n == 0)
+		nocluster_ents[num >> 5] &= ~bit;
+	else
+	{
+		for (i = 0; i < n; i++)
+			SV_ClusterRemoveEdict (ent_clusters[num][i], num);
+	}
+
+	if (ent->num_clusters == -1)
+	{
+		headnode_ents[num >> 5] |= bit;
+		ent_numclusters[num] = -1;
+		return;
+	}
+
+	n = 0;
+	for (i = 0; i < ent->num_clusters; i++)
+	{
+		if (ent->clusternums[i] < 0 || ent->clusternums[i] >= index_numclusters)
+			continue;
+
+		SV_ClusterAddEdict (ent->clusternums[i], num);
+		ent_clusters[num][n++] = ent->clusternums[i];
+	}
+
+	if (!n)
+		nocluster_ents[num >> 5] |= bit;
+
+	ent_numclusters[num] = n;
+}
+
+/*
+===============
+SV_ClusterEdicts
+
+Sets a bit in out (MAX_EDICTS bits) for every entity that may be visible from
+pvs, plus beams that may be audible from phs. Callers must still do the usual
+area / cluster checks on each of them.
+===============
+*/
+void SV_ClusterEdicts (const byte *pvs, const byte *phs, uint32 *out)
+{
+	uint32			phs_ents[EDICT_WORDS];
+	uint32			bits;
+	const uint32	*row;
+	int				i, j, c, e;
+	int				words;
+
+	if (!cluster_ents)
+	{
+		memset (out, 0xFF, EDICT_WORDS * sizeof(uint32));
+		return;
+	}
+
+	words = (ge->num_edicts + 31) >> 5;
+
+	memcpy (out, headnode_ents, sizeof(headnode_ents));
+	memcpy (phs_ents, nocluster_ents, sizeof(nocluster_ents));
+
+	for (i = 0; i < num_occupied; i++)
+	{
+		c = occupied_clusters[i];
+		row = cluster_ents + c * EDICT_WORDS;
+
+		if (pvs[c >> 3] & (1 << (c & 7)))
+			Bit_Or (out, row, words);
+		else if (phs[c >> 3] & (1 << (c & 7)))
+			Bit_Or (phs_ents, row, words);
+	}
+
+	//beams only check their first cluster against the phs
+	for (j = 0; j < words; j++)
+	{
+		bits = phs_ents[j] & ~out[j];
+		while (bits)
+		{
+			for (i = 0; !(bits & (1U << i)); i++)
+				;
+
+			bits &= ~(1U << i);
+
+			e = (j << 5) + i;
+			if (e < ge->num_edicts && (EDICT_NUM(e)->s.renderfx & RF_BEAM))
+				out[j] |= 1U << i;
+		}
+	}
+}
+
 /*
 ===============
 SV_ClearWorld
@@ -136,9 +353,13 @@ SV_ClearWorld
 */
 void SV_ClearWorld (void)
 {
+	//r1: rebuilt for every map so the tree matches its size
 	memset (sv_areanodes, 0, sizeof(sv_areanodes));
 	sv_numareanodes = 0;
 	SV_CreateAreaNode (0, sv.models[1]->mins, sv.models[1]->maxs);
+
+	SV_ClearClusterIndex ();
+	SV_ClearMulticastIndex ();
 }
 
 
@@ -443,6 +664,11 @@ void EXPORT SV_LinkEdict (edict_t *ent)
 		}
 	}
 
+	SV_IndexEdictClusters (ent, edict_number);
+
+	if (edict_number >= 1 && edict_number <= maxclients->intvalue)
+		SV_MulticastClientMoved (edict_number - 1);
+
 	// if first time, make sure old_origin is valid
 	if (!ent->linkcount)
 	{
@@ -483,14 +709,14 @@ SV_AreaEdicts_r
 
 ====================
 */
-static void SV_AreaEdicts_r (const areanode_t *node)
+static void SV_AreaEdicts_r (const areanode_t *node, areaquery_t *q)
 {
 	link_t			*l, *next;
 	const link_t	*start;
 	edict_t			*check;
 
 	// touch linked edicts
-	if (area_type == AREA_SOLID)
+	if (q->type == AREA_SOLID)
 		start = &node->solid_edicts;
 	else
 		start = &node->trigger_edicts;
@@ -502,32 +728,97 @@ static void SV_AreaEdicts_r (const areanode_t *node)
 
 		if (check->solid == SOLID_NOT)
 			continue;		// deactivated
-		if (check->absmin[0] > area_maxs[0]
-		|| check->absmin[1] > area_maxs[1]
-		|| check->absmin[2] > area_maxs[2]
-		|| check->absmax[0] < area_mins[0]
-		|| check->absmax[1] < area_mins[1]
-		|| check->absmax[2] < area_mins[2])
+		if (check->absmin[0] > q->maxs[0]
+		|| check->absmin[1] > q->maxs[1]
+		|| check->absmin[2] > q->maxs[2]
+		|| check->absmax[0] < q->mins[0]
+		|| check->absmax[1] < q->mins[1]
+		|| check->absmax[2] < q->mins[2])
 			continue;		// not touching
 
-		if (area_count == area_maxcount)
+		if (q->count == q->maxcount)
 		{
 			Com_Printf ("SV_AreaEdicts: MAXCOUNT\n", LOG_SERVER|LOG_WARNING);
 			return;
 		}
 
-		area_list[area_count] = check;
-		area_count++;
+		q->list[q->count] = check;
+		q->count++;
 	}
 	
 	if (node->axis == -1)
 		return;		// terminal node
 
 	// recurse down both sides
-	if ( area_maxs[node->axis] > node->dist )
-		SV_AreaEdicts_r ( node->children[0] );
-	if ( area_mins[node->axis] < node->dist )
-		SV_AreaEdicts_r ( node->children[1] );
+	if ( q->maxs[node->axis] > node->dist )
+		SV_AreaEdicts_r ( node->children[0], q );
+	if ( q->mins[node->axis] < node->dist )
+		SV_AreaEdicts_r ( node->children[1], q );
+}
+
+/*
+================
+SV_AreaNodes_f
+
+Shows how linked edicts are spread over the area nodes
+================
+*/
+void SV_AreaNodes_f (void)
+{
+	const areanode_t	*node;
+	const link_t		*l;
+	int					i;
+	int					solid, trigger;
+	int					total, leafs, maxdepth, maxlinks, innerlinks;
+	qboolean			all;
+
+	if (sv.state == ss_dead || !sv_numareanodes)
+	{
+		Com_Printf ("No map loaded.\n", LOG_GENERAL);
+		return;
+	}
+
+	all = !strcmp (Cmd_Argv(1), "all");
+
+	total = leafs = maxdepth = maxlinks = innerlinks = 0;
+
+	Com_Printf ("node depth axis     dist solid trigger\n"
+				"---- ----- ---- -------- ----- -------\n", LOG_GENERAL);
+
+	for (i = 0, node = sv_areanodes; i < sv_numareanodes; i++, node++)
+	{
+		solid = trigger = 0;
+
+		for (l = node->solid_edicts.next; l != &node->solid_edicts; l = l->next)
+			solid++;
+
+		for (l = node->trigger_edicts.next; l != &node->trigger_edicts; l = l->next)
+			trigger++;
+
+		if (node->axis == -1)
+			leafs++;
+		else
+			innerlinks += solid + trigger;
+
+		if (node->depth > maxdepth)
+			maxdepth = node->depth;
+
+		if (solid + trigger > maxlinks)
+			maxlinks = solid + trigger;
+
+		total += solid + trigger;
+
+		if (!all && !solid && !trigger)
+			continue;
+
+		if (node->axis == -1)
+			Com_Printf ("%4d %5d leaf %8s %5d %7d\n", LOG_GENERAL, i, node->depth, "", solid, trigger);
+		else
+			Com_Printf ("%4d %5d %4c %8.1f %5d %7d\n", LOG_GENERAL, i, node->depth, "xyz"[node->axis], node->dist, solid, trigger);
+	}
+
+	Com_Printf ("%d nodes (%d leafs, max depth %d), %d links, %d on inner nodes, at most %d in one node.\n", LOG_GENERAL,
+		sv_numareanodes, leafs, maxdepth, total, innerlinks, maxlinks);
 }
 
 /*
@@ -538,17 +829,115 @@ SV_AreaEdicts
 int EXPORT SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list,
 	int maxcount, int areatype)
 {
-	area_mins = mins;
-	area_maxs = maxs;
-	area_list = list;
-	area_count = 0;
-	area_maxcount = maxcount;
-	area_type = areatype;
+	areaquery_t	q;
+
+	q.mins = mins;
+	q.maxs = maxs;
+	q.list = list;
+	q.count = 0;
+	q.maxcount = maxcount;
+	q.type = areatype;
 
 	//area_recursions = 0;
-	SV_AreaEdicts_r (sv_areanodes);
+	SV_AreaEdicts_r (sv_areanodes, &q);
 
-	return area_count;
+	return q.count;
+}
+
+typedef struct
+{
+	const float	*origin;
+	float		radius;
+	vec3_t		mins, maxs;
+	edict_t		**list;
+	int			count;
+	int			maxcount;
+} radiusquery_t;
+
+static void SV_RadiusLinks (const link_t *start, radiusquery_t *q)
+{
+	const link_t	*l;
+	edict_t			*check;
+	vec3_t			eorg;
+	int				j;
+
+	for (l = start->next; l != start; l = l->next)
+	{
+		check = EDICT_FROM_AREA(l);
+
+		if (check->solid == SOLID_NOT)
+			continue;
+		if (check->absmin[0] > q->maxs[0]
+		|| check->absmin[1] > q->maxs[1]
+		|| check->absmin[2] > q->maxs[2]
+		|| check->absmax[0] < q->mins[0]
+		|| check->absmax[1] < q->mins[1]
+		|| check->absmax[2] < q->mins[2])
+			continue;
+
+		//r1: same test as the game's findradius so results match it exactly
+		for (j = 0; j < 3; j++)
+			eorg[j] = q->origin[j] - (check->s.origin[j] + (check->mins[j] + check->maxs[j]) * 0.5);
+		if (VectorLength (eorg) > q->radius)
+			continue;
+
+		if (q->count == q->maxcount)
+		{
+			Com_Printf ("SV_RadiusEdicts: MAXCOUNT\n", LOG_SERVER|LOG_WARNING);
+			return;
+		}
+
+		q->list[q->count++] = check;
+	}
+}
+
+static void SV_RadiusEdicts_r (const areanode_t *node, radiusquery_t *q)
+{
+	SV_RadiusLinks (&node->solid_edicts, q);
+	SV_RadiusLinks (&node->trigger_edicts, q);
+
+	if (node->axis == -1)
+		return;
+
+	if (q->maxs[node->axis] > node->dist)
+		SV_RadiusEdicts_r (node->children[0], q);
+	if (q->mins[node->axis] < node->dist)
+		SV_RadiusEdicts_r (node->children[1], q);
+}
+
+/*
+================
+SV_RadiusEdicts
+
+Sphere query for the game's findradius.  The center of an edict's bbox is
+always inside its absbox, so the sphere's bounding box only has to overlap
+absmin/absmax for the edict to be a candidate.  Unlike SV_AreaEdicts this
+keeps no static state, the game may call it from inside a findradius loop.
+================
+*/
+int EXPORT SV_RadiusEdicts (vec3_t origin, float radius, edict_t **list, int maxcount)
+{
+	radiusquery_t	q;
+	int				i;
+
+	if (!origin || !list || sv.state == ss_dead)
+		return 0;
+
+	q.origin = origin;
+	q.radius = radius;
+	q.list = list;
+	q.count = 0;
+	q.maxcount = maxcount;
+
+	for (i = 0; i < 3; i++)
+	{
+		q.mins[i] = origin[i] - radius;
+		q.maxs[i] = origin[i] + radius;
+	}
+
+	SV_RadiusEdicts_r (sv_areanodes, &q);
+
+	return q.count;
 }
 
 
@@ -602,6 +991,7 @@ typedef struct
 	trace_t		trace;
 	edict_t		*passedict;
 	int			contentmask;
+	qboolean	threadsafe;		// lock the box hull, may be on a worker
 } moveclip_t;
 
 
@@ -679,6 +1069,17 @@ static void SV_ClipMoveToEntities (moveclip_t *clip )
 		&& (touch->svflags & SVF_DEADMONSTER) )
 				continue;
 
+		//r1: there is only one box hull, it can't be built for two traces at once
+		if (clip->threadsafe && touch->solid != SOLID_BSP)
+		{
+			// the box brush is always CONTENTS_MONSTER, skip it before locking
+			if (!(clip->contentmask & CONTENTS_MONSTER))
+				continue;
+
+			while (!Sys_CompareAndSwap (&boxhull_lock, 0, 1))
+				;
+		}
+
 		// might intersect, so do an exact clip
 		headnode = SV_HullForEntity (touch);
 		angles = touch->s.angles;
@@ -694,6 +1095,12 @@ static void SV_ClipMoveToEntities (moveclip_t *clip )
 				clip->mins, clip->maxs, headnode,  clip->contentmask,
 				touch->s.origin, angles);
 
+		if (clip->threadsafe && touch->solid != SOLID_BSP)
+		{
+			Sys_MemoryBarrier ();
+			boxhull_lock = 0;
+		}
+
 		if (trace.allsolid || trace.startsolid ||
 		trace.fraction < clip->trace.fraction)
 		{
@@ -763,36 +1170,13 @@ Passedict and edicts owned by passedict are explicitly not checked.
 
 ==================
 */
-trace_t EXPORT SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int contentmask)
+static trace_t SV_ClipTrace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int contentmask, qboolean threadsafe)
 {
 	int			i;
 	moveclip_t	clip;
 
-	if (!mins)
-		mins = vec3_origin;
-
-	if (!maxs)
-		maxs = vec3_origin;
-
 	memset ( &clip, 0, sizeof ( moveclip_t ) );
 
-	//r1: server-side hax for bad looping traces
-	if (++sv_tracecount >= sv_max_traces_per_frame->intvalue)
-	{
-		Com_Printf ("GAME ERROR: Bad SV_Trace: %u calls in a single frame, aborting!\n", LOG_SERVER|LOG_GAMEDEBUG|LOG_ERROR, sv_tracecount);
-		if (sv_gamedebug->intvalue >= 2)
-			Sys_DebugBreak ();
-
-		clip.trace.fraction = 1.0;
-		clip.trace.ent = ge->edicts;
-		FastVectorCopy (*end, clip.trace.endpos);
-		//this is really nasty, attempts to overwrite source in Game DLL. may result in flying players and ents if it uses an origin
-		//directly!! we may even crash here if we are given a write protected start.
-		FastVectorCopy (*end, *start);
-		sv_tracecount = 0;
-		return clip.trace;
-	}
-
 	// clip to world
 	clip.trace = CM_BoxTrace (start, end, mins, maxs, 0, contentmask);
 	clip.trace.ent = ge->edicts;
@@ -806,6 +1190,7 @@ trace_t EXPORT SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edi
 	clip.mins = mins;
 	clip.maxs = maxs;
 	clip.passedict = passedict;
+	clip.threadsafe = threadsafe;
 
 	FastVectorCopy (*mins, clip.mins2);
 	FastVectorCopy (*maxs, clip.maxs2);
@@ -831,3 +1216,55 @@ trace_t EXPORT SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edi
 
 	return clip.trace;
 }
+
+trace_t EXPORT SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int contentmask)
+{
+	trace_t		trace;
+
+	if (!mins)
+		mins = vec3_origin;
+
+	if (!maxs)
+		maxs = vec3_origin;
+
+	//r1: server-side hax for bad looping traces
+	if (++sv_tracecount >= sv_max_traces_per_frame->intvalue)
+	{
+		Com_Printf ("GAME ERROR: Bad SV_Trace: %u calls in a single frame, aborting!\n", LOG_SERVER|LOG_GAMEDEBUG|LOG_ERROR, sv_tracecount);
+		if (sv_gamedebug->intvalue >= 2)
+			Sys_DebugBreak ();
+
+		memset (&trace, 0, sizeof(trace));
+		trace.fraction = 1.0;
+		trace.ent = ge->edicts;
+		FastVectorCopy (*end, trace.endpos);
+		//this is really nasty, attempts to overwrite source in Game DLL. may result in flying players and ents if it uses an origin
+		//directly!! we may even crash here if we are given a write protected start.
+		FastVectorCopy (*end, *start);
+		sv_tracecount = 0;
+		return trace;
+	}
+
+	return SV_ClipTrace (start, mins, maxs, end, passedict, contentmask, false);
+}
+
+/*
+==================
+SV_TraceThreadSafe
+
+SV_Trace for the game's RunWorkers jobs.  Safe to call from several threads
+at once as long as nothing is linking or moving edicts meanwhile, which is
+true while RunWorkers is running since the game thread is one of the
+workers.  Not counted towards sv_max_traces_per_frame.
+==================
+*/
+trace_t EXPORT SV_TraceThreadSafe (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int contentmask)
+{
+	if (!mins)
+		mins = vec3_origin;
+
+	if (!maxs)
+		maxs = vec3_origin;
+
+	return SV_ClipTrace (start, mins, maxs, end, passedict, contentmask, true);
+}
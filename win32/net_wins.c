@@ -152,6 +152,15 @@ int	NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 
 //=============================================================================
 
+//r1: no sendmmsg on windows, packets always go out immediately
+void NET_BeginPacketBatch (netsrc_t sock)
+{
+}
+
+void NET_FlushPacketBatch (netsrc_t sock)
+{
+}
+
 int NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t *to)
 {
 //	char *z;
@@ -370,6 +370,234 @@ void Sys_DebugBreak (void)
 	DebugBreak ();
 }
 
+/*
+================
+Worker threads
+
+r1: see q_shlinux.c. XP has no condition variables so each worker gets its own
+auto-reset start event and the last one to finish signals the caller.
+================
+*/
+
+static HANDLE			workers[MAX_WORKER_THREADS];
+static HANDLE			work_start[MAX_WORKER_THREADS];
+static HANDLE			work_done;
+static int				num_workers;
+
+static void				(*work_func)(int job);
+static int				work_count;
+static volatile LONG	work_next;
+static volatile LONG	work_busy;
+static volatile int		work_quit;
+
+static void Sys_TakeJobs (void)
+{
+	int		job;
+
+	while ((job = InterlockedIncrement (&work_next) - 1) < work_count)
+		work_func (job);
+}
+
+static DWORD WINAPI Sys_WorkerThread (LPVOID arg)
+{
+	int		index;
+
+	index = (int)(INT_PTR)arg;
+
+	for (;;)
+	{
+		WaitForSingleObject (work_start[index], INFINITE);
+
+		if (work_quit)
+			break;
+
+		Sys_TakeJobs ();
+
+		if (!InterlockedDecrement (&work_busy))
+			SetEvent (work_done);
+	}
+
+	Com_ThreadExit ();
+
+	return 0;
+}
+
+void Sys_ShutdownWorkers (void)
+{
+	int		i;
+
+	if (!num_workers)
+		return;
+
+	work_quit = true;
+
+	for (i = 0; i < num_workers; i++)
+		SetEvent (work_start[i]);
+
+	WaitForMultipleObjects (num_workers, workers, TRUE, INFINITE);
+
+	for (i = 0; i < num_workers; i++)
+	{
+		CloseHandle (workers[i]);
+		CloseHandle (work_start[i]);
+	}
+
+	CloseHandle (work_done);
+
+	num_workers = 0;
+	work_quit = false;
+}
+
+int Sys_InitWorkers (int numthreads)
+{
+	Sys_ShutdownWorkers ();
+
+	if (numthreads > MAX_WORKER_THREADS)
+		numthreads = MAX_WORKER_THREADS;
+
+	if (numthreads <= 0)
+		return 0;
+
+	work_done = CreateEvent (NULL, FALSE, FALSE, NULL);
+
+	while (num_workers < numthreads)
+	{
+		work_start[num_workers] = CreateEvent (NULL, FALSE, FALSE, NULL);
+		workers[num_workers] = CreateThread (NULL, 0, Sys_WorkerThread, (LPVOID)(INT_PTR)num_workers, 0, NULL);
+		if (!workers[num_workers])
+		{
+			Com_Printf ("Sys_InitWorkers: CreateThread failed (%u)\n", LOG_GENERAL|LOG_WARNING, (unsigned)GetLastError());
+			CloseHandle (work_start[num_workers]);
+			break;
+		}
+		num_workers++;
+	}
+
+	if (!num_workers)
+		CloseHandle (work_done);
+
+	return num_workers;
+}
+
+int Sys_NumWorkers (void)
+{
+	return num_workers;
+}
+
+void Sys_RunWorkers (void (*func)(int job), int numjobs)
+{
+	int		i;
+
+	if (!num_workers || numjobs < 2)
+	{
+		for (i = 0; i < numjobs; i++)
+			func (i);
+		return;
+	}
+
+	work_func = func;
+	work_count = numjobs;
+	work_next = 0;
+	work_busy = num_workers;
+
+	for (i = 0; i < num_workers; i++)
+		SetEvent (work_start[i]);
+
+	Sys_TakeJobs ();
+
+	WaitForSingleObject (work_done, INFINITE);
+}
+
+/*
+================
+Sys_StartThread
+
+r1: a plain background thread for things that don't fit the worker pool, eg
+the async log writer. returns NULL on failure.
+================
+*/
+typedef struct
+{
+	HANDLE		thread;
+	void		(*func)(void *arg);
+	void		*arg;
+} systhread_t;
+
+static DWORD WINAPI Sys_ThreadMain (LPVOID arg)
+{
+	systhread_t	*t;
+
+	t = (systhread_t *)arg;
+	t->func (t->arg);
+
+	Com_ThreadExit ();
+
+	return 0;
+}
+
+void *Sys_StartThread (void (*func)(void *arg), void *arg)
+{
+	systhread_t	*t;
+
+	t = malloc (sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->func = func;
+	t->arg = arg;
+
+	t->thread = CreateThread (NULL, 0, Sys_ThreadMain, t, 0, NULL);
+	if (!t->thread)
+	{
+		Com_Printf ("Sys_StartThread: CreateThread failed (%u)\n", LOG_GENERAL|LOG_WARNING, (unsigned)GetLastError());
+		free (t);
+		return NULL;
+	}
+
+	return t;
+}
+
+void Sys_JoinThread (void *thread)
+{
+	systhread_t	*t;
+
+	t = (systhread_t *)thread;
+
+	WaitForSingleObject (t->thread, INFINITE);
+	CloseHandle (t->thread);
+	free (t);
+}
+
+void *Sys_CreateSignal (void)
+{
+	return CreateEvent (NULL, FALSE, FALSE, NULL);
+}
+
+void Sys_DestroySignal (void *sig)
+{
+	CloseHandle ((HANDLE)sig);
+}
+
+void Sys_SetSignal (void *sig)
+{
+	SetEvent ((HANDLE)sig);
+}
+
+qboolean Sys_WaitSignal (void *sig, int msec)
+{
+	return WaitForSingleObject ((HANDLE)sig, msec < 0 ? INFINITE : (DWORD)msec) == WAIT_OBJECT_0;
+}
+
+qboolean Sys_CompareAndSwap (volatile int *value, int oldvalue, int newvalue)
+{
+	return InterlockedCompareExchange ((volatile LONG *)value, newvalue, oldvalue) == oldvalue;
+}
+
+void Sys_MemoryBarrier (void)
+{
+	MemoryBarrier ();
+}
+
 /*
 ::/ \::::::.
 :/___\:::::::.